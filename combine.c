@@ -0,0 +1,436 @@
+/**
+ * @file    combine.c
+ * @brief   Per-pixel combination of image cube slices
+ *
+ * Combines the slices of a cube pixel by pixel, as for master darks and
+ * flats : median, or sigma-clipped mean, of each pixel along the third
+ * axis. NaN and Inf values are ignored.
+ *
+ * The cube is processed in tiles of contiguous pixels x all slices, read
+ * slice by slice (contiguous reads) into a slice-major buffer sized to
+ * stay in cache. Tiles are independent and processed in parallel.
+ *
+ * For up to INFO_COMBINE_NETWORK_MAX slices, medians are computed by a
+ * sorting network (Batcher odd-even merge sort) applied to all pixels of
+ * the tile at once : each comparator is a min/max over two buffer rows,
+ * a branch-free loop the compiler vectorizes. Non-finite values are set
+ * to +Inf and sort last. For deeper cubes, each pixel column is copied
+ * and its median found by selection (select.h).
+ *
+ * The clipped mean follows sigclip.c : values outside mean +/- nsigma.rms
+ * are rejected, until the kept set no longer changes or after maxiter
+ * iterations. Median follows robust.c, value of rank n/2.
+ *
+ */
+
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+
+#include "CommandLineInterface/CLIcore.h"
+#include "COREMOD_memory/COREMOD_memory.h"
+
+#include "info/pixstats.h"
+#include "info/select.h"
+#include "info/combine.h"
+
+
+
+
+// largest number of slices sorted by network
+#define INFO_COMBINE_NETWORK_MAX 256
+
+// tile buffer size, in doubles
+#define INFO_COMBINE_TILESIZE 32768
+
+
+
+// nbpix contiguous pixels of a slice, to buffer row
+// non-finite values are set to +Inf
+#define INFO_COMBINE_GATHER(TS, PIXTYPE, DTYPE, SUMTYPE, SQTYPE,              \
+                            PIXMIN, PIXMAX, ISFLOAT)                          \
+static void combine_gather_##TS(                                              \
+    const PIXTYPE *restrict array,                                            \
+    long                    nbpix,                                            \
+    double        *restrict row                                               \
+)                                                                             \
+{                                                                             \
+    for(long j = 0; j < nbpix; j++)                                           \
+    {                                                                         \
+        double v = (double) array[j];                                         \
+        if(ISFLOAT && !isfinite(v))                                           \
+        {                                                                     \
+            v = INFINITY;                                                     \
+        }                                                                     \
+        row[j] = v;                                                           \
+    }                                                                         \
+}
+
+INFO_PIXSTATS_TYPELIST(INFO_COMBINE_GATHER)
+
+
+
+
+// comparators of Batcher odd-even merge sort for n elements
+// pairs written to cmp if not NULL, returns number of comparators
+static long combine_network(
+    long  n,
+    long *cmp
+)
+{
+    long NBcmp = 0;
+
+    for(long p = 1; p < n; p <<= 1)
+    {
+        for(long k = p; k >= 1; k >>= 1)
+        {
+            for(long j = k % p; j + k < n; j += 2 * k)
+            {
+                for(long i = 0; (i < k) && (i + j + k < n); i++)
+                {
+                    if((i + j) / (2 * p) == (i + j + k) / (2 * p))
+                    {
+                        if(cmp != NULL)
+                        {
+                            cmp[2 * NBcmp] = i + j;
+                            cmp[2 * NBcmp + 1] = i + j + k;
+                        }
+                        NBcmp++;
+                    }
+                }
+            }
+        }
+    }
+
+    return NBcmp;
+}
+
+
+
+
+// compare-exchange of two buffer rows : a[j] <= b[j]
+static inline void combine_minmax(
+    double *restrict a,
+    double *restrict b,
+    long             nbj
+)
+{
+    INFO_PRAGMA_SIMD()
+    for(long j = 0; j < nbj; j++)
+    {
+        double x = a[j];
+        double y = b[j];
+        double lo = (x < y) ? x : y;
+        double hi = (x < y) ? y : x;
+        a[j] = lo;
+        b[j] = hi;
+    }
+}
+
+
+
+
+// sort each column of slice-major buffer (n rows of stride T, nbj columns)
+static void combine_network_sort(
+    double     *buffer,
+    long        T,
+    long        nbj,
+    const long *cmp,
+    long        NBcmp
+)
+{
+    for(long c = 0; c < NBcmp; c++)
+    {
+        combine_minmax(buffer + cmp[2 * c] * T, buffer + cmp[2 * c + 1] * T, nbj);
+    }
+}
+
+
+
+
+// sigma-clipped mean of n finite values
+static double combine_clipmean(
+    const double *v,
+    long          n,
+    double        nsigma,
+    int           maxiter
+)
+{
+    double lo = -INFINITY;
+    double hi = INFINITY;
+    double mean = NAN;
+    long   cntprev = -1;
+
+    if(n == 0)
+    {
+        return NAN;
+    }
+
+    // sums relative to first value, for accuracy
+    double v0 = v[0];
+
+    for(int iter = 0; iter <= maxiter; iter++)
+    {
+        double sum = 0.0;
+        double sum2 = 0.0;
+        long   cnt = 0;
+
+        for(long i = 0; i < n; i++)
+        {
+            if((v[i] >= lo) && (v[i] <= hi))
+            {
+                double d = v[i] - v0;
+                sum += d;
+                sum2 += d * d;
+                cnt++;
+            }
+        }
+        if((cnt == 0) || (cnt == cntprev))
+        {
+            break;
+        }
+        cntprev = cnt;
+
+        double dmean = sum / cnt;
+        double var = sum2 / cnt - dmean * dmean;
+        double rms = (var > 0.0) ? sqrt(var) : 0.0;
+
+        mean = v0 + dmean;
+        lo = mean - nsigma * rms;
+        hi = mean + nsigma * rms;
+    }
+
+    return mean;
+}
+
+
+
+
+/**
+ * @brief Combine slices of 3D image ID pixel by pixel into IDout
+ *
+ * IDout is a float image of at least xsize x ysize pixels. method is
+ * INFO_COMBINE_MEDIAN or INFO_COMBINE_CLIPMEAN (nsigma, maxiter used for
+ * the latter only). Pixels with no finite value are set to NaN.
+ */
+errno_t info_combine_compute(
+    imageID  ID,
+    int      method,
+    double   nsigma,
+    int      maxiter,
+    imageID  IDout
+)
+{
+    uint8_t  datatype = data.image[ID].md[0].datatype;
+    uint64_t xysize;
+    long     zsize;
+
+    if(data.image[ID].md[0].naxis != 3)
+    {
+        PRINT_ERROR("3D image required");
+        return RETURN_FAILURE;
+    }
+    if(info_pixstats_datatype_supported(datatype) == 0)
+    {
+        PRINT_ERROR("datatype %d not supported", (int) datatype);
+        return RETURN_FAILURE;
+    }
+    if((method != INFO_COMBINE_MEDIAN) && (method != INFO_COMBINE_CLIPMEAN))
+    {
+        PRINT_ERROR("unknown combine method %d", method);
+        return RETURN_FAILURE;
+    }
+
+    xysize = (uint64_t) data.image[ID].md[0].size[0] * data.image[ID].md[0].size[1];
+    zsize = data.image[ID].md[0].size[2];
+
+    if((data.image[IDout].md[0].datatype != _DATATYPE_FLOAT)
+            || (data.image[IDout].md[0].nelement < xysize))
+    {
+        PRINT_ERROR("output image size does not match");
+        return RETURN_FAILURE;
+    }
+
+    // tile width, multiple of 8 pixels
+    long T = (INFO_COMBINE_TILESIZE / zsize) & ~7L;
+    if(T < 8)
+    {
+        T = 8;
+    }
+    long NBtile = (xysize + T - 1) / T;
+
+    long *cmp = NULL;
+    long  NBcmp = 0;
+    int   usenetwork = (method == INFO_COMBINE_MEDIAN)
+                       && (zsize <= INFO_COMBINE_NETWORK_MAX);
+    if(usenetwork)
+    {
+        NBcmp = combine_network(zsize, NULL);
+        cmp = (long *) malloc(sizeof(long) * 2 * (NBcmp + 1));
+        if(cmp == NULL)
+        {
+            PRINT_ERROR("malloc error");
+            return RETURN_FAILURE;
+        }
+        combine_network(zsize, cmp);
+    }
+
+    int NBthreads = info_pixstats_get_NBthreads();
+    (void) NBthreads;
+    int allocerr = 0;
+
+#ifdef _OPENMP
+    #pragma omp parallel num_threads(NBthreads) if(NBtile > 1)
+#endif
+    {
+        double *buffer = (double *) malloc(sizeof(double) * T * zsize);
+        double *column = (double *) malloc(sizeof(double) * zsize);
+        if((buffer == NULL) || (column == NULL))
+        {
+            PRINT_ERROR("malloc error");
+#ifdef _OPENMP
+            #pragma omp atomic write
+#endif
+            allocerr = 1;
+        }
+
+#ifdef _OPENMP
+        #pragma omp for schedule(dynamic)
+#endif
+        for(long tile = 0; tile < NBtile; tile++)
+        {
+            int skip;
+#ifdef _OPENMP
+            #pragma omp atomic read
+#endif
+            skip = allocerr;
+            if(skip)
+            {
+                continue;
+            }
+
+            uint64_t j0 = (uint64_t) tile * T;
+            long     nbj = T;
+            if(j0 + nbj > xysize)
+            {
+                nbj = xysize - j0;
+            }
+
+            for(long kk = 0; kk < zsize; kk++)
+            {
+                uint64_t offset = (uint64_t) kk * xysize + j0;
+                switch(datatype)
+                {
+#define INFO_COMBINE_CASE_GATHER(TS, PIXTYPE, DTYPE, ...)                           \
+                    case DTYPE:                                                     \
+                        combine_gather_##TS(data.image[ID].array.TS + offset,       \
+                                            nbj, buffer + kk * T);                  \
+                        break;
+                        INFO_PIXSTATS_TYPELIST(INFO_COMBINE_CASE_GATHER)
+#undef INFO_COMBINE_CASE_GATHER
+                }
+            }
+
+            float *out = data.image[IDout].array.F + j0;
+
+            if(usenetwork)
+            {
+                combine_network_sort(buffer, T, nbj, cmp, NBcmp);
+
+                for(long j = 0; j < nbj; j++)
+                {
+                    // finite values are first in sorted column
+                    long n = zsize;
+                    while((n > 0) && (buffer[(n - 1) * T + j] == INFINITY))
+                    {
+                        n--;
+                    }
+                    out[j] = (n > 0) ? (float) buffer[(n / 2) * T + j] : NAN;
+                }
+                continue;
+            }
+
+            for(long j = 0; j < nbj; j++)
+            {
+                long n = 0;
+                for(long kk = 0; kk < zsize; kk++)
+                {
+                    double v = buffer[kk * T + j];
+                    if(v != INFINITY)
+                    {
+                        column[n++] = v;
+                    }
+                }
+
+                if(n == 0)
+                {
+                    out[j] = NAN;
+                }
+                else if(method == INFO_COMBINE_MEDIAN)
+                {
+                    out[j] = (float) info_select_double(column, n, n / 2);
+                }
+                else
+                {
+                    out[j] = (float) combine_clipmean(column, n, nsigma, maxiter);
+                }
+            }
+        }
+
+        free(buffer);
+        free(column);
+    }
+
+    free(cmp);
+
+    if(allocerr)
+    {
+        return RETURN_FAILURE;
+    }
+
+    return RETURN_SUCCESS;
+}
+
+
+
+
+/**
+ * @brief Combine slices of 3D image into new 2D image IDout_name
+ *
+ * method : INFO_COMBINE_MEDIAN (0) or INFO_COMBINE_CLIPMEAN (1).
+ */
+imageID info_image_combine(
+    const char *ID_name,
+    int         method,
+    double      nsigma,
+    int         maxiter,
+    const char *IDout_name
+)
+{
+    imageID ID, IDout;
+
+    ID = image_ID(ID_name);
+    if(ID == -1)
+    {
+        PRINT_ERROR("image %s not found", ID_name);
+        return -1;
+    }
+    if(data.image[ID].md[0].naxis != 3)
+    {
+        PRINT_ERROR("image %s : 3D image required", ID_name);
+        return -1;
+    }
+
+    IDout = create_2Dimage_ID(IDout_name, data.image[ID].md[0].size[0],
+                              data.image[ID].md[0].size[1]);
+    if(info_combine_compute(ID, method, nsigma, maxiter, IDout) != RETURN_SUCCESS)
+    {
+        delete_image_ID(IDout_name);
+        return -1;
+    }
+
+    return IDout;
+}
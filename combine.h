@@ -0,0 +1,34 @@
+/**
+ * @file    combine.h
+ * @brief   Per-pixel combination of image cube slices
+ *
+ */
+
+#if !defined(INFO_COMBINE_H)
+#define INFO_COMBINE_H
+
+
+// combine methods
+#define INFO_COMBINE_MEDIAN    0
+#define INFO_COMBINE_CLIPMEAN  1  // sigma-clipped mean
+
+
+
+errno_t info_combine_compute(
+    imageID  ID,
+    int      method,
+    double   nsigma,
+    int      maxiter,
+    imageID  IDout
+);
+
+imageID info_image_combine(
+    const char *ID_name,
+    int         method,
+    double      nsigma,
+    int         maxiter,
+    const char *IDout_name
+);
+
+
+#endif
@@ -0,0 +1,708 @@
+/**
+ * @file    covar.c
+ * @brief   Incremental pixel-to-pixel temporal covariance
+ *
+ * Accumulates the temporal covariance matrix of the pixels of a mask over
+ * frames of a cube or live stream, without keeping the frames.
+ *
+ * Frames are buffered in blocks of blocksize frames. Each full block X
+ * (blocksize x N) is added to the sum of products as a symmetric rank-k
+ * update C += X^T X, computed on the packed lower triangle only. C is
+ * processed in square tiles small enough to stay in cache while the block
+ * frames stream through, tile rows being updated in parallel. Each element
+ * is updated by a single thread in frame order, so results do not depend
+ * on the number of threads.
+ *
+ * For live streams, each full block can instead be added by a separate
+ * thread while the next block is acquired into a second buffer
+ * (info_covar_async). Blocks are still added one at a time in frame order.
+ *
+ * For accuracy, the first frame is subtracted from all frames before
+ * accumulation ; the covariance is formed from shifted sums at the end.
+ * Covariance is normalized by the number of frames. NaN and Inf pixels
+ * are replaced by the first frame value, i.e. count as no deviation.
+ *
+ */
+
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <errno.h>
+#include <pthread.h>
+#include <semaphore.h>
+
+#include "CommandLineInterface/CLIcore.h"
+#include "COREMOD_memory/COREMOD_memory.h"
+
+#include "info/pixstats.h"
+#include "info/pixmask.h"
+#include "info/covar.h"
+
+
+
+
+// side of square tiles of covariance matrix
+#define INFO_COVAR_TILE 64
+
+// default number of frames per rank-k update
+#define INFO_COVAR_BLOCKSIZE 64
+
+
+
+// length contiguous pixels to double
+#define INFO_COVAR_GATHER(TS, PIXTYPE, DTYPE, SUMTYPE, SQTYPE,                \
+                          PIXMIN, PIXMAX, ISFLOAT)                            \
+static void covar_gather_##TS(                                                \
+    const PIXTYPE *restrict array,                                            \
+    uint64_t                length,                                           \
+    double        *restrict out                                               \
+)                                                                             \
+{                                                                             \
+    for(uint64_t ii = 0; ii < length; ii++)                                   \
+    {                                                                         \
+        out[ii] = (double) array[ii];                                         \
+    }                                                                         \
+}
+
+INFO_PIXSTATS_TYPELIST(INFO_COVAR_GATHER)
+
+
+
+
+// packed lower triangle index of row i
+static inline uint64_t covar_row(
+    uint64_t i
+)
+{
+    return i * (i + 1) / 2;
+}
+
+
+
+
+/**
+ * @brief Initialize accumulator for N pixels
+ *
+ * blocksize is the number of frames per rank-k update, default if <= 0.
+ */
+errno_t info_covar_init(
+    INFO_COVAR *covar,
+    uint64_t    N,
+    long        blocksize
+)
+{
+    if(blocksize <= 0)
+    {
+        blocksize = INFO_COVAR_BLOCKSIZE;
+    }
+
+    covar->N = N;
+    covar->NBframe = 0;
+    covar->blocksize = blocksize;
+    covar->NBbuf = 0;
+    covar->ref = (double *) calloc(N + 1, sizeof(double));
+    covar->sum = (double *) calloc(N + 1, sizeof(double));
+    covar->packed = (double *) calloc(covar_row(N) + 1, sizeof(double));
+    covar->buffer = (double *) malloc(sizeof(double) * N * blocksize + 1);
+    covar->abuffer = NULL;
+    covar->NBabuf = 0;
+    covar->busy = 0;
+
+    if((covar->ref == NULL) || (covar->sum == NULL) || (covar->packed == NULL)
+            || (covar->buffer == NULL))
+    {
+        PRINT_ERROR("malloc error");
+        info_covar_free(covar);
+        return RETURN_FAILURE;
+    }
+
+    return RETURN_SUCCESS;
+}
+
+
+
+
+/**
+ * @brief Add full blocks in a separate thread
+ *
+ * Allocates a second block buffer. When a block is full, it is swapped
+ * with the second buffer and added by an update thread, while frames are
+ * added to the other buffer. Waits for the previous update first, so
+ * blocks are added in order and results are unchanged.
+ */
+errno_t info_covar_async(
+    INFO_COVAR *covar
+)
+{
+    if(covar->abuffer != NULL)
+    {
+        return RETURN_SUCCESS;
+    }
+
+    covar->abuffer = (double *) malloc(sizeof(double) * covar->N * covar->blocksize + 1);
+    if(covar->abuffer == NULL)
+    {
+        PRINT_ERROR("malloc error");
+        return RETURN_FAILURE;
+    }
+
+    return RETURN_SUCCESS;
+}
+
+
+
+
+static void *covar_update_thread(
+    void *ptr
+)
+{
+    INFO_COVAR *covar = (INFO_COVAR *) ptr;
+
+    info_covar_rankk(covar->packed, covar->abuffer, covar->N, covar->NBabuf);
+
+    return NULL;
+}
+
+
+
+
+// wait for update thread, if running
+static void covar_wait(
+    INFO_COVAR *covar
+)
+{
+    if(covar->busy)
+    {
+        pthread_join(covar->thread, NULL);
+        covar->busy = 0;
+    }
+}
+
+
+
+
+// hand full buffer to update thread
+static errno_t covar_flush_async(
+    INFO_COVAR *covar
+)
+{
+    covar_wait(covar);
+
+    double *buffer = covar->abuffer;
+    covar->abuffer = covar->buffer;
+    covar->buffer = buffer;
+    covar->NBabuf = covar->NBbuf;
+    covar->NBbuf = 0;
+
+    if(pthread_create(&covar->thread, NULL, covar_update_thread, covar) != 0)
+    {
+        // no thread : update in calling thread
+        info_covar_rankk(covar->packed, covar->abuffer, covar->N, covar->NBabuf);
+        return RETURN_SUCCESS;
+    }
+    covar->busy = 1;
+
+    return RETURN_SUCCESS;
+}
+
+
+
+
+/**
+ * @brief Add frame starting at pixel offset of image ID
+ *
+ * Pixels are those selected by pixmask (spans relative to offset), or N
+ * contiguous pixels if pixmask is NULL. The mask must select N pixels.
+ */
+errno_t info_covar_add_frame(
+    INFO_COVAR         *covar,
+    imageID             ID,
+    uint64_t            offset,
+    const INFO_PIXMASK *pixmask
+)
+{
+    uint8_t  datatype = data.image[ID].md[0].datatype;
+    uint64_t N = covar->N;
+    double  *x = covar->buffer + (uint64_t) covar->NBbuf * N;
+
+    if(info_pixstats_datatype_supported(datatype) == 0)
+    {
+        PRINT_ERROR("datatype %d not supported", (int) datatype);
+        return RETURN_FAILURE;
+    }
+    if((pixmask != NULL) && (pixmask->NBpix != N))
+    {
+        PRINT_ERROR("mask selects %lu pixels, %lu expected",
+                    (unsigned long) pixmask->NBpix, (unsigned long) N);
+        return RETURN_FAILURE;
+    }
+
+    long     NBspan = (pixmask == NULL) ? 1 : pixmask->NBspan;
+    uint64_t ii = 0;
+    for(long spanindex = 0; spanindex < NBspan; spanindex++)
+    {
+        uint64_t start = 0;
+        uint64_t length = N;
+        if(pixmask != NULL)
+        {
+            start = pixmask->span[spanindex].start;
+            length = pixmask->span[spanindex].length;
+        }
+
+        switch(datatype)
+        {
+#define INFO_COVAR_CASE_GATHER(TS, PIXTYPE, DTYPE, ...)                             \
+            case DTYPE:                                                             \
+                covar_gather_##TS(data.image[ID].array.TS + offset + start, length, \
+                                  x + ii);                                          \
+                break;
+                INFO_PIXSTATS_TYPELIST(INFO_COVAR_CASE_GATHER)
+#undef INFO_COVAR_CASE_GATHER
+        }
+        ii += length;
+    }
+
+    if(covar->NBframe == 0)
+    {
+        for(ii = 0; ii < N; ii++)
+        {
+            covar->ref[ii] = isfinite(x[ii]) ? x[ii] : 0.0;
+        }
+    }
+
+    for(ii = 0; ii < N; ii++)
+    {
+        double v = x[ii] - covar->ref[ii];
+        if(!isfinite(v))
+        {
+            v = 0.0;
+        }
+        x[ii] = v;
+        covar->sum[ii] += v;
+    }
+
+    covar->NBframe++;
+    covar->NBbuf++;
+    if(covar->NBbuf == covar->blocksize)
+    {
+        if(covar->abuffer != NULL)
+        {
+            return covar_flush_async(covar);
+        }
+        return info_covar_flush(covar);
+    }
+
+    return RETURN_SUCCESS;
+}
+
+
+
+
+/**
+ * @brief Symmetric rank-k update of packed lower triangle
+ *
+ * packed += X^T X, X being nbf vectors of N values stored contiguously in
+ * buffer (nbf x N).
+ */
+errno_t info_covar_rankk(
+    double       *packed,
+    const double *buffer,
+    uint64_t      N,
+    long          nbf
+)
+{
+    long NBtile = (N + INFO_COVAR_TILE - 1) / INFO_COVAR_TILE;
+
+    if(nbf == 0)
+    {
+        return RETURN_SUCCESS;
+    }
+
+    int NBthreads = info_pixstats_get_NBthreads();
+    (void) NBthreads;
+
+    // tile rows, longest first
+#ifdef _OPENMP
+    #pragma omp parallel for schedule(dynamic, 1) num_threads(NBthreads) if(NBtile > 1)
+#endif
+    for(long ti = NBtile - 1; ti >= 0; ti--)
+    {
+        uint64_t i0 = (uint64_t) ti * INFO_COVAR_TILE;
+        uint64_t i1 = i0 + INFO_COVAR_TILE;
+        if(i1 > N)
+        {
+            i1 = N;
+        }
+
+        for(long tj = 0; tj <= ti; tj++)
+        {
+            uint64_t j0 = (uint64_t) tj * INFO_COVAR_TILE;
+            uint64_t j1 = j0 + INFO_COVAR_TILE;
+
+            for(long f = 0; f < nbf; f++)
+            {
+                const double *x = buffer + (uint64_t) f * N;
+
+                for(uint64_t i = i0; i < i1; i++)
+                {
+                    double       *Ci = packed + covar_row(i);
+                    const double  xi = x[i];
+                    uint64_t      jend = (j1 < i + 1) ? j1 : i + 1;
+
+                    INFO_PRAGMA_SIMD()
+                    for(uint64_t j = j0; j < jend; j++)
+                    {
+                        Ci[j] += xi * x[j];
+                    }
+                }
+            }
+        }
+    }
+
+    return RETURN_SUCCESS;
+}
+
+
+
+
+/**
+ * @brief Add buffered frames to sum of products
+ *
+ * Waits for the update thread, if any.
+ */
+errno_t info_covar_flush(
+    INFO_COVAR *covar
+)
+{
+    covar_wait(covar);
+    info_covar_rankk(covar->packed, covar->buffer, covar->N, covar->NBbuf);
+    covar->NBbuf = 0;
+
+    return RETURN_SUCCESS;
+}
+
+
+
+
+/**
+ * @brief Covariance matrix of frames accumulated so far
+ *
+ * matrix receives N x N values (symmetric). Flushes buffered frames.
+ */
+errno_t info_covar_matrix(
+    INFO_COVAR *covar,
+    double     *matrix
+)
+{
+    uint64_t N = covar->N;
+
+    if(covar->NBframe == 0)
+    {
+        PRINT_ERROR("no frame accumulated");
+        return RETURN_FAILURE;
+    }
+    info_covar_flush(covar);
+
+    double n = (double) covar->NBframe;
+    for(uint64_t i = 0; i < N; i++)
+    {
+        const double *Ci = covar->packed + covar_row(i);
+        double        mi = covar->sum[i] / n;
+
+        for(uint64_t j = 0; j <= i; j++)
+        {
+            double c = Ci[j] / n - mi * (covar->sum[j] / n);
+            matrix[i * N + j] = c;
+            matrix[j * N + i] = c;
+        }
+    }
+
+    return RETURN_SUCCESS;
+}
+
+
+
+
+errno_t info_covar_free(
+    INFO_COVAR *covar
+)
+{
+    covar_wait(covar);
+    free(covar->ref);
+    free(covar->sum);
+    free(covar->packed);
+    free(covar->buffer);
+    free(covar->abuffer);
+    covar->ref = NULL;
+    covar->sum = NULL;
+    covar->packed = NULL;
+    covar->buffer = NULL;
+    covar->abuffer = NULL;
+
+    return RETURN_SUCCESS;
+}
+
+
+
+
+// pixel mask of frame xsize x ysize from image IDmask_name (pixels > 0.5),
+// or all pixels if IDmask_name is NULL or empty
+static errno_t covar_build_mask(
+    INFO_PIXMASK *pixmask,
+    const char   *IDmask_name,
+    uint32_t      xsize,
+    uint32_t      ysize
+)
+{
+    if((IDmask_name != NULL) && (IDmask_name[0] != '\0'))
+    {
+        imageID IDmask = image_ID(IDmask_name);
+        if(IDmask == -1)
+        {
+            PRINT_ERROR("mask image %s not found", IDmask_name);
+            return RETURN_FAILURE;
+        }
+        if((data.image[IDmask].md[0].size[0] != xsize)
+                || (data.image[IDmask].md[0].nelement < (uint64_t) xsize * ysize))
+        {
+            PRINT_ERROR("mask image %s size does not match", IDmask_name);
+            return RETURN_FAILURE;
+        }
+        if(info_pixmask_build_image(pixmask, IDmask) != RETURN_SUCCESS)
+        {
+            return RETURN_FAILURE;
+        }
+        if(pixmask->NBspan > 0)
+        {
+            // first plane of a mask cube
+            INFO_PIXSPAN *last = &pixmask->span[pixmask->NBspan - 1];
+            if(last->start + last->length > (uint64_t) xsize * ysize)
+            {
+                PRINT_ERROR("mask image %s size does not match", IDmask_name);
+                info_pixmask_free(pixmask);
+                return RETURN_FAILURE;
+            }
+        }
+        return RETURN_SUCCESS;
+    }
+
+    return info_pixmask_build_roi(pixmask, xsize, ysize, 0, xsize, 0, ysize);
+}
+
+
+
+
+// write covariance to new N x N double image
+static imageID covar_write(
+    INFO_COVAR *covar,
+    const char *IDout_name
+)
+{
+    imageID IDout = create_2Dimage_ID_double(IDout_name, covar->N, covar->N);
+
+    if(info_covar_matrix(covar, data.image[IDout].array.D) != RETURN_SUCCESS)
+    {
+        delete_image_ID(IDout_name);
+        return -1;
+    }
+
+    return IDout;
+}
+
+
+
+
+/**
+ * @brief Temporal covariance of the mask pixels of a 3D image
+ *
+ * Mask pixels > 0.5 are used, all pixels if IDmask_name is NULL or empty.
+ * Output IDout_name is N x N, N being the number of pixels in the mask,
+ * in mask pixel order.
+ */
+imageID info_image_covar(
+    const char *ID_name,
+    const char *IDmask_name,
+    long        blocksize,
+    const char *IDout_name
+)
+{
+    imageID      ID, IDout;
+    INFO_PIXMASK pixmask;
+    INFO_COVAR   covar;
+
+    ID = image_ID(ID_name);
+    if(ID == -1)
+    {
+        PRINT_ERROR("image %s not found", ID_name);
+        return -1;
+    }
+    if(data.image[ID].md[0].naxis != 3)
+    {
+        PRINT_ERROR("image %s : 3D image required", ID_name);
+        return -1;
+    }
+
+    uint32_t xsize = data.image[ID].md[0].size[0];
+    uint32_t ysize = data.image[ID].md[0].size[1];
+    uint64_t xysize = (uint64_t) xsize * ysize;
+
+    if(covar_build_mask(&pixmask, IDmask_name, xsize, ysize) != RETURN_SUCCESS)
+    {
+        return -1;
+    }
+    if(info_covar_init(&covar, pixmask.NBpix, blocksize) != RETURN_SUCCESS)
+    {
+        info_pixmask_free(&pixmask);
+        return -1;
+    }
+
+    IDout = -1;
+    errno_t ret = RETURN_SUCCESS;
+    for(uint32_t kk = 0; (kk < data.image[ID].md[0].size[2]) && (ret == RETURN_SUCCESS); kk++)
+    {
+        ret = info_covar_add_frame(&covar, ID, kk * xysize, &pixmask);
+    }
+    if(ret == RETURN_SUCCESS)
+    {
+        IDout = covar_write(&covar, IDout_name);
+    }
+
+    info_covar_free(&covar);
+    info_pixmask_free(&pixmask);
+
+    return IDout;
+}
+
+
+
+
+/**
+ * @brief Temporal covariance of the mask pixels of a live stream
+ *
+ * Waits on semaphore sem of stream ID_name and accumulates NBframe new
+ * frames, then writes the covariance to IDout_name as info_image_covar().
+ * For a 3D stream used as a circular buffer, the frame is slice cnt1.
+ *
+ * Semaphore posts with no new frame (unchanged cnt0) are skipped, frames
+ * overwritten before being read are counted as missed. Full blocks are
+ * added in a separate thread (info_covar_async), so that acquisition
+ * does not wait for the rank-k updates. SIGINT ends acquisition early,
+ * the covariance is then computed from the frames accumulated so far.
+ */
+imageID info_covar_stream(
+    const char *ID_name,
+    const char *IDmask_name,
+    int         sem,
+    long        NBframe,
+    long        blocksize,
+    const char *IDout_name
+)
+{
+    imageID      ID, IDout;
+    INFO_PIXMASK pixmask;
+    INFO_COVAR   covar;
+
+    ID = image_ID(ID_name);
+    if(ID == -1)
+    {
+        PRINT_ERROR("stream %s not found", ID_name);
+        return -1;
+    }
+    if((sem < 0) || (sem >= data.image[ID].md[0].sem))
+    {
+        PRINT_ERROR("stream %s has no semaphore %d", ID_name, sem);
+        return -1;
+    }
+    if(NBframe < 1)
+    {
+        PRINT_ERROR("number of frames must be > 0");
+        return -1;
+    }
+
+    uint32_t xsize = data.image[ID].md[0].size[0];
+    uint32_t ysize = (data.image[ID].md[0].naxis > 1) ? data.image[ID].md[0].size[1] : 1;
+    uint64_t xysize = (uint64_t) xsize * ysize;
+
+    if(covar_build_mask(&pixmask, IDmask_name, xsize, ysize) != RETURN_SUCCESS)
+    {
+        return -1;
+    }
+    if(info_covar_init(&covar, pixmask.NBpix, blocksize) != RETURN_SUCCESS)
+    {
+        info_pixmask_free(&pixmask);
+        return -1;
+    }
+    if(info_covar_async(&covar) != RETURN_SUCCESS)
+    {
+        info_covar_free(&covar);
+        info_pixmask_free(&pixmask);
+        return -1;
+    }
+
+    // discard frames posted before start
+    while(sem_trywait(data.image[ID].semptr[sem]) == 0)
+    {
+    }
+
+    uint64_t cntin = data.image[ID].md[0].cnt0;
+    uint64_t NBmissed = 0;
+    long     frame = 0;
+    errno_t  ret = RETURN_SUCCESS;
+
+    while((frame < NBframe) && (ret == RETURN_SUCCESS))
+    {
+        if(data.signal_INT == 1)
+        {
+            break;
+        }
+        if(sem_wait(data.image[ID].semptr[sem]) == -1)
+        {
+            if(errno == EINTR)
+            {
+                continue;
+            }
+            PRINT_ERROR("sem_wait error on stream %s", ID_name);
+            ret = RETURN_FAILURE;
+            break;
+        }
+
+        // posts that piled up during a flush carry no new frame
+        uint64_t cnt0 = data.image[ID].md[0].cnt0;
+        if(cnt0 == cntin)
+        {
+            continue;
+        }
+        if(cnt0 > cntin + 1)
+        {
+            NBmissed += cnt0 - cntin - 1;
+        }
+        cntin = cnt0;
+
+        uint64_t offset = 0;
+        if(data.image[ID].md[0].naxis == 3)
+        {
+            offset = (uint64_t) data.image[ID].md[0].cnt1 * xysize;
+        }
+        ret = info_covar_add_frame(&covar, ID, offset, &pixmask);
+        frame++;
+    }
+
+    if(NBmissed > 0)
+    {
+        printf("%s : %lu frames missed\n", ID_name, (unsigned long) NBmissed);
+    }
+
+    IDout = -1;
+    if(ret == RETURN_SUCCESS)
+    {
+        IDout = covar_write(&covar, IDout_name);
+    }
+
+    info_covar_free(&covar);
+    info_pixmask_free(&pixmask);
+
+    return IDout;
+}
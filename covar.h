@@ -0,0 +1,91 @@
+/**
+ * @file    covar.h
+ * @brief   Incremental pixel-to-pixel temporal covariance
+ *
+ */
+
+#if !defined(INFO_COVAR_H)
+#define INFO_COVAR_H
+
+#include <pthread.h>
+
+#include "info/pixmask.h"
+
+
+typedef struct
+{
+    uint64_t  N;          // number of pixels
+    uint64_t  NBframe;    // number of frames accumulated
+
+    double   *ref;        // first frame, subtracted from all frames
+    double   *sum;        // sum of frames, minus ref
+    double   *packed;     // sum of products, minus ref, packed lower triangle
+
+    long      blocksize;  // frames per rank-k update
+    long      NBbuf;      // frames waiting in buffer
+    double   *buffer;     // blocksize frames x N
+
+    // asynchronous updates, see info_covar_async()
+    double   *abuffer;    // block being added by update thread, NULL if synchronous
+    long      NBabuf;     // frames in abuffer
+    int       busy;       // update thread running
+    pthread_t thread;
+} INFO_COVAR;
+
+
+
+errno_t info_covar_rankk(
+    double       *packed,
+    const double *buffer,
+    uint64_t      N,
+    long          nbf
+);
+
+errno_t info_covar_init(
+    INFO_COVAR *covar,
+    uint64_t    N,
+    long        blocksize
+);
+
+errno_t info_covar_async(
+    INFO_COVAR *covar
+);
+
+errno_t info_covar_add_frame(
+    INFO_COVAR         *covar,
+    imageID             ID,
+    uint64_t            offset,
+    const INFO_PIXMASK *pixmask
+);
+
+errno_t info_covar_flush(
+    INFO_COVAR *covar
+);
+
+errno_t info_covar_matrix(
+    INFO_COVAR *covar,
+    double     *matrix
+);
+
+errno_t info_covar_free(
+    INFO_COVAR *covar
+);
+
+imageID info_image_covar(
+    const char *ID_name,
+    const char *IDmask_name,
+    long        blocksize,
+    const char *IDout_name
+);
+
+imageID info_covar_stream(
+    const char *ID_name,
+    const char *IDmask_name,
+    int         sem,
+    long        NBframe,
+    long        blocksize,
+    const char *IDout_name
+);
+
+
+#endif
@@ -0,0 +1,456 @@
+/**
+ * @file    cubecorr.c
+ * @brief   Temporal correlation of image cube slices versus frame lag
+ *
+ * For each lag kc, the normalized correlation between slices kk and kk+kc
+ * (sum of pixel products divided by the slice norms, over pixels within the
+ * mask), averaged over all slice pairs.
+ *
+ * Once slices are divided by their norm, the sum over slice pairs and
+ * pixels is the sum over pixels of the temporal autocorrelation of each
+ * pixel. Each pixel time series is zero-padded and Fourier transformed,
+ * power spectra are summed over pixels, and a single inverse transform
+ * gives the correlation for all lags. Cost is N Z log Z instead of
+ * N Z kcmax for the direct sum over slice pairs.
+ *
+ * Pixels are processed in blocks, each transformed by a single batched
+ * FFTW plan. The block size only depends on the padded series length. Blocks are assigned to a fixed number of lanes, so the result
+ * does not depend on the number of threads.
+ *
+ */
+
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+
+#include <fftw3.h>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+#include "CommandLineInterface/CLIcore.h"
+#include "COREMOD_memory/COREMOD_memory.h"
+
+#include "info/pixstats.h"
+#include "info/pixmask.h"
+#include "info/cubecorr.h"
+
+
+
+
+// maximum number of pixel time series per FFT batch
+#define INFO_CUBECORR_BLOCKSIZE 64
+
+// at most this number of samples per FFT batch, so that per-thread buffers
+// stay at about 16 MB for long cubes : fewer series per batch when L is large
+#define INFO_CUBECORR_BLOCKMAXSAMPLE 1048576
+
+// number of independent power spectrum accumulators
+#define INFO_CUBECORR_NBLANE 16
+
+
+
+// time series of pixels idx[0..nbpix-1] of slice at array, scaled, written
+// with stride L ; non-finite pixels are set to 0
+#define INFO_CUBECORR_GATHER(TS, PIXTYPE, DTYPE, SUMTYPE, SQTYPE,             \
+                             PIXMIN, PIXMAX, ISFLOAT)                         \
+static void cubecorr_gather_##TS(                                             \
+    const PIXTYPE  *restrict array,                                           \
+    const uint64_t *restrict idx,                                             \
+    long                     nbpix,                                           \
+    double                   scale,                                           \
+    double         *restrict buffer,                                          \
+    long                     L                                                \
+)                                                                             \
+{                                                                             \
+    for(long j = 0; j < nbpix; j++)                                           \
+    {                                                                         \
+        double v = (double) array[idx[j]];                                    \
+        if(ISFLOAT && !isfinite(v))                                           \
+        {                                                                     \
+            v = 0.0;                                                          \
+        }                                                                     \
+        buffer[j * L] = v * scale;                                            \
+    }                                                                         \
+}
+
+INFO_PIXSTATS_TYPELIST(INFO_CUBECORR_GATHER)
+
+
+
+
+/**
+ * @brief Slice correlation versus lag for a 3D image
+ *
+ * corr[kc] for kc = 0 ... kcmax-1 is the normalized correlation between
+ * slices kk and kk+kc, averaged over kk. Only pixels selected by pixmask
+ * are used, or all pixels if pixmask is NULL. NaN and Inf pixels count as
+ * 0. Slices with zero norm are ignored : the average is over pairs of
+ * non-zero slices only, NaN for lags with no such pair.
+ */
+errno_t info_cubecorr_compute(
+    imageID             ID,
+    const INFO_PIXMASK *pixmask,
+    long                kcmax,
+    double             *corr
+)
+{
+    uint8_t      datatype = data.image[ID].md[0].datatype;
+    uint64_t     xysize;
+    long         zsize;
+    INFO_PIXMASK rangemask;
+
+    if(data.image[ID].md[0].naxis != 3)
+    {
+        PRINT_ERROR("3D image required");
+        return RETURN_FAILURE;
+    }
+    if(info_pixstats_datatype_supported(datatype) == 0)
+    {
+        PRINT_ERROR("datatype %d not supported", (int) datatype);
+        return RETURN_FAILURE;
+    }
+
+    xysize = (uint64_t) data.image[ID].md[0].size[0] * data.image[ID].md[0].size[1];
+    zsize = data.image[ID].md[0].size[2];
+
+    for(long kc = 0; kc < kcmax; kc++)
+    {
+        corr[kc] = NAN;
+    }
+    if(kcmax > zsize)
+    {
+        kcmax = zsize;
+    }
+
+    if(pixmask == NULL)
+    {
+        if(info_pixmask_build_range(&rangemask, xysize) != RETURN_SUCCESS)
+        {
+            return RETURN_FAILURE;
+        }
+        pixmask = &rangemask;
+    }
+
+
+    // slice norms over mask
+    double *scale = (double *) malloc(sizeof(double) * zsize);
+    // flat list of selected pixels
+    uint64_t *idx = (uint64_t *) malloc(sizeof(uint64_t) * (pixmask->NBpix + 1));
+    if((scale == NULL) || (idx == NULL))
+    {
+        PRINT_ERROR("malloc error");
+        free(scale);
+        free(idx);
+        if(pixmask == &rangemask)
+        {
+            info_pixmask_free(&rangemask);
+        }
+        return RETURN_FAILURE;
+    }
+
+    for(long kk = 0; kk < zsize; kk++)
+    {
+        INFO_PIXSTATS pixstats;
+
+        info_pixstats_compute(ID, kk * xysize, xysize, pixmask, &pixstats);
+        scale[kk] = (pixstats.ssquare > 0.0) ? 1.0 / sqrt(pixstats.ssquare) : 0.0;
+    }
+
+    uint64_t NBpix = 0;
+    for(long spanindex = 0; spanindex < pixmask->NBspan; spanindex++)
+    {
+        for(uint64_t ii = 0; ii < pixmask->span[spanindex].length; ii++)
+        {
+            idx[NBpix++] = pixmask->span[spanindex].start + ii;
+        }
+    }
+    if(pixmask == &rangemask)
+    {
+        info_pixmask_free(&rangemask);
+    }
+
+
+    // zero-padded length for linear correlation up to lag kcmax-1
+    long L = 1;
+    while(L < zsize + kcmax)
+    {
+        L *= 2;
+    }
+    long Lc = L / 2 + 1;
+    long blocksize = INFO_CUBECORR_BLOCKMAXSAMPLE / L;
+    if(blocksize > INFO_CUBECORR_BLOCKSIZE)
+    {
+        blocksize = INFO_CUBECORR_BLOCKSIZE;
+    }
+    if(blocksize < 1)
+    {
+        blocksize = 1;
+    }
+    long NBblock = (NBpix + blocksize - 1) / blocksize;
+    int  NBlane = INFO_CUBECORR_NBLANE;
+    if(NBlane > NBblock)
+    {
+        NBlane = NBblock;
+    }
+
+    // power spectrum per lane, followed by their sum
+    double *power = (double *) calloc((size_t) Lc * (NBlane + 1), sizeof(double));
+    double *tbuffer = (double *) fftw_malloc(sizeof(double) * L * blocksize);
+    fftw_complex *fbuffer = (fftw_complex *) fftw_malloc(sizeof(fftw_complex) * Lc *
+                            blocksize);
+    // number of slice pairs per lag
+    double *npair = (double *) malloc(sizeof(double) * (kcmax + 1));
+    if((power == NULL) || (tbuffer == NULL) || (fbuffer == NULL) || (npair == NULL))
+    {
+        PRINT_ERROR("malloc error");
+        free(scale);
+        free(idx);
+        free(power);
+        free(npair);
+        fftw_free(tbuffer);
+        fftw_free(fbuffer);
+        return RETURN_FAILURE;
+    }
+
+    // plans are created once, and executed on per-thread arrays
+    int n[1] = { (int) L };
+    fftw_plan plan = fftw_plan_many_dft_r2c(1, n, blocksize,
+                                            tbuffer, NULL, 1, L,
+                                            fbuffer, NULL, 1, Lc, FFTW_ESTIMATE);
+    fftw_plan planinv = fftw_plan_dft_c2r_1d(L, fbuffer, tbuffer, FFTW_ESTIMATE);
+
+    // number of pairs of non-zero slices per lag : autocorrelation of the
+    // slice validity sequence, through the same transforms
+    memset(tbuffer, 0, sizeof(double) * L * blocksize);
+    for(long kk = 0; kk < zsize; kk++)
+    {
+        tbuffer[kk] = (scale[kk] > 0.0) ? 1.0 : 0.0;
+    }
+    fftw_execute(plan);
+    for(long q = 0; q < Lc; q++)
+    {
+        fbuffer[q][0] = fbuffer[q][0] * fbuffer[q][0] + fbuffer[q][1] * fbuffer[q][1];
+        fbuffer[q][1] = 0.0;
+    }
+    fftw_execute(planinv);
+    for(long kc = 0; kc < kcmax; kc++)
+    {
+        npair[kc] = floor(tbuffer[kc] / L + 0.5);
+    }
+
+    int NBthreads = info_pixstats_get_NBthreads();
+    (void) NBthreads;
+    int allocerr = 0;
+
+#ifdef _OPENMP
+    #pragma omp parallel num_threads(NBthreads) if(NBlane > 1)
+#endif
+    {
+        double       *tbuf = (double *) fftw_malloc(sizeof(double) * L * blocksize);
+        fftw_complex *fbuf = (fftw_complex *) fftw_malloc(sizeof(fftw_complex) * Lc *
+                             blocksize);
+        if((tbuf == NULL) || (fbuf == NULL))
+        {
+            PRINT_ERROR("malloc error");
+#ifdef _OPENMP
+            #pragma omp atomic write
+#endif
+            allocerr = 1;
+        }
+
+#ifdef _OPENMP
+        #pragma omp for schedule(dynamic)
+#endif
+        for(int lane = 0; lane < NBlane; lane++)
+        {
+            double *lpower = power + (size_t) Lc * lane;
+            int     skip;
+
+#ifdef _OPENMP
+            #pragma omp atomic read
+#endif
+            skip = allocerr;
+            if(skip)
+            {
+                continue;
+            }
+
+            for(long block = lane; block < NBblock; block += NBlane)
+            {
+                uint64_t j0 = (uint64_t) block * blocksize;
+                long     nbj = blocksize;
+                if(j0 + nbj > NBpix)
+                {
+                    nbj = NBpix - j0;
+                }
+
+                memset(tbuf, 0, sizeof(double) * L * blocksize);
+                for(long kk = 0; kk < zsize; kk++)
+                {
+                    switch(datatype)
+                    {
+#define INFO_CUBECORR_CASE_GATHER(TS, PIXTYPE, DTYPE, ...)                          \
+                        case DTYPE:                                                 \
+                            cubecorr_gather_##TS(data.image[ID].array.TS + kk * xysize, \
+                                                 idx + j0, nbj, scale[kk],          \
+                                                 tbuf + kk, L);                     \
+                            break;
+                            INFO_PIXSTATS_TYPELIST(INFO_CUBECORR_CASE_GATHER)
+#undef INFO_CUBECORR_CASE_GATHER
+                    }
+                }
+
+                fftw_execute_dft_r2c(plan, tbuf, fbuf);
+
+                for(long j = 0; j < nbj; j++)
+                {
+                    const fftw_complex *f = fbuf + j * Lc;
+                    for(long q = 0; q < Lc; q++)
+                    {
+                        lpower[q] += f[q][0] * f[q][0] + f[q][1] * f[q][1];
+                    }
+                }
+            }
+        }
+
+        fftw_free(tbuf);
+        fftw_free(fbuf);
+    }
+
+    if(allocerr)
+    {
+        fftw_destroy_plan(plan);
+        fftw_destroy_plan(planinv);
+        fftw_free(tbuffer);
+        fftw_free(fbuffer);
+        free(power);
+        free(npair);
+        free(scale);
+        free(idx);
+        return RETURN_FAILURE;
+    }
+
+    // sum lanes in fixed order, back to lag domain
+    double *ptot = power + (size_t) Lc * NBlane;
+    for(int lane = 0; lane < NBlane; lane++)
+    {
+        for(long q = 0; q < Lc; q++)
+        {
+            ptot[q] += power[(size_t) Lc * lane + q];
+        }
+    }
+    for(long q = 0; q < Lc; q++)
+    {
+        fbuffer[q][0] = ptot[q];
+        fbuffer[q][1] = 0.0;
+    }
+    fftw_execute(planinv);
+
+    for(long kc = 0; kc < kcmax; kc++)
+    {
+        corr[kc] = (npair[kc] > 0.0) ? tbuffer[kc] / L / npair[kc] : NAN;
+    }
+
+    fftw_destroy_plan(plan);
+    fftw_destroy_plan(planinv);
+    fftw_free(tbuffer);
+    fftw_free(fbuffer);
+    free(power);
+    free(npair);
+    free(scale);
+    free(idx);
+
+    return RETURN_SUCCESS;
+}
+
+
+
+
+/**
+ * @brief Write slice correlation versus lag to file, one line per lag 1 ... kcmax-1
+ *
+ * Mask pixels > 0.5 are used ; IDmask_name can be NULL or empty for no mask.
+ */
+errno_t info_cubecorr(
+    const char *ID_name,
+    const char *IDmask_name,
+    long        kcmax,
+    const char *outfname
+)
+{
+    imageID      ID;
+    INFO_PIXMASK pixmask;
+    INFO_PIXMASK *pmask = NULL;
+    FILE        *fp;
+
+    ID = image_ID(ID_name);
+    if(ID == -1)
+    {
+        PRINT_ERROR("image %s not found", ID_name);
+        return RETURN_FAILURE;
+    }
+
+    if((IDmask_name != NULL) && (IDmask_name[0] != '\0'))
+    {
+        imageID IDmask = image_ID(IDmask_name);
+        if(IDmask == -1)
+        {
+            PRINT_ERROR("mask image %s not found", IDmask_name);
+            return RETURN_FAILURE;
+        }
+        if((data.image[IDmask].md[0].size[0] != data.image[ID].md[0].size[0])
+                || (data.image[IDmask].md[0].size[1] != data.image[ID].md[0].size[1]))
+        {
+            PRINT_ERROR("mask image %s size does not match image %s",
+                        IDmask_name, ID_name);
+            return RETURN_FAILURE;
+        }
+        if(info_pixmask_build_image(&pixmask, IDmask) != RETURN_SUCCESS)
+        {
+            return RETURN_FAILURE;
+        }
+        pmask = &pixmask;
+    }
+
+    double *corr = (double *) malloc(sizeof(double) * (kcmax + 1));
+    if(corr == NULL)
+    {
+        PRINT_ERROR("malloc error");
+        if(pmask != NULL)
+        {
+            info_pixmask_free(pmask);
+        }
+        return RETURN_FAILURE;
+    }
+
+    errno_t ret = info_cubecorr_compute(ID, pmask, kcmax, corr);
+    if(pmask != NULL)
+    {
+        info_pixmask_free(pmask);
+    }
+
+    if(ret == RETURN_SUCCESS)
+    {
+        if((fp = fopen(outfname, "w")) == NULL)
+        {
+            PRINT_ERROR("cannot create file %s", outfname);
+            ret = RETURN_FAILURE;
+        }
+        else
+        {
+            for(long kc = 1; kc < kcmax; kc++)
+            {
+                fprintf(fp, "%3ld   %g\n", kc, corr[kc]);
+            }
+            fclose(fp);
+        }
+    }
+    free(corr);
+
+    return ret;
+}
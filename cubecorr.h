@@ -0,0 +1,28 @@
+/**
+ * @file    cubecorr.h
+ * @brief   Temporal correlation of image cube slices versus frame lag
+ *
+ */
+
+#if !defined(INFO_CUBECORR_H)
+#define INFO_CUBECORR_H
+
+#include "info/pixmask.h"
+
+
+errno_t info_cubecorr_compute(
+    imageID             ID,
+    const INFO_PIXMASK *pixmask,
+    long                kcmax,
+    double             *corr
+);
+
+errno_t info_cubecorr(
+    const char *ID_name,
+    const char *IDmask_name,
+    long        kcmax,
+    const char *outfname
+);
+
+
+#endif
@@ -0,0 +1,389 @@
+/**
+ * @file    cubepsd.c
+ * @brief   Per-pixel temporal power spectral density of image cubes
+ *
+ * The PSD of each pixel time series along the cube third axis is estimated
+ * with Welch's method : segments of seglen slices overlapping by half are
+ * mean-subtracted, multiplied by a Hann window and Fourier transformed,
+ * and power spectra are averaged over segments.
+ *
+ * Pixels are processed in blocks of contiguous pixels. For each segment,
+ * a block is read slice by slice (contiguous reads) into a time-major
+ * buffer, so the cube is transposed one cache-sized tile at a time, and
+ * the block time series are transformed by a single batched FFTW plan.
+ * Blocks are independent and processed in parallel, each writing its own
+ * pixels of the output cube.
+ *
+ * PSD is one-sided, in units of pixel value squared per frequency unit :
+ * the sum of PSD x df over frequencies is the mean square of the windowed,
+ * mean-subtracted signal.
+ *
+ */
+
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+
+#include <fftw3.h>
+
+#include "CommandLineInterface/CLIcore.h"
+#include "COREMOD_memory/COREMOD_memory.h"
+
+#include "info/pixstats.h"
+#include "info/cubepsd.h"
+
+
+
+
+// number of pixel time series per FFT batch
+#define INFO_CUBEPSD_BLOCKSIZE 64
+
+
+
+// nbpix contiguous pixels of slice at array, written with stride L
+// non-finite pixels are set to 0
+#define INFO_CUBEPSD_GATHER(TS, PIXTYPE, DTYPE, SUMTYPE, SQTYPE,              \
+                            PIXMIN, PIXMAX, ISFLOAT)                          \
+static void cubepsd_gather_##TS(                                              \
+    const PIXTYPE *restrict array,                                            \
+    long                    nbpix,                                            \
+    double        *restrict buffer,                                           \
+    long                    L                                                 \
+)                                                                             \
+{                                                                             \
+    for(long j = 0; j < nbpix; j++)                                           \
+    {                                                                         \
+        double v = (double) array[j];                                         \
+        if(ISFLOAT && !isfinite(v))                                           \
+        {                                                                     \
+            v = 0.0;                                                          \
+        }                                                                     \
+        buffer[j * L] = v;                                                    \
+    }                                                                         \
+}
+
+INFO_PIXSTATS_TYPELIST(INFO_CUBEPSD_GATHER)
+
+
+
+
+/**
+ * @brief Welch PSD of each pixel of 3D image ID
+ *
+ * IDpsd is a float image of xsize x ysize x (seglen/2+1) : slice q is the
+ * PSD map at frequency q x fsample / seglen. seglen is the number of
+ * slices per segment, at most the cube depth.
+ */
+errno_t info_cubepsd_compute(
+    imageID  ID,
+    long     seglen,
+    double   fsample,
+    imageID  IDpsd
+)
+{
+    uint8_t  datatype = data.image[ID].md[0].datatype;
+    uint64_t xysize;
+    long     zsize;
+
+    if(data.image[ID].md[0].naxis != 3)
+    {
+        PRINT_ERROR("3D image required");
+        return RETURN_FAILURE;
+    }
+    if(info_pixstats_datatype_supported(datatype) == 0)
+    {
+        PRINT_ERROR("datatype %d not supported", (int) datatype);
+        return RETURN_FAILURE;
+    }
+
+    xysize = (uint64_t) data.image[ID].md[0].size[0] * data.image[ID].md[0].size[1];
+    zsize = data.image[ID].md[0].size[2];
+
+    if((seglen < 2) || (seglen > zsize))
+    {
+        PRINT_ERROR("segment length %ld out of range 2 ... %ld", seglen, zsize);
+        return RETURN_FAILURE;
+    }
+
+    if(fsample <= 0.0)
+    {
+        fsample = 1.0;
+    }
+
+    long L = seglen;
+    long Lc = L / 2 + 1;
+    if((data.image[IDpsd].md[0].datatype != _DATATYPE_FLOAT)
+            || (data.image[IDpsd].md[0].nelement != xysize * Lc))
+    {
+        PRINT_ERROR("PSD image size does not match");
+        return RETURN_FAILURE;
+    }
+
+    long step = seglen / 2;
+    long NBseg = (zsize - seglen) / step + 1;
+    long NBblock = (xysize + INFO_CUBEPSD_BLOCKSIZE - 1) / INFO_CUBEPSD_BLOCKSIZE;
+
+    // Hann window and one-sided density normalization
+    double *window = (double *) malloc(sizeof(double) * L);
+    double *tbuffer = (double *) fftw_malloc(sizeof(double) * L *
+                      INFO_CUBEPSD_BLOCKSIZE);
+    fftw_complex *fbuffer = (fftw_complex *) fftw_malloc(sizeof(fftw_complex) * Lc *
+                            INFO_CUBEPSD_BLOCKSIZE);
+    if((window == NULL) || (tbuffer == NULL) || (fbuffer == NULL))
+    {
+        PRINT_ERROR("malloc error");
+        free(window);
+        fftw_free(tbuffer);
+        fftw_free(fbuffer);
+        return RETURN_FAILURE;
+    }
+
+    double wnorm = 0.0;
+    for(long t = 0; t < L; t++)
+    {
+        window[t] = 0.5 - 0.5 * cos(2.0 * M_PI * t / L);
+        wnorm += window[t] * window[t];
+    }
+    double scale = 2.0 / (fsample * wnorm * NBseg);
+
+    // plan is created once, and executed on per-thread arrays
+    int n[1] = { (int) L };
+    fftw_plan plan = fftw_plan_many_dft_r2c(1, n, INFO_CUBEPSD_BLOCKSIZE,
+                                            tbuffer, NULL, 1, L,
+                                            fbuffer, NULL, 1, Lc, FFTW_ESTIMATE);
+
+    int NBthreads = info_pixstats_get_NBthreads();
+    (void) NBthreads;
+    int allocerr = 0;
+
+#ifdef _OPENMP
+    #pragma omp parallel num_threads(NBthreads) if(NBblock > 1)
+#endif
+    {
+        double       *tbuf = (double *) fftw_malloc(sizeof(double) * L *
+                             INFO_CUBEPSD_BLOCKSIZE);
+        fftw_complex *fbuf = (fftw_complex *) fftw_malloc(sizeof(fftw_complex) * Lc *
+                             INFO_CUBEPSD_BLOCKSIZE);
+        double       *acc = (double *) malloc(sizeof(double) * Lc *
+                            INFO_CUBEPSD_BLOCKSIZE);
+        if((tbuf == NULL) || (fbuf == NULL) || (acc == NULL))
+        {
+            PRINT_ERROR("malloc error");
+#ifdef _OPENMP
+            #pragma omp atomic write
+#endif
+            allocerr = 1;
+        }
+
+#ifdef _OPENMP
+        #pragma omp for schedule(dynamic)
+#endif
+        for(long block = 0; block < NBblock; block++)
+        {
+            int skip;
+#ifdef _OPENMP
+            #pragma omp atomic read
+#endif
+            skip = allocerr;
+            if(skip)
+            {
+                continue;
+            }
+
+            uint64_t j0 = (uint64_t) block * INFO_CUBEPSD_BLOCKSIZE;
+            long     nbj = INFO_CUBEPSD_BLOCKSIZE;
+            if(j0 + nbj > xysize)
+            {
+                nbj = xysize - j0;
+                memset(tbuf, 0, sizeof(double) * L * INFO_CUBEPSD_BLOCKSIZE);
+            }
+
+            memset(acc, 0, sizeof(double) * Lc * INFO_CUBEPSD_BLOCKSIZE);
+
+            for(long seg = 0; seg < NBseg; seg++)
+            {
+                long kk0 = seg * step;
+
+                for(long t = 0; t < L; t++)
+                {
+                    uint64_t offset = (uint64_t)(kk0 + t) * xysize + j0;
+                    switch(datatype)
+                    {
+#define INFO_CUBEPSD_CASE_GATHER(TS, PIXTYPE, DTYPE, ...)                           \
+                        case DTYPE:                                                 \
+                            cubepsd_gather_##TS(data.image[ID].array.TS + offset,   \
+                                                nbj, tbuf + t, L);                  \
+                            break;
+                            INFO_PIXSTATS_TYPELIST(INFO_CUBEPSD_CASE_GATHER)
+#undef INFO_CUBEPSD_CASE_GATHER
+                    }
+                }
+
+                // detrend and window
+                for(long j = 0; j < nbj; j++)
+                {
+                    double *x = tbuf + j * L;
+                    double  mean = 0.0;
+                    for(long t = 0; t < L; t++)
+                    {
+                        mean += x[t];
+                    }
+                    mean /= L;
+                    for(long t = 0; t < L; t++)
+                    {
+                        x[t] = (x[t] - mean) * window[t];
+                    }
+                }
+
+                fftw_execute_dft_r2c(plan, tbuf, fbuf);
+
+                for(long j = 0; j < nbj; j++)
+                {
+                    const fftw_complex *f = fbuf + j * Lc;
+                    double             *a = acc + j * Lc;
+                    for(long q = 0; q < Lc; q++)
+                    {
+                        a[q] += f[q][0] * f[q][0] + f[q][1] * f[q][1];
+                    }
+                }
+            }
+
+            // back to frequency-major output, contiguous writes per frequency
+            for(long q = 0; q < Lc; q++)
+            {
+                // DC and Nyquist terms are not folded
+                double qscale = scale;
+                if((q == 0) || (2 * q == L))
+                {
+                    qscale *= 0.5;
+                }
+                float *psd = data.image[IDpsd].array.F + (uint64_t) q * xysize + j0;
+                for(long j = 0; j < nbj; j++)
+                {
+                    psd[j] = (float)(acc[j * Lc + q] * qscale);
+                }
+            }
+        }
+
+        fftw_free(tbuf);
+        fftw_free(fbuf);
+        free(acc);
+    }
+
+    fftw_destroy_plan(plan);
+    fftw_free(tbuffer);
+    fftw_free(fbuffer);
+    free(window);
+
+    if(allocerr)
+    {
+        return RETURN_FAILURE;
+    }
+
+    return RETURN_SUCCESS;
+}
+
+
+
+
+/**
+ * @brief Per-pixel PSD cube and band power map of a 3D image
+ *
+ * Writes PSD cube IDpsd_name (xsize x ysize x seglen/2+1, see
+ * info_cubepsd_compute) and, if IDband_name is not NULL or empty, the map
+ * IDband_name of PSD integrated over frequencies fmin <= f <= fmax.
+ * Frequencies are in units of fsample (1 if fsample <= 0).
+ */
+errno_t info_cubepsd(
+    const char *ID_name,
+    long        seglen,
+    double      fsample,
+    double      fmin,
+    double      fmax,
+    const char *IDpsd_name,
+    const char *IDband_name
+)
+{
+    imageID  ID, IDpsd;
+    uint32_t xsize, ysize;
+
+    ID = image_ID(ID_name);
+    if(ID == -1)
+    {
+        PRINT_ERROR("image %s not found", ID_name);
+        return RETURN_FAILURE;
+    }
+    if(data.image[ID].md[0].naxis != 3)
+    {
+        PRINT_ERROR("image %s : 3D image required", ID_name);
+        return RETURN_FAILURE;
+    }
+    if(fsample <= 0.0)
+    {
+        fsample = 1.0;
+    }
+    if((seglen < 2) || (seglen > (long) data.image[ID].md[0].size[2]))
+    {
+        PRINT_ERROR("segment length %ld out of range 2 ... %ld", seglen,
+                    (long) data.image[ID].md[0].size[2]);
+        return RETURN_FAILURE;
+    }
+
+    xsize = data.image[ID].md[0].size[0];
+    ysize = data.image[ID].md[0].size[1];
+    long NBfreq = seglen / 2 + 1;
+
+    IDpsd = create_3Dimage_ID(IDpsd_name, xsize, ysize, NBfreq);
+    if(IDpsd == -1)
+    {
+        PRINT_ERROR("cannot create image %s", IDpsd_name);
+        return RETURN_FAILURE;
+    }
+    if(info_cubepsd_compute(ID, seglen, fsample, IDpsd) != RETURN_SUCCESS)
+    {
+        delete_image_ID(IDpsd_name);
+        return RETURN_FAILURE;
+    }
+
+    if((IDband_name != NULL) && (IDband_name[0] != '\0'))
+    {
+        uint64_t xysize = (uint64_t) xsize * ysize;
+        double   df = fsample / seglen;
+        imageID  IDband = create_2Dimage_ID(IDband_name, xsize, ysize);
+        if(IDband == -1)
+        {
+            PRINT_ERROR("cannot create image %s", IDband_name);
+            return RETURN_FAILURE;
+        }
+        double  *band = (double *) calloc(xysize, sizeof(double));
+        if(band == NULL)
+        {
+            PRINT_ERROR("malloc error");
+            delete_image_ID(IDband_name);
+            return RETURN_FAILURE;
+        }
+
+        for(long q = 0; q < NBfreq; q++)
+        {
+            double f = q * df;
+            if((f >= fmin) && (f <= fmax))
+            {
+                const float *psd = data.image[IDpsd].array.F + (uint64_t) q * xysize;
+                for(uint64_t ii = 0; ii < xysize; ii++)
+                {
+                    band[ii] += psd[ii];
+                }
+            }
+        }
+        for(uint64_t ii = 0; ii < xysize; ii++)
+        {
+            data.image[IDband].array.F[ii] = (float)(band[ii] * df);
+        }
+        free(band);
+    }
+
+    return RETURN_SUCCESS;
+}
@@ -0,0 +1,29 @@
+/**
+ * @file    cubepsd.h
+ * @brief   Per-pixel temporal power spectral density of image cubes
+ *
+ */
+
+#if !defined(INFO_CUBEPSD_H)
+#define INFO_CUBEPSD_H
+
+
+errno_t info_cubepsd_compute(
+    imageID  ID,
+    long     seglen,
+    double   fsample,
+    imageID  IDpsd
+);
+
+errno_t info_cubepsd(
+    const char *ID_name,
+    long        seglen,
+    double      fsample,
+    double      fmin,
+    double      fmax,
+    const char *IDpsd_name,
+    const char *IDband_name
+);
+
+
+#endif
@@ -0,0 +1,423 @@
+/**
+ * @file    cubereg.c
+ * @brief   Sub-pixel registration of image cube slices by FFT cross-correlation
+ *
+ * The shift of each slice relative to a reference image is the position
+ * of the peak of their cross-correlation, computed as the inverse FFT of
+ * F . conj(R), F and R being the slice and reference transforms. The peak
+ * is refined to sub-pixel precision by fitting a parabola through the
+ * peak and its neighbours along each axis.
+ *
+ * Registered slices are obtained by applying the opposite shift in the
+ * Fourier domain, re-using the slice transform.
+ *
+ * The reference is transformed once. FFTW plans are created once and
+ * executed on per-thread buffers, slices being processed in parallel.
+ * NaN and Inf pixels count as 0.
+ *
+ */
+
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+
+#include <fftw3.h>
+
+#include "CommandLineInterface/CLIcore.h"
+#include "COREMOD_memory/COREMOD_memory.h"
+
+#include "info/pixstats.h"
+#include "info/cubereg.h"
+
+
+
+
+// nbpix pixels to double buffer, non-finite pixels set to 0
+#define INFO_CUBEREG_GATHER(TS, PIXTYPE, DTYPE, SUMTYPE, SQTYPE,              \
+                            PIXMIN, PIXMAX, ISFLOAT)                          \
+static void cubereg_gather_##TS(                                              \
+    const PIXTYPE *restrict array,                                            \
+    uint64_t                nbpix,                                            \
+    double        *restrict buffer                                            \
+)                                                                             \
+{                                                                             \
+    for(uint64_t ii = 0; ii < nbpix; ii++)                                    \
+    {                                                                         \
+        double v = (double) array[ii];                                        \
+        if(ISFLOAT && !isfinite(v))                                           \
+        {                                                                     \
+            v = 0.0;                                                          \
+        }                                                                     \
+        buffer[ii] = v;                                                       \
+    }                                                                         \
+}
+
+INFO_PIXSTATS_TYPELIST(INFO_CUBEREG_GATHER)
+
+
+
+static void cubereg_gather(
+    imageID   ID,
+    uint64_t  offset,
+    uint64_t  nbpix,
+    double   *buffer
+)
+{
+    switch(data.image[ID].md[0].datatype)
+    {
+#define INFO_CUBEREG_CASE_GATHER(TS, PIXTYPE, DTYPE, ...)                           \
+        case DTYPE:                                                                 \
+            cubereg_gather_##TS(data.image[ID].array.TS + offset, nbpix, buffer);   \
+            break;
+            INFO_PIXSTATS_TYPELIST(INFO_CUBEREG_CASE_GATHER)
+#undef INFO_CUBEREG_CASE_GATHER
+    }
+}
+
+
+
+
+// signed frequency of index i along axis of size n
+static inline long cubereg_freq(
+    long i,
+    long n
+)
+{
+    return (2 * i < n) ? i : i - n;
+}
+
+
+
+
+// sub-pixel offset of parabola through (-1, cm), (0, c0), (1, cp)
+static inline double cubereg_parabola(
+    double cm,
+    double c0,
+    double cp
+)
+{
+    double denom = cm - 2.0 * c0 + cp;
+
+    if(denom < 0.0)
+    {
+        double d = 0.5 * (cm - cp) / denom;
+        if(fabs(d) < 1.0)
+        {
+            return d;
+        }
+    }
+    return 0.0;
+}
+
+
+
+
+/**
+ * @brief Shift of each slice of 3D image ID relative to reference IDref
+ *
+ * shift[2*kk] and shift[2*kk+1] receive the x and y shift of slice kk :
+ * slice kk is the reference translated by this amount, within
+ * +/- size/2. IDref is a 2D image of the slice size, or -1 to use the
+ * first slice. If IDout is not -1, it receives the registered cube
+ * (float, same size as ID), each slice shifted back onto the reference.
+ */
+errno_t info_cubereg_compute(
+    imageID  ID,
+    imageID  IDref,
+    double  *shift,
+    imageID  IDout
+)
+{
+    long     xsize, ysize, zsize;
+    uint64_t xysize;
+
+    if(data.image[ID].md[0].naxis != 3)
+    {
+        PRINT_ERROR("3D image required");
+        return RETURN_FAILURE;
+    }
+    if(info_pixstats_datatype_supported(data.image[ID].md[0].datatype) == 0)
+    {
+        PRINT_ERROR("datatype %d not supported",
+                    (int) data.image[ID].md[0].datatype);
+        return RETURN_FAILURE;
+    }
+
+    xsize = data.image[ID].md[0].size[0];
+    ysize = data.image[ID].md[0].size[1];
+    zsize = data.image[ID].md[0].size[2];
+    xysize = (uint64_t) xsize * ysize;
+
+    if(IDref != -1)
+    {
+        if((data.image[IDref].md[0].size[0] != (uint32_t) xsize)
+                || (data.image[IDref].md[0].nelement < xysize)
+                || (info_pixstats_datatype_supported(data.image[IDref].md[0].datatype) == 0))
+        {
+            PRINT_ERROR("reference image does not match cube slice");
+            return RETURN_FAILURE;
+        }
+    }
+    if((IDout != -1)
+            && ((data.image[IDout].md[0].datatype != _DATATYPE_FLOAT)
+                || (data.image[IDout].md[0].nelement != xysize * zsize)))
+    {
+        PRINT_ERROR("output cube size does not match");
+        return RETURN_FAILURE;
+    }
+
+    long xsizec = xsize / 2 + 1;
+    uint64_t xysizec = (uint64_t) xsizec * ysize;
+
+    double       *tbuffer = (double *) fftw_malloc(sizeof(double) * xysize);
+    fftw_complex *refbuffer = (fftw_complex *) fftw_malloc(sizeof(fftw_complex) * xysizec);
+    if((tbuffer == NULL) || (refbuffer == NULL))
+    {
+        PRINT_ERROR("malloc error");
+        fftw_free(tbuffer);
+        fftw_free(refbuffer);
+        return RETURN_FAILURE;
+    }
+
+    // plans are created once, and executed on per-thread arrays
+    fftw_plan plan = fftw_plan_dft_r2c_2d(ysize, xsize, tbuffer, refbuffer,
+                                          FFTW_ESTIMATE);
+    fftw_plan planinv = fftw_plan_dft_c2r_2d(ysize, xsize, refbuffer, tbuffer,
+                                             FFTW_ESTIMATE);
+
+    // reference transform, conjugated, without mean
+    if(IDref == -1)
+    {
+        cubereg_gather(ID, 0, xysize, tbuffer);
+    }
+    else
+    {
+        cubereg_gather(IDref, 0, xysize, tbuffer);
+    }
+    fftw_execute_dft_r2c(plan, tbuffer, refbuffer);
+    refbuffer[0][0] = 0.0;
+    refbuffer[0][1] = 0.0;
+    for(uint64_t ii = 0; ii < xysizec; ii++)
+    {
+        refbuffer[ii][1] = -refbuffer[ii][1];
+    }
+
+    int NBthreads = info_pixstats_get_NBthreads();
+    (void) NBthreads;
+    int allocerr = 0;
+
+#ifdef _OPENMP
+    #pragma omp parallel num_threads(NBthreads) if(zsize > 1)
+#endif
+    {
+        double       *tbuf = (double *) fftw_malloc(sizeof(double) * xysize);
+        fftw_complex *fbuf = (fftw_complex *) fftw_malloc(sizeof(fftw_complex) * xysizec);
+        fftw_complex *cbuf = (fftw_complex *) fftw_malloc(sizeof(fftw_complex) * xysizec);
+        if((tbuf == NULL) || (fbuf == NULL) || (cbuf == NULL))
+        {
+            PRINT_ERROR("malloc error");
+#ifdef _OPENMP
+            #pragma omp atomic write
+#endif
+            allocerr = 1;
+        }
+
+#ifdef _OPENMP
+        #pragma omp for schedule(dynamic)
+#endif
+        for(long kk = 0; kk < zsize; kk++)
+        {
+            int skip;
+#ifdef _OPENMP
+            #pragma omp atomic read
+#endif
+            skip = allocerr;
+            if(skip)
+            {
+                continue;
+            }
+
+            cubereg_gather(ID, kk * xysize, xysize, tbuf);
+            fftw_execute_dft_r2c(plan, tbuf, fbuf);
+
+            for(uint64_t ii = 0; ii < xysizec; ii++)
+            {
+                double fr = fbuf[ii][0];
+                double fi = fbuf[ii][1];
+                double rr = refbuffer[ii][0];
+                double ri = refbuffer[ii][1];
+                cbuf[ii][0] = fr * rr - fi * ri;
+                cbuf[ii][1] = fr * ri + fi * rr;
+            }
+            fftw_execute_dft_c2r(planinv, cbuf, tbuf);
+
+            // correlation peak
+            uint64_t iimax = 0;
+            for(uint64_t ii = 1; ii < xysize; ii++)
+            {
+                if(tbuf[ii] > tbuf[iimax])
+                {
+                    iimax = ii;
+                }
+            }
+            long px = iimax % xsize;
+            long py = iimax / xsize;
+            double c0 = tbuf[iimax];
+            double dx = 0.0;
+            double dy = 0.0;
+            if(xsize > 2)
+            {
+                dx = cubereg_parabola(tbuf[py * xsize + (px + xsize - 1) % xsize], c0,
+                                      tbuf[py * xsize + (px + 1) % xsize]);
+            }
+            if(ysize > 2)
+            {
+                dy = cubereg_parabola(tbuf[((py + ysize - 1) % ysize) * xsize + px], c0,
+                                      tbuf[((py + 1) % ysize) * xsize + px]);
+            }
+            double sx = cubereg_freq(px, xsize) + dx;
+            double sy = cubereg_freq(py, ysize) + dy;
+            shift[2 * kk] = sx;
+            shift[2 * kk + 1] = sy;
+
+            if(IDout != -1)
+            {
+                // translate by -shift : multiply by exp(+2 i pi (u sx / xsize + v sy / ysize))
+                for(long v = 0; v < ysize; v++)
+                {
+                    double phy = 2.0 * M_PI * cubereg_freq(v, ysize) * sy / ysize;
+                    for(long u = 0; u < xsizec; u++)
+                    {
+                        double ph = phy + 2.0 * M_PI * u * sx / xsize;
+                        double c = cos(ph);
+                        double s = sin(ph);
+                        fftw_complex *f = fbuf + v * xsizec + u;
+                        double fr = (*f)[0];
+                        double fi = (*f)[1];
+                        (*f)[0] = fr * c - fi * s;
+                        (*f)[1] = fr * s + fi * c;
+                    }
+                }
+                fftw_execute_dft_c2r(planinv, fbuf, tbuf);
+
+                float *out = data.image[IDout].array.F + kk * xysize;
+                for(uint64_t ii = 0; ii < xysize; ii++)
+                {
+                    out[ii] = (float)(tbuf[ii] / xysize);
+                }
+            }
+        }
+
+        fftw_free(tbuf);
+        fftw_free(fbuf);
+        fftw_free(cbuf);
+    }
+
+    fftw_destroy_plan(plan);
+    fftw_destroy_plan(planinv);
+    fftw_free(tbuffer);
+    fftw_free(refbuffer);
+
+    if(allocerr)
+    {
+        return RETURN_FAILURE;
+    }
+
+    return RETURN_SUCCESS;
+}
+
+
+
+
+/**
+ * @brief Register slices of 3D image against reference image
+ *
+ * IDref_name is the reference image, or NULL, empty or "none" to use
+ * the first slice ; a named reference that does not exist is an error.
+ * Writes the shift table to outfname, one line per slice : slice
+ * index, x shift, y shift. If IDout_name is not NULL or empty, the
+ * registered cube is written to new image IDout_name.
+ */
+errno_t info_cubereg(
+    const char *ID_name,
+    const char *IDref_name,
+    const char *outfname,
+    const char *IDout_name
+)
+{
+    imageID ID;
+    imageID IDref = -1;
+    imageID IDout = -1;
+
+    ID = image_ID(ID_name);
+    if(ID == -1)
+    {
+        PRINT_ERROR("image %s not found", ID_name);
+        return RETURN_FAILURE;
+    }
+    if(data.image[ID].md[0].naxis != 3)
+    {
+        PRINT_ERROR("image %s : 3D image required", ID_name);
+        return RETURN_FAILURE;
+    }
+    if((IDref_name != NULL) && (IDref_name[0] != '\0')
+            && (strcmp(IDref_name, "none") != 0))
+    {
+        IDref = image_ID(IDref_name);
+        if(IDref == -1)
+        {
+            PRINT_ERROR("reference image %s not found", IDref_name);
+            return RETURN_FAILURE;
+        }
+    }
+
+    long zsize = data.image[ID].md[0].size[2];
+    double *shift = (double *) malloc(sizeof(double) * 2 * zsize);
+    if(shift == NULL)
+    {
+        PRINT_ERROR("malloc error");
+        return RETURN_FAILURE;
+    }
+
+    if((IDout_name != NULL) && (IDout_name[0] != '\0'))
+    {
+        IDout = create_3Dimage_ID(IDout_name, data.image[ID].md[0].size[0],
+                                  data.image[ID].md[0].size[1], zsize);
+        if(IDout == -1)
+        {
+            PRINT_ERROR("cannot create image %s", IDout_name);
+            free(shift);
+            return RETURN_FAILURE;
+        }
+    }
+
+    errno_t ret = info_cubereg_compute(ID, IDref, shift, IDout);
+
+    if(ret == RETURN_SUCCESS)
+    {
+        FILE *fp = fopen(outfname, "w");
+        if(fp == NULL)
+        {
+            PRINT_ERROR("cannot create file %s", outfname);
+            ret = RETURN_FAILURE;
+        }
+        else
+        {
+            for(long kk = 0; kk < zsize; kk++)
+            {
+                fprintf(fp, "%5ld  %10.4f  %10.4f\n", kk, shift[2 * kk], shift[2 * kk + 1]);
+            }
+            fclose(fp);
+        }
+    }
+    else if(IDout != -1)
+    {
+        delete_image_ID(IDout_name);
+    }
+    free(shift);
+
+    return ret;
+}
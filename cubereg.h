@@ -0,0 +1,26 @@
+/**
+ * @file    cubereg.h
+ * @brief   Sub-pixel registration of image cube slices by FFT cross-correlation
+ *
+ */
+
+#if !defined(INFO_CUBEREG_H)
+#define INFO_CUBEREG_H
+
+
+errno_t info_cubereg_compute(
+    imageID  ID,
+    imageID  IDref,
+    double  *shift,
+    imageID  IDout
+);
+
+errno_t info_cubereg(
+    const char *ID_name,
+    const char *IDref_name,
+    const char *outfname,
+    const char *IDout_name
+);
+
+
+#endif
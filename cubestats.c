@@ -0,0 +1,453 @@
+/**
+ * @file    cubestats.c
+ * @brief   Masked per-frame statistics of cubes and streams
+ *
+ * Per-frame statistics over the pixels of a mask, as reported by
+ * cubestats : min, max, total, mean, power and RMS, one row per frame.
+ * Frames are reduced over the mask spans (pixmask.h), over finite pixels.
+ *
+ * Statistics can be computed on a cube in memory (info_cubestats), or on
+ * a live stream as frames arrive (info_cubestats_stream), the latter
+ * writing rows to a circular output stream, or on a FITS cube too large
+ * for memory, read in blocks of slices (info_cubestats_fits, fitsblock.h).
+ *
+ */
+
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <errno.h>
+#include <semaphore.h>
+
+#include "CommandLineInterface/CLIcore.h"
+#include "COREMOD_memory/COREMOD_memory.h"
+#include "COREMOD_iofits/COREMOD_iofits.h"
+
+#include "info/pixstats.h"
+#include "info/pixmask.h"
+#include "info/fitsblock.h"
+#include "info/cubestats.h"
+
+
+
+
+/**
+ * @brief Statistics of the frame starting at pixel offset, within mask
+ *
+ * statrow receives INFO_CUBESTATS_NBSTAT values, see cubestats.h.
+ */
+errno_t info_cubestats_frame(
+    imageID             ID,
+    uint64_t            offset,
+    const INFO_PIXMASK *pixmask,
+    double             *statrow
+)
+{
+    INFO_PIXSTATS pixstats;
+
+    if(info_pixstats_compute(ID, offset, pixmask->NBpix, pixmask,
+                             &pixstats) != RETURN_SUCCESS)
+    {
+        return RETURN_FAILURE;
+    }
+
+    double mtot = (double)(pixstats.nelement - pixstats.NBnan - pixstats.NBinf);
+    double tot = pixstats.total;
+    double tot2 = pixstats.ssquare;
+
+    statrow[INFO_CUBESTATS_MIN] = pixstats.min;
+    statrow[INFO_CUBESTATS_MAX] = pixstats.max;
+    statrow[INFO_CUBESTATS_TOTAL] = tot;
+    statrow[INFO_CUBESTATS_MEAN] = NAN;
+    statrow[INFO_CUBESTATS_POWER] = tot2;
+    statrow[INFO_CUBESTATS_RMS] = NAN;
+    if(mtot > 0.0)
+    {
+        // clamped : cancellation on constant frames
+        double var = (tot2 - tot * tot / mtot) / mtot;
+        statrow[INFO_CUBESTATS_MEAN] = tot / mtot;
+        statrow[INFO_CUBESTATS_RMS] = (var > 0.0) ? sqrt(var) : 0.0;
+    }
+
+    return RETURN_SUCCESS;
+}
+
+
+
+
+/**
+ * @brief Create cubestats table image of NBrow frames, with a unique name
+ *
+ * The name, derived from the address of tablename, is written to
+ * tablename (STRINGMAXLEN_IMGNAME) for deletion by the caller.
+ * Returns -1 on failure.
+ */
+imageID info_cubestats_table_create(
+    uint32_t  NBrow,
+    char     *tablename
+)
+{
+    imageID IDtable;
+    int     index = 0;
+
+    do
+    {
+        snprintf(tablename, STRINGMAXLEN_IMGNAME, "_cubestats%lx_%d",
+                 (unsigned long) tablename, index++);
+    }
+    while(image_ID(tablename) != -1);
+
+    IDtable = create_2Dimage_ID_double(tablename, INFO_CUBESTATS_NBSTAT, NBrow);
+    if(IDtable == -1)
+    {
+        PRINT_ERROR("cannot create image %s", tablename);
+    }
+
+    return IDtable;
+}
+
+
+
+
+/**
+ * @brief Write cubestats table image to file
+ *
+ * If outfname ends with ".fits", the table is saved as a FITS image
+ * (INFO_CUBESTATS_NBSTAT x number of frames). Otherwise it is written as
+ * text, one line per frame starting with the frame index.
+ */
+errno_t info_cubestats_table_write(
+    imageID     IDtable,
+    const char *outfname
+)
+{
+    size_t len = strlen(outfname);
+
+    if((len > 5) && (strcmp(outfname + len - 5, ".fits") == 0))
+    {
+        char fname[STRINGMAXLEN_FILENAME];
+
+        snprintf(fname, STRINGMAXLEN_FILENAME, "!%s", outfname);
+        return save_fits(data.image[IDtable].name, fname);
+    }
+
+    FILE *fp = fopen(outfname, "w");
+    if(fp == NULL)
+    {
+        PRINT_ERROR("cannot create file %s", outfname);
+        return RETURN_FAILURE;
+    }
+
+    uint32_t NBrow = data.image[IDtable].md[0].size[1];
+    for(uint32_t kk = 0; kk < NBrow; kk++)
+    {
+        const double *statrow = data.image[IDtable].array.D +
+                                (uint64_t) kk * INFO_CUBESTATS_NBSTAT;
+
+        fprintf(fp, "%5ld  %20f  %20f  %20f  %20f  %20f  %20f\n", (long) kk,
+                statrow[INFO_CUBESTATS_MIN], statrow[INFO_CUBESTATS_MAX],
+                statrow[INFO_CUBESTATS_TOTAL], statrow[INFO_CUBESTATS_MEAN],
+                statrow[INFO_CUBESTATS_POWER], statrow[INFO_CUBESTATS_RMS]);
+    }
+    if(fclose(fp) != 0)
+    {
+        PRINT_ERROR("write error on file %s", outfname);
+        return RETURN_FAILURE;
+    }
+
+    return RETURN_SUCCESS;
+}
+
+
+
+
+/**
+ * @brief Per-frame masked statistics of a live stream
+ *
+ * Waits on semaphore sem of stream ID_name, and computes the statistics of
+ * each new frame within the mask (pixels > 0.5, or all pixels if
+ * IDmask_name is NULL or empty). For a 3D stream used as a circular
+ * buffer, the frame is slice cnt1.
+ *
+ * Each frame produces one row of the output stream IDout_name, a shared
+ * double image of INFO_CUBESTATS_STREAM_NBCOL x NBrow used as a circular
+ * buffer : cnt1 is the last row written, cnt0 the number of rows written.
+ * Rows hold the cubestats columns followed by the input frame cnt0.
+ *
+ * Semaphore posts with no new frame (unchanged cnt0) are skipped, frames
+ * overwritten before being read are counted as missed.
+ *
+ * Runs for NBframe frames, or if NBframe <= 0 until SIGINT.
+ */
+errno_t info_cubestats_stream(
+    const char *ID_name,
+    const char *IDmask_name,
+    int         sem,
+    const char *IDout_name,
+    long        NBrow,
+    long        NBframe
+)
+{
+    imageID      ID;
+    imageID      IDout;
+    INFO_PIXMASK pixmask;
+    uint32_t     xsize, ysize;
+    uint64_t     xysize;
+
+    ID = image_ID(ID_name);
+    if(ID == -1)
+    {
+        PRINT_ERROR("stream %s not found", ID_name);
+        return RETURN_FAILURE;
+    }
+    if((sem < 0) || (sem >= data.image[ID].md[0].sem))
+    {
+        PRINT_ERROR("stream %s has no semaphore %d", ID_name, sem);
+        return RETURN_FAILURE;
+    }
+    if(info_pixstats_datatype_supported(data.image[ID].md[0].datatype) == 0)
+    {
+        PRINT_ERROR("datatype %d not supported",
+                    (int) data.image[ID].md[0].datatype);
+        return RETURN_FAILURE;
+    }
+    if(NBrow < 1)
+    {
+        NBrow = 1;
+    }
+
+    xsize = data.image[ID].md[0].size[0];
+    ysize = (data.image[ID].md[0].naxis > 1) ? data.image[ID].md[0].size[1] : 1;
+    xysize = (uint64_t) xsize * ysize;
+
+    if((IDmask_name != NULL) && (IDmask_name[0] != '\0'))
+    {
+        imageID IDm = image_ID(IDmask_name);
+        if(IDm == -1)
+        {
+            PRINT_ERROR("mask image %s not found", IDmask_name);
+            return RETURN_FAILURE;
+        }
+        if((data.image[IDm].md[0].size[0] != xsize)
+                || (data.image[IDm].md[0].nelement < xysize))
+        {
+            PRINT_ERROR("mask image %s size does not match stream %s",
+                        IDmask_name, ID_name);
+            return RETURN_FAILURE;
+        }
+        if(info_pixmask_build_image(&pixmask, IDm) != RETURN_SUCCESS)
+        {
+            return RETURN_FAILURE;
+        }
+    }
+    else if(info_pixmask_build_roi(&pixmask, xsize, ysize, 0, xsize, 0,
+                                   ysize) != RETURN_SUCCESS)
+    {
+        return RETURN_FAILURE;
+    }
+    if(pixmask.NBspan > 0)
+    {
+        // first plane of a mask cube
+        INFO_PIXSPAN *last = &pixmask.span[pixmask.NBspan - 1];
+        if(last->start + last->length > xysize)
+        {
+            PRINT_ERROR("mask image %s size does not match stream %s",
+                        IDmask_name, ID_name);
+            info_pixmask_free(&pixmask);
+            return RETURN_FAILURE;
+        }
+    }
+
+    // output circular buffer, re-used if it exists with the right size
+    IDout = image_ID(IDout_name);
+    if((IDout != -1)
+            && ((data.image[IDout].md[0].datatype != _DATATYPE_DOUBLE)
+                || (data.image[IDout].md[0].size[0] != INFO_CUBESTATS_STREAM_NBCOL)
+                || (data.image[IDout].md[0].size[1] != (uint32_t) NBrow)))
+    {
+        delete_image_ID(IDout_name);
+        IDout = -1;
+    }
+    if(IDout == -1)
+    {
+        uint32_t outsize[2] = { INFO_CUBESTATS_STREAM_NBCOL, (uint32_t) NBrow };
+        IDout = create_image_ID(IDout_name, 2, outsize, _DATATYPE_DOUBLE, 1, 0);
+        if(IDout == -1)
+        {
+            PRINT_ERROR("cannot create stream %s", IDout_name);
+            info_pixmask_free(&pixmask);
+            return RETURN_FAILURE;
+        }
+    }
+
+    // discard frames posted before start
+    while(sem_trywait(data.image[ID].semptr[sem]) == 0)
+    {
+    }
+
+    uint64_t cntin = data.image[ID].md[0].cnt0;
+    uint64_t NBmissed = 0;
+    long     row = 0;
+    long     frame = 0;
+    errno_t  ret = RETURN_SUCCESS;
+
+    while((NBframe <= 0) || (frame < NBframe))
+    {
+        if(data.signal_INT == 1)
+        {
+            break;
+        }
+        if(sem_wait(data.image[ID].semptr[sem]) == -1)
+        {
+            if(errno == EINTR)
+            {
+                continue;
+            }
+            PRINT_ERROR("sem_wait error on stream %s", ID_name);
+            ret = RETURN_FAILURE;
+            break;
+        }
+
+        // posts that piled up while the previous frame was processed
+        // carry no new frame
+        uint64_t cnt0 = data.image[ID].md[0].cnt0;
+        if(cnt0 == cntin)
+        {
+            continue;
+        }
+        uint64_t offset = 0;
+        if(data.image[ID].md[0].naxis == 3)
+        {
+            offset = (uint64_t) data.image[ID].md[0].cnt1 * xysize;
+        }
+        if(cnt0 > cntin + 1)
+        {
+            NBmissed += cnt0 - cntin - 1;
+        }
+        cntin = cnt0;
+
+        double *statrow = data.image[IDout].array.D + (uint64_t) row *
+                          INFO_CUBESTATS_STREAM_NBCOL;
+
+        data.image[IDout].md[0].write = 1;
+        info_cubestats_frame(ID, offset, &pixmask, statrow);
+        statrow[INFO_CUBESTATS_STREAM_CNT] = (double) cnt0;
+        data.image[IDout].md[0].cnt1 = row;
+        data.image[IDout].md[0].cnt0++;
+        data.image[IDout].md[0].write = 0;
+        COREMOD_MEMORY_image_set_sempost_byID(IDout, -1);
+
+        row++;
+        if(row == NBrow)
+        {
+            row = 0;
+        }
+        frame++;
+    }
+
+    if(NBmissed > 0)
+    {
+        printf("%s : %lu frames missed\n", ID_name, (unsigned long) NBmissed);
+    }
+
+    info_pixmask_free(&pixmask);
+
+    return ret;
+}
+
+
+
+
+/**
+ * @brief Per-slice masked statistics of a FITS cube, read out-of-core
+ *
+ * Same output as info_cubestats(), for a cube read from file fname in
+ * blocks of NBslice slices (default size if NBslice <= 0). The next block
+ * is read while the current one is processed, slices of a block being
+ * processed in parallel. Memory use is two blocks and the output table.
+ */
+errno_t info_cubestats_fits(
+    const char *fname,
+    const char *IDmask_name,
+    const char *outfname,
+    long        NBslice
+)
+{
+    INFO_FITSBLOCK fitsblock;
+    INFO_PIXMASK   pixmask;
+    imageID        IDm, IDtable, IDbuf;
+    char           tablename[STRINGMAXLEN_IMGNAME];
+    uint64_t       xysize;
+    long           kkstart;
+
+    IDm = image_ID(IDmask_name);
+    if(IDm == -1)
+    {
+        PRINT_ERROR("mask image %s not found", IDmask_name);
+        return RETURN_FAILURE;
+    }
+
+    if(info_fitsblock_open(&fitsblock, fname, NBslice) != RETURN_SUCCESS)
+    {
+        return RETURN_FAILURE;
+    }
+
+    if((data.image[IDm].md[0].size[0] != fitsblock.size[0])
+            || (data.image[IDm].md[0].size[1] != fitsblock.size[1]))
+    {
+        PRINT_ERROR("mask image %s size does not match file %s",
+                    IDmask_name, fname);
+        info_fitsblock_close(&fitsblock);
+        return RETURN_FAILURE;
+    }
+    if(info_pixmask_build_image(&pixmask, IDm) != RETURN_SUCCESS)
+    {
+        info_fitsblock_close(&fitsblock);
+        return RETURN_FAILURE;
+    }
+
+    xysize = (uint64_t) fitsblock.size[0] * fitsblock.size[1];
+    IDtable = info_cubestats_table_create(fitsblock.size[2], tablename);
+    if(IDtable == -1)
+    {
+        info_pixmask_free(&pixmask);
+        info_fitsblock_close(&fitsblock);
+        return RETURN_FAILURE;
+    }
+
+    int NBthreads = info_pixstats_get_NBthreads();
+    (void) NBthreads;
+
+    while((IDbuf = info_fitsblock_next(&fitsblock, &kkstart,
+                                       &NBslice)) != -1)
+    {
+        double *statrow = data.image[IDtable].array.D +
+                          (uint64_t) kkstart * INFO_CUBESTATS_NBSTAT;
+
+#ifdef _OPENMP
+        #pragma omp parallel for schedule(dynamic, 16) num_threads(NBthreads)
+#endif
+        for(long kk = 0; kk < NBslice; kk++)
+        {
+            info_cubestats_frame(IDbuf, kk * xysize, &pixmask,
+                                 statrow + kk * INFO_CUBESTATS_NBSTAT);
+        }
+    }
+
+    info_pixmask_free(&pixmask);
+
+    if(info_fitsblock_close(&fitsblock) != RETURN_SUCCESS)
+    {
+        PRINT_ERROR("read error on file %s", fname);
+        delete_image_ID(tablename);
+        return RETURN_FAILURE;
+    }
+
+    errno_t ret = info_cubestats_table_write(IDtable, outfname);
+    delete_image_ID(tablename);
+
+    return ret;
+}
@@ -0,0 +1,62 @@
+/**
+ * @file    cubestats.h
+ * @brief   Masked per-frame statistics of cubes and streams
+ *
+ */
+
+#if !defined(INFO_CUBESTATS_H)
+#define INFO_CUBESTATS_H
+
+#include "info/pixmask.h"
+
+
+// columns of the cubestats table
+#define INFO_CUBESTATS_MIN     0
+#define INFO_CUBESTATS_MAX     1
+#define INFO_CUBESTATS_TOTAL   2
+#define INFO_CUBESTATS_MEAN    3
+#define INFO_CUBESTATS_POWER   4  // sum of squares
+#define INFO_CUBESTATS_RMS     5  // standard deviation
+#define INFO_CUBESTATS_NBSTAT  6
+
+// streaming output : input frame counter cnt0 follows the statistics
+#define INFO_CUBESTATS_STREAM_CNT     INFO_CUBESTATS_NBSTAT
+#define INFO_CUBESTATS_STREAM_NBCOL   (INFO_CUBESTATS_NBSTAT + 1)
+
+
+
+errno_t info_cubestats_frame(
+    imageID             ID,
+    uint64_t            offset,
+    const INFO_PIXMASK *pixmask,
+    double             *statrow
+);
+
+imageID info_cubestats_table_create(
+    uint32_t  NBrow,
+    char     *tablename
+);
+
+errno_t info_cubestats_table_write(
+    imageID     IDtable,
+    const char *outfname
+);
+
+errno_t info_cubestats_stream(
+    const char *ID_name,
+    const char *IDmask_name,
+    int         sem,
+    const char *IDout_name,
+    long        NBrow,
+    long        NBframe
+);
+
+errno_t info_cubestats_fits(
+    const char *fname,
+    const char *IDmask_name,
+    const char *outfname,
+    long        NBslice
+);
+
+
+#endif
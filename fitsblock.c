@@ -0,0 +1,357 @@
+/**
+ * @file    fitsblock.c
+ * @brief   Out-of-core reading of FITS cubes in slice blocks
+ *
+ * Reduces FITS cubes too large to be loaded in memory. The cube is read
+ * from file in blocks of NBslice slices, into two buffer images used
+ * alternately : a prefetch thread reads the next block while the caller
+ * processes the current one, so that file I/O overlaps computation and
+ * memory use is bounded by two blocks.
+ *
+ * Buffers are local images of size xsize x ysize x NBslice, float for
+ * 8-, 16-bit and float FITS images, double otherwise, so that the
+ * existing image reductions apply to each block. Undefined (BLANK) pixels
+ * are read as NaN.
+ *
+ * Typical use :
+ *
+ *     INFO_FITSBLOCK fitsblock;
+ *     imageID IDbuf;
+ *     long kkstart, NBslice;
+ *
+ *     info_fitsblock_open(&fitsblock, "cube.fits", 0);
+ *     while((IDbuf = info_fitsblock_next(&fitsblock, &kkstart, &NBslice)) != -1)
+ *     {
+ *         // slices kkstart to kkstart+NBslice-1 of the cube
+ *     }
+ *     info_fitsblock_close(&fitsblock);
+ *
+ * The buffer returned by info_fitsblock_next() is valid until the next
+ * call. fitsblock.status is non-zero if a read failed.
+ *
+ */
+
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <pthread.h>
+#include <fitsio.h>
+
+#include "CommandLineInterface/CLIcore.h"
+#include "COREMOD_memory/COREMOD_memory.h"
+
+#include "info/fitsblock.h"
+
+
+
+
+static void fitsblock_free_buffers(
+    INFO_FITSBLOCK *fitsblock
+)
+{
+    for(int buf = 0; buf < 2; buf++)
+    {
+        if(fitsblock->IDbuf[buf] != -1)
+        {
+            char bufname[200];
+
+            strncpy(bufname, data.image[fitsblock->IDbuf[buf]].name, 199);
+            bufname[199] = '\0';
+            delete_image_ID(bufname);
+            fitsblock->IDbuf[buf] = -1;
+        }
+    }
+}
+
+
+
+
+static int fitsblock_read(
+    INFO_FITSBLOCK *fitsblock,
+    int             buf,
+    long            block
+)
+{
+    imageID  IDbuf = fitsblock->IDbuf[buf];
+    uint64_t xysize = (uint64_t) fitsblock->size[0] * fitsblock->size[1];
+    long     kkstart = block * fitsblock->NBslice;
+    long     NBslice = fitsblock->NBslice;
+    long     firstpix[3] = { 1, 1, kkstart + 1 };
+    int      anynul = 0;
+    int      status = 0;
+
+    if(kkstart + NBslice > (long) fitsblock->size[2])
+    {
+        NBslice = (long) fitsblock->size[2] - kkstart;
+    }
+
+    if(fitsblock->fitstype == TFLOAT)
+    {
+        float nulval = NAN;
+        fits_read_pix(fitsblock->fptr, TFLOAT, firstpix,
+                      (long long)(xysize * NBslice), &nulval,
+                      data.image[IDbuf].array.F, &anynul, &status);
+    }
+    else
+    {
+        double nulval = NAN;
+        fits_read_pix(fitsblock->fptr, TDOUBLE, firstpix,
+                      (long long)(xysize * NBslice), &nulval,
+                      data.image[IDbuf].array.D, &anynul, &status);
+    }
+
+    return status;
+}
+
+
+
+
+// prefetch thread : fills buffer block%2 as soon as it is released
+static void *fitsblock_prefetch(
+    void *ptr
+)
+{
+    INFO_FITSBLOCK *fitsblock = (INFO_FITSBLOCK *) ptr;
+
+    for(long block = 0; block < fitsblock->NBblock; block++)
+    {
+        int buf = (int)(block % 2);
+
+        pthread_mutex_lock(&fitsblock->mutex);
+        while((fitsblock->bufblock[buf] != -1) && (fitsblock->stop == 0))
+        {
+            pthread_cond_wait(&fitsblock->cond, &fitsblock->mutex);
+        }
+        if(fitsblock->stop)
+        {
+            pthread_mutex_unlock(&fitsblock->mutex);
+            break;
+        }
+        pthread_mutex_unlock(&fitsblock->mutex);
+
+        int status = fitsblock_read(fitsblock, buf, block);
+
+        pthread_mutex_lock(&fitsblock->mutex);
+        if(status != 0)
+        {
+            fitsblock->status = status;
+            fitsblock->stop = 1;
+        }
+        else
+        {
+            fitsblock->bufblock[buf] = block;
+        }
+        pthread_cond_broadcast(&fitsblock->cond);
+        pthread_mutex_unlock(&fitsblock->mutex);
+
+        if(status != 0)
+        {
+            break;
+        }
+    }
+
+    return NULL;
+}
+
+
+
+
+/**
+ * @brief Open FITS cube fname for reading in blocks of NBslice slices
+ *
+ * If NBslice <= 0, the block size is set to INFO_FITSBLOCK_DEFAULTSIZE
+ * bytes. A 2D image is read as a single slice. Starts the prefetch thread.
+ */
+errno_t info_fitsblock_open(
+    INFO_FITSBLOCK *fitsblock,
+    const char     *fname,
+    long            NBslice
+)
+{
+    int  status = 0;
+    int  naxis = 0;
+    int  bitpix = 0;
+    long naxes[3] = { 1, 1, 1 };
+
+    memset(fitsblock, 0, sizeof(INFO_FITSBLOCK));
+    fitsblock->IDbuf[0] = -1;
+    fitsblock->IDbuf[1] = -1;
+
+    if(fits_open_file(&fitsblock->fptr, fname, READONLY, &status))
+    {
+        fits_report_error(stderr, status);
+        PRINT_ERROR("cannot open FITS file %s", fname);
+        return RETURN_FAILURE;
+    }
+    fits_get_img_dim(fitsblock->fptr, &naxis, &status);
+    fits_get_img_type(fitsblock->fptr, &bitpix, &status);
+    if((status == 0) && ((naxis < 2) || (naxis > 3)))
+    {
+        PRINT_ERROR("FITS file %s : 2D or 3D image required", fname);
+        fits_close_file(fitsblock->fptr, &status);
+        return RETURN_FAILURE;
+    }
+    fits_get_img_size(fitsblock->fptr, naxis, naxes, &status);
+    if(status != 0)
+    {
+        fits_report_error(stderr, status);
+        status = 0;
+        fits_close_file(fitsblock->fptr, &status);
+        return RETURN_FAILURE;
+    }
+
+    // float holds 8- and 16-bit integers exactly
+    if((bitpix == BYTE_IMG) || (bitpix == SHORT_IMG) || (bitpix == FLOAT_IMG))
+    {
+        fitsblock->fitstype = TFLOAT;
+        fitsblock->datatype = _DATATYPE_FLOAT;
+    }
+    else
+    {
+        fitsblock->fitstype = TDOUBLE;
+        fitsblock->datatype = _DATATYPE_DOUBLE;
+    }
+
+    for(int i = 0; i < 3; i++)
+    {
+        fitsblock->size[i] = (uint32_t) naxes[i];
+    }
+
+    uint64_t slicebytes = (uint64_t) naxes[0] * naxes[1] *
+                          ((fitsblock->fitstype == TFLOAT) ? sizeof(float) : sizeof(double));
+    if(NBslice <= 0)
+    {
+        NBslice = (long)(INFO_FITSBLOCK_DEFAULTSIZE / slicebytes);
+    }
+    if(NBslice < 1)
+    {
+        NBslice = 1;
+    }
+    if(NBslice > naxes[2])
+    {
+        NBslice = naxes[2];
+    }
+    fitsblock->NBslice = NBslice;
+    fitsblock->NBblock = (naxes[2] + NBslice - 1) / NBslice;
+
+    fitsblock->IDbuf[0] = -1;
+    fitsblock->IDbuf[1] = -1;
+    for(int buf = 0; buf < 2; buf++)
+    {
+        char     bufname[200];
+        uint32_t bufsize[3] = { fitsblock->size[0], fitsblock->size[1], (uint32_t) NBslice };
+
+        snprintf(bufname, 200, "_fitsblock%lx_%d", (unsigned long) fitsblock, buf);
+        fitsblock->IDbuf[buf] = create_image_ID(bufname, 3, bufsize,
+                                                fitsblock->datatype, 0, 0);
+        if(fitsblock->IDbuf[buf] == -1)
+        {
+            PRINT_ERROR("cannot create image %s", bufname);
+            fitsblock_free_buffers(fitsblock);
+            fits_close_file(fitsblock->fptr, &status);
+            return RETURN_FAILURE;
+        }
+        fitsblock->bufblock[buf] = -1;
+    }
+    fitsblock->nextblock = 0;
+
+    pthread_mutex_init(&fitsblock->mutex, NULL);
+    pthread_cond_init(&fitsblock->cond, NULL);
+    if(pthread_create(&fitsblock->thread, NULL, fitsblock_prefetch,
+                      fitsblock) != 0)
+    {
+        PRINT_ERROR("cannot create prefetch thread");
+        fitsblock_free_buffers(fitsblock);
+        pthread_mutex_destroy(&fitsblock->mutex);
+        pthread_cond_destroy(&fitsblock->cond);
+        fits_close_file(fitsblock->fptr, &status);
+        return RETURN_FAILURE;
+    }
+
+    return RETURN_SUCCESS;
+}
+
+
+
+
+/**
+ * @brief Next block of slices, in file order
+ *
+ * Releases the buffer returned by the previous call and waits for the next
+ * block. Returns the buffer image, whose first NBslice slices hold slices
+ * kkstart to kkstart+NBslice-1 of the cube, or -1 at end of file or on
+ * read error (fitsblock.status non-zero).
+ */
+imageID info_fitsblock_next(
+    INFO_FITSBLOCK *fitsblock,
+    long           *kkstart,
+    long           *NBslice
+)
+{
+    long block = fitsblock->nextblock;
+    int  buf = (int)(block % 2);
+
+    pthread_mutex_lock(&fitsblock->mutex);
+    if(block > 0)
+    {
+        fitsblock->bufblock[(block - 1) % 2] = -1;
+        pthread_cond_broadcast(&fitsblock->cond);
+    }
+    if(block >= fitsblock->NBblock)
+    {
+        pthread_mutex_unlock(&fitsblock->mutex);
+        return -1;
+    }
+    while((fitsblock->bufblock[buf] != block) && (fitsblock->status == 0))
+    {
+        pthread_cond_wait(&fitsblock->cond, &fitsblock->mutex);
+    }
+    if(fitsblock->status != 0)
+    {
+        pthread_mutex_unlock(&fitsblock->mutex);
+        fits_report_error(stderr, fitsblock->status);
+        return -1;
+    }
+    pthread_mutex_unlock(&fitsblock->mutex);
+
+    *kkstart = block * fitsblock->NBslice;
+    *NBslice = fitsblock->NBslice;
+    if(*kkstart + *NBslice > (long) fitsblock->size[2])
+    {
+        *NBslice = (long) fitsblock->size[2] - *kkstart;
+    }
+    fitsblock->nextblock++;
+
+    return fitsblock->IDbuf[buf];
+}
+
+
+
+
+/**
+ * @brief Stop prefetch thread, close file and free buffers
+ */
+errno_t info_fitsblock_close(
+    INFO_FITSBLOCK *fitsblock
+)
+{
+    int status = 0;
+
+    pthread_mutex_lock(&fitsblock->mutex);
+    fitsblock->stop = 1;
+    pthread_cond_broadcast(&fitsblock->cond);
+    pthread_mutex_unlock(&fitsblock->mutex);
+    pthread_join(fitsblock->thread, NULL);
+
+    pthread_mutex_destroy(&fitsblock->mutex);
+    pthread_cond_destroy(&fitsblock->cond);
+
+    fitsblock_free_buffers(fitsblock);
+
+    fits_close_file(fitsblock->fptr, &status);
+
+    return (fitsblock->status == 0) ? RETURN_SUCCESS : RETURN_FAILURE;
+}
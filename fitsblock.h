@@ -0,0 +1,58 @@
+/**
+ * @file    fitsblock.h
+ * @brief   Out-of-core reading of FITS cubes in slice blocks
+ *
+ */
+
+#if !defined(INFO_FITSBLOCK_H)
+#define INFO_FITSBLOCK_H
+
+#include <pthread.h>
+#include <fitsio.h>
+
+
+// default block size, bytes per buffer
+#define INFO_FITSBLOCK_DEFAULTSIZE (64UL * 1024 * 1024)
+
+
+typedef struct
+{
+    fitsfile        *fptr;
+    int              fitstype;      // TFLOAT or TDOUBLE
+    uint8_t          datatype;      // _DATATYPE_FLOAT or _DATATYPE_DOUBLE
+    uint32_t         size[3];
+    long             NBslice;       // slices per block
+    long             NBblock;
+
+    // double buffer, filled by prefetch thread
+    imageID          IDbuf[2];
+    long             bufblock[2];   // block index held, -1 if free
+    long             nextblock;     // next block returned to caller
+    int              status;        // CFITSIO status of prefetch thread
+    int              stop;
+
+    pthread_t        thread;
+    pthread_mutex_t  mutex;
+    pthread_cond_t   cond;
+} INFO_FITSBLOCK;
+
+
+
+errno_t info_fitsblock_open(
+    INFO_FITSBLOCK *fitsblock,
+    const char     *fname,
+    long            NBslice
+);
+
+imageID info_fitsblock_next(
+    INFO_FITSBLOCK *fitsblock,
+    long           *kkstart,
+    long           *NBslice
+);
+
+errno_t info_fitsblock_close(
+    INFO_FITSBLOCK *fitsblock
+);
+
+
+#endif
@@ -86,6 +86,24 @@ int clock_gettime(int clk_id, struct timespec *t)
 
 
 #include "info/info.h"
+#include "info/pixstats.h"
+#include "info/pixmask.h"
+#include "info/moments.h"
+#include "info/slicestats.h"
+#include "info/statcache.h"
+#include "info/sigclip.h"
+#include "info/robust.h"
+#include "info/select.h"
+#include "info/wstats.h"
+#include "info/cubecorr.h"
+#include "info/cubestats.h"
+#include "info/cubepsd.h"
+#include "info/combine.h"
+#include "info/lucky.h"
+#include "info/cubereg.h"
+#include "info/covar.h"
+#include "info/pca.h"
+#include "info/outlier.h"
 #include "fft/fft.h"
 
 
@@ -211,6 +229,538 @@ errno_t info_image_stats_cli()
 
 
 
+errno_t info_image_stats_mask_cli()
+{
+    if(
+        CLI_checkarg(1, CLIARG_IMG)
+        + CLI_checkarg(2, CLIARG_IMG)
+        == 0)
+    {
+        // "mask=" prefix and image name
+        char options[sizeof(data.cmdargtoken[2].val.string) + 8];
+
+        snprintf(options, sizeof(options), "mask=%s",
+                 data.cmdargtoken[2].val.string);
+        info_image_stats(
+            data.cmdargtoken[1].val.string,
+            options
+        );
+        return CLICMD_SUCCESS;
+    }
+    else
+    {
+        return CLICMD_INVALID_ARG;
+    }
+}
+
+
+
+errno_t info_image_sigclip_cli()
+{
+    if(
+        CLI_checkarg(1, CLIARG_IMG)
+        + CLI_checkarg(2, CLIARG_FLOAT)
+        + CLI_checkarg(3, CLIARG_LONG)
+        == 0)
+    {
+        INFO_SIGCLIP sigclip;
+
+        if(info_image_sigclip(data.cmdargtoken[1].val.string, NULL,
+                              data.cmdargtoken[2].val.numf,
+                              (int) data.cmdargtoken[3].val.numl,
+                              &sigclip) == RETURN_SUCCESS)
+        {
+            printf("clip bounds                  %20.18e %20.18e\n", sigclip.lo,
+                   sigclip.hi);
+            printf("iterations                   %d\n", sigclip.NBiter);
+            printf("kept pixels     (->vcnpix)   %ld\n", (long) sigclip.NBpix);
+            printf("clipped pixels  (->vcnclip)  %ld\n", (long) sigclip.NBclip);
+            printf("clipped mean    (->vcmean)   %20.18e\n", sigclip.mean);
+            printf("clipped rms     (->vcrms)    %20.18e\n", sigclip.rms);
+            create_variable_ID("vcnpix", 1.0 * sigclip.NBpix);
+            create_variable_ID("vcnclip", 1.0 * sigclip.NBclip);
+            create_variable_ID("vcmean", sigclip.mean);
+            create_variable_ID("vcrms", sigclip.rms);
+        }
+        return CLICMD_SUCCESS;
+    }
+    else
+    {
+        return CLICMD_INVALID_ARG;
+    }
+}
+
+
+
+errno_t info_image_moments_cli()
+{
+    if(
+        CLI_checkarg(1, CLIARG_IMG)
+        == 0)
+    {
+        INFO_MOMENTS moments;
+
+        if(info_image_moments(data.cmdargtoken[1].val.string, &moments) == RETURN_SUCCESS)
+        {
+            printf("total           (->vtot)     %20.18e\n", moments.total);
+            printf("centroid x      (->vbx)      %20.18f\n", moments.xc);
+            printf("centroid y      (->vby)      %20.18f\n", moments.yc);
+            printf("moment xx       (->vmxx)     %20.18e\n", moments.mxx);
+            printf("moment yy       (->vmyy)     %20.18e\n", moments.myy);
+            printf("moment xy       (->vmxy)     %20.18e\n", moments.mxy);
+            printf("major axis      (->vlmaj)    %20.18e\n", moments.lmajor);
+            printf("minor axis      (->vlmin)    %20.18e\n", moments.lminor);
+            printf("angle [rad]     (->vang)     %20.18f\n", moments.angle);
+            printf("ellipticity     (->vell)     %20.18e\n", moments.ellipticity);
+            printf("FWHM            (->vfwhm)    %20.18e\n", moments.fwhm);
+            create_variable_ID("vtot", moments.total);
+            create_variable_ID("vbx", moments.xc);
+            create_variable_ID("vby", moments.yc);
+            create_variable_ID("vmxx", moments.mxx);
+            create_variable_ID("vmyy", moments.myy);
+            create_variable_ID("vmxy", moments.mxy);
+            create_variable_ID("vlmaj", moments.lmajor);
+            create_variable_ID("vlmin", moments.lminor);
+            create_variable_ID("vang", moments.angle);
+            create_variable_ID("vell", moments.ellipticity);
+            create_variable_ID("vfwhm", moments.fwhm);
+        }
+        return CLICMD_SUCCESS;
+    }
+    else
+    {
+        return CLICMD_INVALID_ARG;
+    }
+}
+
+
+
+errno_t info_image_slicestats_cli()
+{
+    if(
+        CLI_checkarg(1, CLIARG_IMG) +
+        CLI_checkarg(2, CLIARG_STR_NOT_IMG)
+        == 0)
+    {
+        info_image_slicestats(
+            data.cmdargtoken[1].val.string,
+            data.cmdargtoken[2].val.string
+        );
+        return CLICMD_SUCCESS;
+    }
+    else
+    {
+        return CLICMD_INVALID_ARG;
+    }
+}
+
+
+
+errno_t info_cubestats_stream_cli()
+{
+    if(
+        CLI_checkarg(1, CLIARG_IMG) +
+        CLI_checkarg(2, CLIARG_IMG) +
+        CLI_checkarg(3, CLIARG_LONG) +
+        CLI_checkarg(4, CLIARG_STR_NOT_IMG) +
+        CLI_checkarg(5, CLIARG_LONG) +
+        CLI_checkarg(6, CLIARG_LONG)
+        == 0)
+    {
+        info_cubestats_stream(
+            data.cmdargtoken[1].val.string,
+            data.cmdargtoken[2].val.string,
+            (int) data.cmdargtoken[3].val.numl,
+            data.cmdargtoken[4].val.string,
+            data.cmdargtoken[5].val.numl,
+            data.cmdargtoken[6].val.numl
+        );
+        return CLICMD_SUCCESS;
+    }
+    else
+    {
+        return CLICMD_INVALID_ARG;
+    }
+}
+
+
+
+errno_t info_cubestats_fits_cli()
+{
+    if(
+        CLI_checkarg(1, CLIARG_STR) +
+        CLI_checkarg(2, CLIARG_IMG) +
+        CLI_checkarg(3, CLIARG_STR_NOT_IMG) +
+        CLI_checkarg(4, CLIARG_LONG)
+        == 0)
+    {
+        info_cubestats_fits(
+            data.cmdargtoken[1].val.string,
+            data.cmdargtoken[2].val.string,
+            data.cmdargtoken[3].val.string,
+            data.cmdargtoken[4].val.numl
+        );
+        return CLICMD_SUCCESS;
+    }
+    else
+    {
+        return CLICMD_INVALID_ARG;
+    }
+}
+
+
+
+errno_t info_cubepsd_cli()
+{
+    if(
+        CLI_checkarg(1, CLIARG_IMG) +
+        CLI_checkarg(2, CLIARG_LONG) +
+        CLI_checkarg(3, CLIARG_FLOAT) +
+        CLI_checkarg(4, CLIARG_FLOAT) +
+        CLI_checkarg(5, CLIARG_FLOAT) +
+        CLI_checkarg(6, CLIARG_STR_NOT_IMG) +
+        CLI_checkarg(7, CLIARG_STR_NOT_IMG)
+        == 0)
+    {
+        info_cubepsd(
+            data.cmdargtoken[1].val.string,
+            data.cmdargtoken[2].val.numl,
+            data.cmdargtoken[3].val.numf,
+            data.cmdargtoken[4].val.numf,
+            data.cmdargtoken[5].val.numf,
+            data.cmdargtoken[6].val.string,
+            data.cmdargtoken[7].val.string
+        );
+        return CLICMD_SUCCESS;
+    }
+    else
+    {
+        return CLICMD_INVALID_ARG;
+    }
+}
+
+
+
+errno_t info_image_combine_cli()
+{
+    if(
+        CLI_checkarg(1, CLIARG_IMG) +
+        CLI_checkarg(2, CLIARG_LONG) +
+        CLI_checkarg(3, CLIARG_FLOAT) +
+        CLI_checkarg(4, CLIARG_LONG) +
+        CLI_checkarg(5, CLIARG_STR_NOT_IMG)
+        == 0)
+    {
+        info_image_combine(
+            data.cmdargtoken[1].val.string,
+            (int) data.cmdargtoken[2].val.numl,
+            data.cmdargtoken[3].val.numf,
+            (int) data.cmdargtoken[4].val.numl,
+            data.cmdargtoken[5].val.string
+        );
+        return CLICMD_SUCCESS;
+    }
+    else
+    {
+        return CLICMD_INVALID_ARG;
+    }
+}
+
+
+
+errno_t info_image_lucky_cli()
+{
+    if(
+        CLI_checkarg(1, CLIARG_IMG) +
+        CLI_checkarg(2, CLIARG_IMG) +
+        CLI_checkarg(3, CLIARG_LONG) +
+        CLI_checkarg(4, CLIARG_LONG) +
+        CLI_checkarg(5, CLIARG_STR_NOT_IMG) +
+        CLI_checkarg(6, CLIARG_STR_NOT_IMG)
+        == 0)
+    {
+        info_image_lucky(
+            data.cmdargtoken[1].val.string,
+            data.cmdargtoken[2].val.string,
+            (int) data.cmdargtoken[3].val.numl,
+            data.cmdargtoken[4].val.numl,
+            data.cmdargtoken[5].val.string,
+            data.cmdargtoken[6].val.string
+        );
+        return CLICMD_SUCCESS;
+    }
+    else
+    {
+        return CLICMD_INVALID_ARG;
+    }
+}
+
+
+
+errno_t info_cubereg_cli()
+{
+    if(
+        CLI_checkarg(1, CLIARG_IMG) +
+        CLI_checkarg(2, CLIARG_STR) +
+        CLI_checkarg(3, CLIARG_STR_NOT_IMG) +
+        CLI_checkarg(4, CLIARG_STR_NOT_IMG)
+        == 0)
+    {
+        info_cubereg(
+            data.cmdargtoken[1].val.string,
+            data.cmdargtoken[2].val.string,
+            data.cmdargtoken[3].val.string,
+            data.cmdargtoken[4].val.string
+        );
+        return CLICMD_SUCCESS;
+    }
+    else
+    {
+        return CLICMD_INVALID_ARG;
+    }
+}
+
+
+
+errno_t info_image_covar_cli()
+{
+    if(
+        CLI_checkarg(1, CLIARG_IMG) +
+        CLI_checkarg(2, CLIARG_IMG) +
+        CLI_checkarg(3, CLIARG_LONG) +
+        CLI_checkarg(4, CLIARG_STR_NOT_IMG)
+        == 0)
+    {
+        info_image_covar(
+            data.cmdargtoken[1].val.string,
+            data.cmdargtoken[2].val.string,
+            data.cmdargtoken[3].val.numl,
+            data.cmdargtoken[4].val.string
+        );
+        return CLICMD_SUCCESS;
+    }
+    else
+    {
+        return CLICMD_INVALID_ARG;
+    }
+}
+
+
+
+errno_t info_covar_stream_cli()
+{
+    if(
+        CLI_checkarg(1, CLIARG_IMG) +
+        CLI_checkarg(2, CLIARG_IMG) +
+        CLI_checkarg(3, CLIARG_LONG) +
+        CLI_checkarg(4, CLIARG_LONG) +
+        CLI_checkarg(5, CLIARG_LONG) +
+        CLI_checkarg(6, CLIARG_STR_NOT_IMG)
+        == 0)
+    {
+        info_covar_stream(
+            data.cmdargtoken[1].val.string,
+            data.cmdargtoken[2].val.string,
+            (int) data.cmdargtoken[3].val.numl,
+            data.cmdargtoken[4].val.numl,
+            data.cmdargtoken[5].val.numl,
+            data.cmdargtoken[6].val.string
+        );
+        return CLICMD_SUCCESS;
+    }
+    else
+    {
+        return CLICMD_INVALID_ARG;
+    }
+}
+
+
+
+errno_t info_image_outlier_cli()
+{
+    if(
+        CLI_checkarg(1, CLIARG_IMG) +
+        CLI_checkarg(2, CLIARG_FLOAT) +
+        CLI_checkarg(3, CLIARG_STR_NOT_IMG) +
+        CLI_checkarg(4, CLIARG_STR_NOT_IMG)
+        == 0)
+    {
+        info_image_outlier(
+            data.cmdargtoken[1].val.string,
+            data.cmdargtoken[2].val.numf,
+            data.cmdargtoken[3].val.string,
+            data.cmdargtoken[4].val.string
+        );
+        return CLICMD_SUCCESS;
+    }
+    else
+    {
+        return CLICMD_INVALID_ARG;
+    }
+}
+
+
+
+errno_t info_outlier_fits_cli()
+{
+    if(
+        CLI_checkarg(1, CLIARG_STR) +
+        CLI_checkarg(2, CLIARG_FLOAT) +
+        CLI_checkarg(3, CLIARG_STR_NOT_IMG) +
+        CLI_checkarg(4, CLIARG_STR_NOT_IMG) +
+        CLI_checkarg(5, CLIARG_LONG)
+        == 0)
+    {
+        info_outlier_fits(
+            data.cmdargtoken[1].val.string,
+            data.cmdargtoken[2].val.numf,
+            data.cmdargtoken[3].val.string,
+            data.cmdargtoken[4].val.string,
+            data.cmdargtoken[5].val.numl
+        );
+        return CLICMD_SUCCESS;
+    }
+    else
+    {
+        return CLICMD_INVALID_ARG;
+    }
+}
+
+
+
+errno_t info_cubecorr_cli()
+{
+    if(
+        CLI_checkarg(1, CLIARG_IMG) +
+        CLI_checkarg(2, CLIARG_IMG) +
+        CLI_checkarg(3, CLIARG_LONG) +
+        CLI_checkarg(4, CLIARG_STR_NOT_IMG)
+        == 0)
+    {
+        info_cubecorr(
+            data.cmdargtoken[1].val.string,
+            data.cmdargtoken[2].val.string,
+            data.cmdargtoken[3].val.numl,
+            data.cmdargtoken[4].val.string
+        );
+        return CLICMD_SUCCESS;
+    }
+    else
+    {
+        return CLICMD_INVALID_ARG;
+    }
+}
+
+
+
+errno_t info_image_wstats_cli()
+{
+    if(
+        CLI_checkarg(1, CLIARG_IMG) +
+        CLI_checkarg(2, CLIARG_IMG)
+        == 0)
+    {
+        INFO_WSTATS wstats;
+
+        if(info_image_wstats(data.cmdargtoken[1].val.string,
+                             data.cmdargtoken[2].val.string, &wstats) == RETURN_SUCCESS)
+        {
+            imageID  ID = image_ID(data.cmdargtoken[1].val.string);
+            imageID  IDw = image_ID(data.cmdargtoken[2].val.string);
+            uint64_t xysize = data.image[ID].md[0].size[0];
+            double   p = 0.5;
+            double   median = NAN;
+
+            // same first 2D plane as info_image_wstats()
+            if(data.image[ID].md[0].naxis > 1)
+            {
+                xysize *= data.image[ID].md[0].size[1];
+            }
+            if(info_wstats_percentiles(ID, 0, IDw, 0, xysize, &p, 1,
+                                       &median) != RETURN_SUCCESS)
+            {
+                PRINT_ERROR("weighted median of %s failed", data.cmdargtoken[1].val.string);
+            }
+
+            printf("weighted pixels (->vwnpix)   %ld\n", (long) wstats.NBpix);
+            printf("sum of weights  (->vwsum)    %20.18e\n", wstats.sumw);
+            printf("weighted mean   (->vwmean)   %20.18e\n", wstats.mean);
+            printf("weighted rms    (->vwrms)    %20.18e\n", wstats.rms);
+            printf("weighted median (->vwmed)    %20.18e\n", median);
+            printf("centroid x      (->vwbx)     %20.18f\n", wstats.xc);
+            printf("centroid y      (->vwby)     %20.18f\n", wstats.yc);
+            create_variable_ID("vwnpix", 1.0 * wstats.NBpix);
+            create_variable_ID("vwsum", wstats.sumw);
+            create_variable_ID("vwmean", wstats.mean);
+            create_variable_ID("vwrms", wstats.rms);
+            create_variable_ID("vwmed", median);
+            create_variable_ID("vwbx", wstats.xc);
+            create_variable_ID("vwby", wstats.yc);
+        }
+        return CLICMD_SUCCESS;
+    }
+    else
+    {
+        return CLICMD_INVALID_ARG;
+    }
+}
+
+
+
+errno_t info_image_robust_cli()
+{
+    if(
+        CLI_checkarg(1, CLIARG_IMG)
+        == 0)
+    {
+        INFO_ROBUST robust;
+
+        if(info_image_robust(data.cmdargtoken[1].val.string, &robust) == RETURN_SUCCESS)
+        {
+            printf("median          (->vmed)     %20.18e\n", robust.median);
+            printf("MAD             (->vmad)     %20.18e\n", robust.mad);
+            printf("sigma 1.4826MAD (->vmadsig)  %20.18e\n", robust.sigma);
+            printf("quartile 1      (->vq1)      %20.18e\n", robust.q1);
+            printf("quartile 3      (->vq3)      %20.18e\n", robust.q3);
+            printf("IQR             (->viqr)     %20.18e\n", robust.iqr);
+            create_variable_ID("vmed", robust.median);
+            create_variable_ID("vmad", robust.mad);
+            create_variable_ID("vmadsig", robust.sigma);
+            create_variable_ID("vq1", robust.q1);
+            create_variable_ID("vq3", robust.q3);
+            create_variable_ID("viqr", robust.iqr);
+        }
+        return CLICMD_SUCCESS;
+    }
+    else
+    {
+        return CLICMD_INVALID_ARG;
+    }
+}
+
+
+
+errno_t info_image_robust_slices_cli()
+{
+    if(
+        CLI_checkarg(1, CLIARG_IMG) +
+        CLI_checkarg(2, CLIARG_STR_NOT_IMG)
+        == 0)
+    {
+        info_image_robust_slices(
+            data.cmdargtoken[1].val.string,
+            data.cmdargtoken[2].val.string
+        );
+        return CLICMD_SUCCESS;
+    }
+    else
+    {
+        return CLICMD_INVALID_ARG;
+    }
+}
+
+
+
 errno_t info_cubestats_cli()
 {
     if(
@@ -256,6 +806,31 @@ errno_t info_image_statsf_cli()
 
 
 
+errno_t info_image_pca_cli()
+{
+    if(
+        CLI_checkarg(1, CLIARG_IMG) +
+        CLI_checkarg(2, CLIARG_LONG) +
+        CLI_checkarg(3, CLIARG_STR_NOT_IMG) +
+        CLI_checkarg(4, CLIARG_STR_NOT_IMG)
+        == 0)
+    {
+        info_image_pca(
+            data.cmdargtoken[1].val.string,
+            data.cmdargtoken[2].val.numl,
+            data.cmdargtoken[3].val.string,
+            data.cmdargtoken[4].val.string
+        );
+        return CLICMD_SUCCESS;
+    }
+    else
+    {
+        return CLICMD_INVALID_ARG;
+    }
+}
+
+
+
 errno_t info_cubeMatchMatrix_cli()
 {
     if(
@@ -301,16 +876,196 @@ static errno_t init_module_CLI()
         "int info_image_stats(const char *ID_name, \"\")"
     );
 
+    RegisterCLIcommand(
+        "imstatsmask",
+        __FILE__,
+        info_image_stats_mask_cli,
+        "image stats over pixels where mask > 0.5",
+        "<image> <mask>",
+        "imstatsmask im1 immask",
+        "int info_image_stats(const char *ID_name, \"mask=<mask>\")"
+    );
+
+    RegisterCLIcommand(
+        "imstatsclip",
+        __FILE__,
+        info_image_sigclip_cli,
+        "sigma-clipped mean and rms",
+        "<image> <nsigma> <maxiter>",
+        "imstatsclip im1 3.0 10",
+        "errno_t info_image_sigclip(const char *ID_name, const char *IDmask_name, double nsigma, int maxiter, INFO_SIGCLIP *sigclip)"
+    );
+
+    RegisterCLIcommand(
+        "immoments",
+        __FILE__,
+        info_image_moments_cli,
+        "image moments: centroid, covariance, ellipticity, FWHM",
+        "<image>",
+        "immoments im1",
+        "errno_t info_image_moments(const char *ID_name, INFO_MOMENTS *moments)"
+    );
+
+    RegisterCLIcommand(
+        "imstatsslice",
+        __FILE__,
+        info_image_slicestats_cli,
+        "per-slice stats table: min max total mean rms xc yc median nbbad",
+        "<3Dimage> <output table image>",
+        "imstatsslice imc imcstats",
+        "imageID info_image_slicestats(const char *ID_name, const char *IDout_name)"
+    );
+
+    RegisterCLIcommand(
+        "imwstats",
+        __FILE__,
+        info_image_wstats_cli,
+        "weighted stats: mean, rms, median, centroid",
+        "<image> <weight image>",
+        "imwstats im1 imw",
+        "errno_t info_image_wstats(const char *ID_name, const char *IDw_name, INFO_WSTATS *wstats)"
+    );
+
+    RegisterCLIcommand(
+        "imrobust",
+        __FILE__,
+        info_image_robust_cli,
+        "robust stats: median, MAD, quartiles",
+        "<image>",
+        "imrobust im1",
+        "errno_t info_image_robust(const char *ID_name, INFO_ROBUST *robust)"
+    );
+
+    RegisterCLIcommand(
+        "imrobustslice",
+        __FILE__,
+        info_image_robust_slices_cli,
+        "per-slice robust stats table: median mad sigma q1 q3 iqr nbpix",
+        "<3Dimage> <output table image>",
+        "imrobustslice imc imcrobust",
+        "imageID info_image_robust_slices(const char *ID_name, const char *IDout_name)"
+    );
+
     RegisterCLIcommand(
         "cubestats",
         __FILE__,
         info_cubestats_cli,
-        "image cube stats",
+        "image cube stats, output file is FITS if name ends with .fits",
         "<3Dimage> <mask> <output file>",
         "cubestats imc immask imc_stats.txt",
         "long info_cubestats(const char *ID_name, const char *IDmask_name, const char *outfname)"
     );
 
+    RegisterCLIcommand(
+        "cubestatsstream",
+        __FILE__,
+        info_cubestats_stream_cli,
+        "per-frame masked stats of a live stream, to circular output stream",
+        "<stream> <mask> <semaphore> <output stream> <NBrow> <NBframe, 0 until SIGINT>",
+        "cubestatsstream ims immask 3 ims_stats 10000 0",
+        "errno_t info_cubestats_stream(const char *ID_name, const char *IDmask_name, int sem, const char *IDout_name, long NBrow, long NBframe)"
+    );
+
+    RegisterCLIcommand(
+        "cubestatsfits",
+        __FILE__,
+        info_cubestats_fits_cli,
+        "image cube stats of FITS file read in blocks of slices, for cubes larger than memory",
+        "<FITS file> <mask> <output file> <NBslice per block, 0 for default>",
+        "cubestatsfits cube.fits immask cube_stats.txt 0",
+        "errno_t info_cubestats_fits(const char *fname, const char *IDmask_name, const char *outfname, long NBslice)"
+    );
+
+    RegisterCLIcommand(
+        "cubecorr",
+        __FILE__,
+        info_cubecorr_cli,
+        "image cube slice correlation versus frame lag",
+        "<3Dimage> <mask> <max lag> <output file>",
+        "cubecorr imc immask 100 corr.txt",
+        "errno_t info_cubecorr(const char *ID_name, const char *IDmask_name, long kcmax, const char *outfname)"
+    );
+
+    RegisterCLIcommand(
+        "cubepsd",
+        __FILE__,
+        info_cubepsd_cli,
+        "per-pixel temporal PSD (Welch, Hann window) and band power map",
+        "<3Dimage> <segment length> <sampling frequency> <fmin> <fmax> <output PSD cube> <output band power map>",
+        "cubepsd imc 256 1000.0 50.0 60.0 imcpsd imcband",
+        "errno_t info_cubepsd(const char *ID_name, long seglen, double fsample, double fmin, double fmax, const char *IDpsd_name, const char *IDband_name)"
+    );
+
+    RegisterCLIcommand(
+        "cubecombine",
+        __FILE__,
+        info_image_combine_cli,
+        "combine cube slices pixel by pixel : median (0) or sigma-clipped mean (1)",
+        "<3Dimage> <method> <nsigma> <maxiter> <output image>",
+        "cubecombine darkcube 1 3.0 10 darkmaster",
+        "imageID info_image_combine(const char *ID_name, int method, double nsigma, int maxiter, const char *IDout_name)"
+    );
+
+    RegisterCLIcommand(
+        "cubelucky",
+        __FILE__,
+        info_image_lucky_cli,
+        "rank cube slices by sharpness : peak (0), power (1), normalized power (2), keep k best",
+        "<3Dimage> <mask> <metric> <k> <output file> <output cube>",
+        "cubelucky imc immask 2 100 imc_lucky.txt imcbest",
+        "imageID info_image_lucky(const char *ID_name, const char *IDmask_name, int metric, long k, const char *outfname, const char *IDout_name)"
+    );
+
+    RegisterCLIcommand(
+        "cubereg",
+        __FILE__,
+        info_cubereg_cli,
+        "sub-pixel shift of cube slices against reference by FFT cross-correlation",
+        "<3Dimage> <reference image, none for first slice> <output shift file> <output registered cube>",
+        "cubereg imc imref imc_shift.txt imcreg",
+        "errno_t info_cubereg(const char *ID_name, const char *IDref_name, const char *outfname, const char *IDout_name)"
+    );
+
+    RegisterCLIcommand(
+        "cubecovar",
+        __FILE__,
+        info_image_covar_cli,
+        "pixel-to-pixel temporal covariance matrix of cube, over mask pixels",
+        "<3Dimage> <mask> <frames per update, 0 for default> <output matrix>",
+        "cubecovar imc immask 0 imccov",
+        "imageID info_image_covar(const char *ID_name, const char *IDmask_name, long blocksize, const char *IDout_name)"
+    );
+
+    RegisterCLIcommand(
+        "covarstream",
+        __FILE__,
+        info_covar_stream_cli,
+        "pixel-to-pixel temporal covariance matrix of live stream, over mask pixels",
+        "<stream> <mask> <semaphore> <NBframe> <frames per update, 0 for default> <output matrix>",
+        "covarstream wfsslopes wfsmask 4 10000 0 slopecov",
+        "imageID info_covar_stream(const char *ID_name, const char *IDmask_name, int sem, long NBframe, long blocksize, const char *IDout_name)"
+    );
+
+    RegisterCLIcommand(
+        "cubeoutlier",
+        __FILE__,
+        info_image_outlier_cli,
+        "flag pixels deviating from their temporal median by more than nsigma robust sigma",
+        "<3Dimage> <nsigma> <output bit-packed flag cube> <output per-slice count>",
+        "cubeoutlier imc 5.0 imcflag imccount",
+        "imageID info_image_outlier(const char *ID_name, double nsigma, const char *IDflag_name, const char *IDcount_name)"
+    );
+
+    RegisterCLIcommand(
+        "cubeoutlierfits",
+        __FILE__,
+        info_outlier_fits_cli,
+        "flag temporal outliers of FITS cube read in blocks of slices, for cubes larger than memory",
+        "<FITS file> <nsigma> <output bit-packed flag cube, or .fits file> <output per-slice count> <NBslice per block, 0 for default>",
+        "cubeoutlierfits cube.fits 5.0 cubeflag.fits cubecount 0",
+        "imageID info_outlier_fits(const char *fname, double nsigma, const char *IDflag_name, const char *IDcount_name, long NBslice)"
+    );
+
     RegisterCLIcommand(
         "imstatsf",
         __FILE__,
@@ -362,6 +1117,16 @@ static errno_t init_module_CLI()
         "long info_cubeMatchMatrix(const char* IDin_name, const char* IDout_name)"
     );
 
+    RegisterCLIcommand(
+        "cubepca",
+        __FILE__,
+        info_image_pca_cli,
+        "principal components of cube slices: spatial modes and coefficients",
+        "<imagecube> <number of modes> <output modes cube> <output coefficients>",
+        "cubepca incube 20 pcamodes pcacoeff",
+        "imageID info_image_pca(const char *ID_name, long K, const char *IDmodes_name, const char *IDcoeff_name)"
+    );
+
 
     return RETURN_SUCCESS;
 }
@@ -1751,209 +2516,311 @@ float img_percentile_float(
     float       p
 )
 {
-    imageID     ID;
-    uint32_t    naxes[2];
-    float       value = 0;
-    float      *array;
-    uint64_t    nelements;
-    uint64_t    n;
+    double value;
 
-    ID = image_ID(ID_name);
-    naxes[0] = data.image[ID].md[0].size[0];
-    naxes[1] = data.image[ID].md[0].size[1];
-    nelements = naxes[0] * naxes[1];
+    value = img_percentile_double(ID_name, (double) p);
 
-    array = (float *) malloc(nelements * sizeof(float));
-    for(unsigned long ii = 0; ii < nelements; ii++)
-    {
-        array[ii] = data.image[ID].array.F[ii];
-    }
+    printf("percentile %f = %f\n", p, value);
 
-    quick_sort_float(array, nelements);
+    return (float) value;
+}
+
+
+double img_percentile_double(
+    const char *ID_name,
+    double      p
+)
+{
+    imageID    ID;
+    double     value = NAN;
 
-    n = (uint64_t)(p * naxes[1] * naxes[0]);
-    if(n > 0)
+    ID = image_ID(ID_name);
+    if(ID == -1)
     {
-        if(n > (nelements - 1))
-        {
-            n = (nelements - 1);
-        }
+        PRINT_ERROR("image %s not found", ID_name);
+        return NAN;
     }
-    value = array[n];
-    free(array);
+    info_robust_percentiles(ID, 0, data.image[ID].md[0].nelement, NULL, &p, 1,
+                            &value);
 
-    printf("percentile %f = %f (%ld)\n", p, value, n);
-
-    return(value);
+    return value;
 }
 
 
-double img_percentile_double(
+
+
+double img_percentile(
     const char *ID_name,
     double      p
 )
 {
     imageID    ID;
-    uint32_t   naxes[2];
-    double     value = 0;
-    double    *array;
-    uint64_t   nelements;
-    uint64_t   n;
+    double     value = NAN;
 
     ID = image_ID(ID_name);
-    naxes[0] = data.image[ID].md[0].size[0];
-    naxes[1] = data.image[ID].md[0].size[1];
-    nelements = naxes[0] * naxes[1];
+    if(ID == -1)
+    {
+        PRINT_ERROR("image %s not found", ID_name);
+        return NAN;
+    }
+    if(info_pixstats_datatype_supported(data.image[ID].md[0].datatype) == 0)
+    {
+        PRINT_ERROR("datatype %d not supported",
+                    (int) data.image[ID].md[0].datatype);
+        return NAN;
+    }
+    if(info_statcache_percentiles(ID, &p, 1, &value) != RETURN_SUCCESS)
+    {
+        return NAN;
+    }
+
+    return value;
+}
+
+
 
-    array = (double *) malloc(nelements * sizeof(double));
-    for(unsigned long ii = 0; ii < nelements; ii++)
+// first rank written by img_histoc : ranks ii > (1-frac).n
+static uint64_t img_histoc_start(
+    uint64_t n,
+    double   frac
+)
+{
+    if(frac >= 1.0)
+    {
+        return 0;
+    }
+    if(!(frac > 0.0))
     {
-        array[ii] = data.image[ID].array.F[ii];
+        return n;
     }
 
-    quick_sort_double(array, nelements);
+    uint64_t k0 = (uint64_t)((1.0 - frac) * n) + 1;
+
+    return (k0 > n) ? n : k0;
+}
+
+
+
+
+// write cumulative curve of sorted top[0, n-k0[ , ranks k0 to n-1
+// lines are formatted into a large buffer, written by blocks
+static errno_t img_histoc_write(
+    const char   *fname,
+    uint64_t      n,
+    uint64_t      k0,
+    double        sumlow,
+    const double *top
+)
+{
+    FILE  *fp;
+    size_t bufsize = 1024 * 1024;
+    size_t buflen = 0;
+    char  *buffer;
+
+    if((fp = fopen(fname, "w")) == NULL)
+    {
+        PRINT_ERROR("cannot open file \"%s\"", fname);
+        return RETURN_FAILURE;
+    }
+    buffer = (char *) malloc(bufsize);
+    if(buffer == NULL)
+    {
+        PRINT_ERROR("malloc error");
+        fclose(fp);
+        return RETURN_FAILURE;
+    }
 
-    n = (uint64_t)(p * naxes[1] * naxes[0]);
-    if(n > 0)
+    double value = sumlow;
+    for(uint64_t ii = k0; ii < n; ii++)
     {
-        if(n > (nelements - 1))
+        value += top[ii - k0];
+        buflen += snprintf(buffer + buflen, bufsize - buflen, "%ld %g %g\n",
+                           (long)(n - ii), value, top[ii - k0]);
+        if(bufsize - buflen < 128)
         {
-            n = (nelements - 1);
+            fwrite(buffer, 1, buflen, fp);
+            buflen = 0;
         }
     }
-    value = array[n];
-    free(array);
+    fwrite(buffer, 1, buflen, fp);
 
-    return(value);
+    free(buffer);
+    fclose(fp);
+
+    return RETURN_SUCCESS;
 }
 
 
 
 
-double img_percentile(
+/**
+ * @brief Cumulative flux curve of the brightest pixels of a float image
+ *
+ * Writes one line per pixel of rank ii > (1-frac).N in increasing pixel
+ * value : N-ii, sum of pixel values up to rank ii, pixel value.
+ * N is the number of finite pixels. The image is partitioned at the first
+ * written rank by selection, and only the top fraction is sorted.
+ */
+errno_t img_histoc_float(
     const char *ID_name,
-    double      p
+    const char *fname,
+    double      frac
 )
 {
-    imageID    ID;
-    uint8_t    datatype;
-    double     value = 0.0;
+    imageID     ID;
+    float      *array;
+    double     *top;
+    uint64_t    nelements;
+    uint64_t    n = 0;
 
     ID = image_ID(ID_name);
-    datatype = data.image[ID].md[0].datatype;
+    if(ID == -1)
+    {
+        PRINT_ERROR("image %s not found", ID_name);
+        return RETURN_FAILURE;
+    }
+    nelements = data.image[ID].md[0].nelement;
 
-    if(datatype == _DATATYPE_FLOAT)
+    array = (float *) malloc(sizeof(float) * (nelements + 1));
+    if(array == NULL)
+    {
+        PRINT_ERROR("malloc error");
+        return RETURN_FAILURE;
+    }
+    for(uint64_t ii = 0; ii < nelements; ii++)
     {
-        value = (double) img_percentile_float(ID_name, (float) p);
+        float v = data.image[ID].array.F[ii];
+        if(isfinite(v))
+        {
+            array[n++] = v;
+        }
     }
-    if(datatype == _DATATYPE_DOUBLE)
+
+    uint64_t k0 = img_histoc_start(n, frac);
+    if(k0 < n)
     {
-        value = img_percentile_double(ID_name, p);
+        info_select_float(array, n, k0);
     }
 
-    return value;
+    double sumlow = 0.0;
+    for(uint64_t ii = 0; ii < k0; ii++)
+    {
+        sumlow += array[ii];
+    }
+
+    top = (double *) malloc(sizeof(double) * (n - k0 + 1));
+    if(top == NULL)
+    {
+        PRINT_ERROR("malloc error");
+        free(array);
+        return RETURN_FAILURE;
+    }
+    for(uint64_t ii = k0; ii < n; ii++)
+    {
+        top[ii - k0] = array[ii];
+    }
+    free(array);
+
+    quick_sort_double(top, n - k0);
+
+    errno_t ret = img_histoc_write(fname, n, k0, sumlow, top);
+    free(top);
+
+    return ret;
 }
 
 
 
-errno_t img_histoc_float(
+
+/**
+ * @brief Cumulative flux curve of the brightest pixels, any datatype
+ *
+ * Same as img_histoc_float, computed in double precision.
+ */
+errno_t img_histoc_double(
     const char *ID_name,
-    const char *fname
+    const char *fname,
+    double      frac
 )
 {
-    FILE       *fp;
     imageID     ID;
-    uint32_t    naxes[2];
-    float       value = 0;
-    float      *array;
+    double     *array;
     uint64_t    nelements;
+    uint64_t    n;
 
     ID = image_ID(ID_name);
-    naxes[0] = data.image[ID].md[0].size[0];
-    naxes[1] = data.image[ID].md[0].size[1];
-    nelements = naxes[0] * naxes[1];
-
-    array = (float *) malloc(naxes[1] * naxes[0] * sizeof(float));
-    for(unsigned long jj = 0; jj < naxes[1]; jj++)
-        for(unsigned long ii = 0; ii < naxes[0]; ii++)
-        {
-            array[jj * naxes[0] + ii] = data.image[ID].array.F[jj * naxes[0] + ii];
-        }
+    if(ID == -1)
+    {
+        PRINT_ERROR("image %s not found", ID_name);
+        return RETURN_FAILURE;
+    }
+    if(info_pixstats_datatype_supported(data.image[ID].md[0].datatype) == 0)
+    {
+        PRINT_ERROR("datatype %d not supported",
+                    (int) data.image[ID].md[0].datatype);
+        return RETURN_FAILURE;
+    }
+    nelements = data.image[ID].md[0].nelement;
 
-    quick_sort_float(array, nelements);
+    array = (double *) malloc(sizeof(double) * (nelements + 1));
+    if(array == NULL)
+    {
+        PRINT_ERROR("malloc error");
+        return RETURN_FAILURE;
+    }
+    info_pixstats_copy_double(ID, 0, nelements, NULL, array, &n);
 
-    if((fp = fopen(fname, "w")) == NULL)
+    uint64_t k0 = img_histoc_start(n, frac);
+    if(k0 < n)
     {
-        printf("ERROR: cannot open file \"%s\"\n", fname);
-        exit(0);
+        info_select_double(array, n, k0);
     }
-    value = 0.0;
-    for(unsigned long ii = 0; ii < nelements; ii++)
+
+    double sumlow = 0.0;
+    for(uint64_t ii = 0; ii < k0; ii++)
     {
-        value += array[ii];
-        if(ii > 0.99 * nelements)
-        {
-            fprintf(fp, "%ld %g %g\n", nelements - ii, value, array[ii]);
-        }
+        sumlow += array[ii];
     }
 
-    fclose(fp);
+    quick_sort_double(array + k0, n - k0);
+
+    errno_t ret = img_histoc_write(fname, n, k0, sumlow, array + k0);
     free(array);
 
-    return RETURN_SUCCESS;
+    return ret;
 }
 
 
 
 
-errno_t img_histoc_double(
+/**
+ * @brief Cumulative flux curve of the brightest INFO_HISTOC_FRACTION pixels
+ */
+errno_t img_histoc(
     const char *ID_name,
     const char *fname
 )
 {
-    FILE       *fp;
-    imageID     ID;
-    uint32_t    naxes[2];
-    double      value = 0;
-    double     *array;
-    uint64_t    nelements;
+    imageID ID;
 
     ID = image_ID(ID_name);
-    naxes[0] = data.image[ID].md[0].size[0];
-    naxes[1] = data.image[ID].md[0].size[1];
-    nelements = naxes[0] * naxes[1];
-
-    array = (double *) malloc(naxes[1] * naxes[0] * sizeof(double));
-    for(unsigned long jj = 0; jj < naxes[1]; jj++)
-        for(unsigned long ii = 0; ii < naxes[0]; ii++)
-        {
-            array[jj * naxes[0] + ii] = data.image[ID].array.F[jj * naxes[0] + ii];
-        }
-
-    quick_sort_double(array, nelements);
-
-    if((fp = fopen(fname, "w")) == NULL)
+    if(ID == -1)
     {
-        printf("ERROR: cannot open file \"%s\"\n", fname);
-        exit(0);
+        PRINT_ERROR("image %s not found", ID_name);
+        return RETURN_FAILURE;
     }
-    value = 0.0;
-    for(unsigned long ii = 0; ii < nelements; ii++)
+
+    if(data.image[ID].md[0].datatype == _DATATYPE_FLOAT)
     {
-        value += array[ii];
-        if(ii > 0.99 * nelements)
-        {
-            fprintf(fp, "%ld %g %g\n", nelements - ii, value, array[ii]);
-        }
+        return img_histoc_float(ID_name, fname, INFO_HISTOC_FRACTION);
     }
 
-    fclose(fp);
-    free(array);
-
-    return RETURN_SUCCESS;
+    return img_histoc_double(ID_name, fname, INFO_HISTOC_FRACTION);
 }
 
 
+
+
 errno_t make_histogram(
     const char *ID_name,
     const char *ID_out_name,
@@ -1990,47 +2857,32 @@ errno_t make_histogram(
 
 double ssquare(const char *ID_name)
 {
-    int ID;
-    uint32_t naxes[2];
-    double ssquare;
+    imageID ID;
+    INFO_PIXSTATS pixstats;
 
     ID = image_ID(ID_name);
-    naxes[0] = data.image[ID].md[0].size[0];
-    naxes[1] = data.image[ID].md[0].size[1];
+    info_statcache_pixstats(ID, &pixstats);
 
-    ssquare = 0;
-    for(unsigned long jj = 0; jj < naxes[1]; jj++)
-        for(unsigned long ii = 0; ii < naxes[0]; ii++)
-        {
-            ssquare = ssquare + data.image[ID].array.F[jj * naxes[0] + ii] *
-                      data.image[ID].array.F[jj * naxes[0] + ii];
-        }
-    return(ssquare);
+    return(pixstats.ssquare);
 }
 
 
 
 
+// standard deviation of finite pixel values
 double rms_dev(const char *ID_name)
 {
-    int ID;
-    uint32_t naxes[2];
-    double ssquare, rms;
-    double constant;
+    imageID ID;
+    double  rms = NAN;
 
     ID = image_ID(ID_name);
-    naxes[0] = data.image[ID].md[0].size[0];
-    naxes[1] = data.image[ID].md[0].size[1];
+    if(ID == -1)
+    {
+        PRINT_ERROR("image %s not found", ID_name);
+        return NAN;
+    }
+    info_statcache_rms(ID, &rms);
 
-    ssquare = 0;
-    constant = arith_image_total(ID_name) / naxes[0] / naxes[1];
-    for(unsigned long jj = 0; jj < naxes[1]; jj++)
-        for(unsigned long ii = 0; ii < naxes[0]; ii++)
-        {
-            ssquare = ssquare + (data.image[ID].array.F[jj * naxes[0] + ii] - constant) *
-                      (data.image[ID].array.F[jj * naxes[0] + ii] - constant);
-        }
-    rms = sqrt(ssquare / naxes[1] / naxes[0]);
     return(rms);
 }
 
@@ -2038,27 +2890,51 @@ double rms_dev(const char *ID_name)
 
 
 
-// option "fileout" : output to file imstat.info.txt
-errno_t info_image_stats(
+// percentiles reported by info_image_stats
+static const struct
+{
+    double      p;
+    const char *label;
+    const char *vname;
+} imstats_percentiles[] =
+{
+    { 0.01,  "1  percent",   "vp01"  },
+    { 0.05,  "5  percent",   "vp05"  },
+    { 0.10,  "10 percent",   "vp10"  },
+    { 0.20,  "20 percent",   "vp20"  },
+    { 0.50,  "50 percent",   "vp50"  },
+    { 0.80,  "80 percent",   "vp80"  },
+    { 0.90,  "90 percent",   "vp90"  },
+    { 0.95,  "95 percent",   "vp95"  },
+    { 0.99,  "99 percent",   "vp99"  },
+    { 0.995, "99.5 percent", "vp995" },
+    { 0.998, "99.8 percent", "vp998" },
+    { 0.999, "99.9 percent", "vp999" }
+};
+
+
+
+
+// body of info_image_stats(), options are documented there
+static errno_t info_image_stats_run(
     const char *ID_name,
     const char *options
 )
 {
     imageID        ID;
-    double         min, max;
     double         rms;
     uint64_t       nelements;
+    uint64_t       nbvalid;
     double         tot;
-    double        *array;
-    long           iimin, iimax;
     uint8_t        datatype;
     long           tmp_long;
     char           type[20];
     char           vname[200];
-    double         xtot, ytot;
-    double         vbx, vby;
-    FILE          *fp;
+    FILE          *fp = NULL;
     int            mode = 0;
+    INFO_PIXSTATS  pixstats;
+    INFO_PIXMASK   pixmaskdata;
+    INFO_PIXMASK  *pixmask = NULL;
 
     // printf("OPTIONS = %s\n",options);
     if(strstr(options, "fileout") != NULL)
@@ -2071,12 +2947,87 @@ errno_t info_image_stats(
         fp = fopen("imstat.info.txt", "w");
     }
 
-
     ID = image_ID_noaccessupdate(ID_name);
     if(ID != -1)
     {
         nelements =  data.image[ID].md[0].nelement;
 
+        {
+            uint32_t xsize = data.image[ID].md[0].size[0];
+            uint32_t ysize = 1;
+            const char *optstr;
+
+            if(data.image[ID].md[0].naxis > 1)
+            {
+                ysize = data.image[ID].md[0].size[1];
+            }
+
+            if((optstr = strstr(options, "mask=")) != NULL)
+            {
+                char    maskname[200];
+                imageID IDmask;
+
+                sscanf(optstr + strlen("mask="), "%199[^ ,]", maskname);
+                IDmask = image_ID(maskname);
+                if(IDmask == -1)
+                {
+                    PRINT_ERROR("mask image %s not found", maskname);
+                    if(mode == 1)
+                    {
+                        fclose(fp);
+                    }
+                    return RETURN_FAILURE;
+                }
+                if((data.image[IDmask].md[0].size[0] != xsize)
+                        || (data.image[IDmask].md[0].nelement != (uint64_t) xsize * ysize))
+                {
+                    PRINT_ERROR("mask image %s size does not match image %s",
+                                maskname, ID_name);
+                    if(mode == 1)
+                    {
+                        fclose(fp);
+                    }
+                    return RETURN_FAILURE;
+                }
+                if(info_pixmask_build_image(&pixmaskdata, IDmask) != RETURN_SUCCESS)
+                {
+                    PRINT_ERROR("cannot build mask from image %s", maskname);
+                    if(mode == 1)
+                    {
+                        fclose(fp);
+                    }
+                    return RETURN_FAILURE;
+                }
+                pixmask = &pixmaskdata;
+            }
+            else if((optstr = strstr(options, "roi=")) != NULL)
+            {
+                unsigned int xmin, xmax, ymin, ymax;
+
+                if(sscanf(optstr + strlen("roi="), "%u:%u,%u:%u", &xmin, &xmax, &ymin,
+                          &ymax) != 4)
+                {
+                    PRINT_ERROR("roi format is roi=xmin:xmax,ymin:ymax");
+                    if(mode == 1)
+                    {
+                        fclose(fp);
+                    }
+                    return RETURN_FAILURE;
+                }
+                if(info_pixmask_build_roi(&pixmaskdata, xsize, ysize, xmin, xmax, ymin,
+                                          ymax) != RETURN_SUCCESS)
+                {
+                    PRINT_ERROR("cannot build roi %u:%u,%u:%u", xmin, xmax, ymin, ymax);
+                    if(mode == 1)
+                    {
+                        fclose(fp);
+                    }
+                    return RETURN_FAILURE;
+                }
+                pixmask = &pixmaskdata;
+            }
+        }
+
         datatype = data.image[ID].md[0].datatype;
         tmp_long = data.image[ID].md[0].nelement * TYPESIZE[datatype];
         printf("\n");
@@ -2165,57 +3116,61 @@ errno_t info_image_stats(
         //      printf("Created:         %f\n", data.image[ID].creation_time);
         //      printf("Last access:     %f\n", data.image[ID].last_access);
 
-        if(datatype == _DATATYPE_FLOAT)
+        if(info_pixstats_datatype_supported(datatype) == 1)
         {
-
-            min = data.image[ID].array.F[0];
-            max = data.image[ID].array.F[0];
-
-            iimin = 0;
-            iimax = 0;
-            for(unsigned long ii = 0; ii < nelements; ii++)
+            if(pixmask == NULL)
             {
-                if(min > data.image[ID].array.F[ii])
-                {
-                    min = data.image[ID].array.F[ii];
-                    iimin = ii;
-                }
-                if(max < data.image[ID].array.F[ii])
+                info_statcache_pixstats(ID, &pixstats);
+            }
+            else
+            {
+                info_pixstats_compute(ID, 0, nelements, pixmask, &pixstats);
+            }
+            if(pixmask != NULL)
+            {
+                nelements = pixmask->NBpix;
+                printf("Selected pixels (->vnbpix)   %ld\n", (long) nelements);
+                if(mode == 1)
                 {
-                    max = data.image[ID].array.F[ii];
-                    iimax = ii;
+                    fprintf(fp, "selected pixels          %ld\n", (long) nelements);
                 }
+                create_variable_ID("vnbpix", 1.0 * nelements);
             }
 
-            array = (double *) malloc(nelements * sizeof(double));
-            tot = 0.0;
+            // statistics are computed over finite pixels
+            nbvalid = nelements - pixstats.NBnan - pixstats.NBinf;
+            tot = pixstats.total;
+            rms = sqrt(pixstats.ssquare);
 
-            rms = 0.0;
-            for(unsigned long ii = 0; ii < nelements; ii++)
+            if(nbvalid != nelements)
             {
-                if(isnan(data.image[ID].array.F[ii]) != 0)
+                printf("NaN pixels      (->vnan)     %ld\n", (long) pixstats.NBnan);
+                printf("Inf pixels      (->vinf)     %ld\n", (long) pixstats.NBinf);
+                if(mode == 1)
                 {
-                    printf("element %ld is NAN -> replacing by 0\n", ii);
-                    data.image[ID].array.F[ii] = 0.0;
+                    fprintf(fp, "NaN pixels               %ld\n", (long) pixstats.NBnan);
+                    fprintf(fp, "Inf pixels               %ld\n", (long) pixstats.NBinf);
                 }
-                tot += data.image[ID].array.F[ii];
-                rms += data.image[ID].array.F[ii] * data.image[ID].array.F[ii];
-                array[ii] = data.image[ID].array.F[ii];
             }
-            rms = sqrt(rms);
+            create_variable_ID("vnan", 1.0 * pixstats.NBnan);
+            create_variable_ID("vinf", 1.0 * pixstats.NBinf);
 
-            printf("minimum         (->vmin)     %20.18e [ pix %ld ]\n", min, iimin);
+            printf("minimum         (->vmin)     %20.18e [ pix %ld ]\n", pixstats.min,
+                   (long) pixstats.iimin);
             if(mode == 1)
             {
-                fprintf(fp, "minimum                  %20.18e [ pix %ld ]\n", min, iimin);
+                fprintf(fp, "minimum                  %20.18e [ pix %ld ]\n", pixstats.min,
+                        (long) pixstats.iimin);
             }
-            create_variable_ID("vmin", min);
-            printf("maximum         (->vmax)     %20.18e [ pix %ld ]\n", max, iimax);
+            create_variable_ID("vmin", pixstats.min);
+            printf("maximum         (->vmax)     %20.18e [ pix %ld ]\n", pixstats.max,
+                   (long) pixstats.iimax);
             if(mode == 1)
             {
-                fprintf(fp, "maximum                  %20.18e [ pix %ld ]\n", max, iimax);
+                fprintf(fp, "maximum                  %20.18e [ pix %ld ]\n", pixstats.max,
+                        (long) pixstats.iimax);
             }
-            create_variable_ID("vmax", max);
+            create_variable_ID("vmax", pixstats.max);
             printf("total           (->vtot)     %20.18e\n", tot);
             if(mode == 1)
             {
@@ -2228,163 +3183,100 @@ errno_t info_image_stats(
                 fprintf(fp, "rms                      %20.18e\n", rms);
             }
             create_variable_ID("vrms", rms);
-            printf("rms per pixel   (->vrmsp)    %20.18e\n", rms / sqrt(nelements));
+            printf("rms per pixel   (->vrmsp)    %20.18e\n", rms / sqrt(nbvalid));
             if(mode == 1)
             {
-                fprintf(fp, "rms per pixel            %20.18e\n", rms / sqrt(nelements));
+                fprintf(fp, "rms per pixel            %20.18e\n", rms / sqrt(nbvalid));
             }
-            create_variable_ID("vrmsp", rms / sqrt(nelements));
+            create_variable_ID("vrmsp", rms / sqrt(nbvalid));
             printf("rms dev per pix (->vrmsdp)   %20.18e\n",
-                   sqrt(rms * rms / nelements - tot * tot / nelements / nelements));
+                   sqrt(rms * rms / nbvalid - tot * tot / nbvalid / nbvalid));
             create_variable_ID("vrmsdp",
-                               sqrt(rms * rms / nelements - tot * tot / nelements / nelements));
-            printf("mean            (->vmean)    %20.18e\n", tot / nelements);
+                               sqrt(rms * rms / nbvalid - tot * tot / nbvalid / nbvalid));
+            printf("mean            (->vmean)    %20.18e\n", tot / nbvalid);
             if(mode == 1)
             {
-                fprintf(fp, "mean                     %20.18e\n", tot / nelements);
+                fprintf(fp, "mean                     %20.18e\n", tot / nbvalid);
             }
-            create_variable_ID("vmean", tot / nelements);
+            create_variable_ID("vmean", tot / nbvalid);
 
             if(data.image[ID].md[0].naxis == 2)
             {
-                xtot = 0.0;
-                ytot = 0.0;
-                for(unsigned long ii = 0; ii < data.image[ID].md[0].size[0]; ii++)
-                    for(unsigned long jj = 0; jj < data.image[ID].md[0].size[1]; jj++)
-                    {
-                        xtot += data.image[ID].array.F[jj * data.image[ID].md[0].size[0] + ii] * ii;
-                        ytot += data.image[ID].array.F[jj * data.image[ID].md[0].size[0] + ii] * jj;
-                    }
-                vbx = xtot / tot;
-                vby = ytot / tot;
-                printf("Barycenter x    (->vbx)      %20.18f\n", vbx);
+                INFO_MOMENTS moments;
+
+                info_moments_compute(ID, 0, pixmask, &moments);
+                printf("Barycenter x    (->vbx)      %20.18f\n", moments.xc);
                 if(mode == 1)
                 {
-                    fprintf(fp, "photocenterX             %20.18e\n", vbx);
+                    fprintf(fp, "photocenterX             %20.18e\n", moments.xc);
                 }
-                create_variable_ID("vbx", vbx);
-                printf("Barycenter y    (->vby)      %20.18f\n", vby);
+                create_variable_ID("vbx", moments.xc);
+                printf("Barycenter y    (->vby)      %20.18f\n", moments.yc);
                 if(mode == 1)
                 {
-                    fprintf(fp, "photocenterY             %20.18e\n", vby);
+                    fprintf(fp, "photocenterY             %20.18e\n", moments.yc);
                 }
-                create_variable_ID("vby", vby);
-            }
-
-            quick_sort_double(array, nelements);
-            printf("\n");
-            printf("percentile values:\n");
-
-            printf("1  percent      (->vp01)     %20.18e\n",
-                   array[(long)(0.01 * nelements)]);
-            if(mode == 1)
-            {
-                fprintf(fp, "percentile01             %20.18e\n",
-                        array[(long)(0.01 * nelements)]);
-            }
-            create_variable_ID("vp01", array[(long)(0.01 * nelements)]);
-
-            printf("5  percent      (->vp05)     %20.18e\n",
-                   array[(long)(0.05 * nelements)]);
-            if(mode == 1)
-            {
-                fprintf(fp, "percentile05             %20.18e\n",
-                        array[(long)(0.05 * nelements)]);
-            }
-            create_variable_ID("vp05", array[(long)(0.05 * nelements)]);
-
-            printf("10 percent      (->vp10)     %20.18e\n",
-                   array[(long)(0.1 * nelements)]);
-            if(mode == 1)
-            {
-                fprintf(fp, "percentile10             %20.18e\n",
-                        array[(long)(0.10 * nelements)]);
-            }
-            create_variable_ID("vp10", array[(long)(0.1 * nelements)]);
-
-            printf("20 percent      (->vp20)     %20.18e\n",
-                   array[(long)(0.2 * nelements)]);
-            if(mode == 1)
-            {
-                fprintf(fp, "percentile20             %20.18e\n",
-                        array[(long)(0.20 * nelements)]);
-            }
-            create_variable_ID("vp20", array[(long)(0.2 * nelements)]);
-
-            printf("50 percent      (->vp50)     %20.18e\n",
-                   array[(long)(0.5 * nelements)]);
-            if(mode == 1)
-            {
-                fprintf(fp, "percentile50             %20.18e\n",
-                        array[(long)(0.50 * nelements)]);
-            }
-            create_variable_ID("vp50", array[(long)(0.5 * nelements)]);
-
-            printf("80 percent      (->vp80)     %20.18e\n",
-                   array[(long)(0.8 * nelements)]);
-            if(mode == 1)
-            {
-                fprintf(fp, "percentile80             %20.18e\n",
-                        array[(long)(0.80 * nelements)]);
+                create_variable_ID("vby", moments.yc);
+                printf("Moment xx       (->vmxx)     %20.18e\n", moments.mxx);
+                printf("Moment yy       (->vmyy)     %20.18e\n", moments.myy);
+                printf("Moment xy       (->vmxy)     %20.18e\n", moments.mxy);
+                printf("Ellipticity     (->vell)     %20.18e\n", moments.ellipticity);
+                printf("FWHM            (->vfwhm)    %20.18e\n", moments.fwhm);
+                if(mode == 1)
+                {
+                    fprintf(fp, "momentXX                 %20.18e\n", moments.mxx);
+                    fprintf(fp, "momentYY                 %20.18e\n", moments.myy);
+                    fprintf(fp, "momentXY                 %20.18e\n", moments.mxy);
+                    fprintf(fp, "ellipticity              %20.18e\n", moments.ellipticity);
+                    fprintf(fp, "FWHM                     %20.18e\n", moments.fwhm);
+                }
+                create_variable_ID("vmxx", moments.mxx);
+                create_variable_ID("vmyy", moments.myy);
+                create_variable_ID("vmxy", moments.mxy);
+                create_variable_ID("vell", moments.ellipticity);
+                create_variable_ID("vfwhm", moments.fwhm);
             }
-            create_variable_ID("vp80", array[(long)(0.8 * nelements)]);
 
-            printf("90 percent      (->vp90)     %20.18e\n",
-                   array[(long)(0.9 * nelements)]);
-            if(mode == 1)
-            {
-                fprintf(fp, "percentile90             %20.18e\n",
-                        array[(long)(0.90 * nelements)]);
-            }
-            create_variable_ID("vp90", array[(long)(0.9 * nelements)]);
+            long NBp = sizeof(imstats_percentiles) / sizeof(imstats_percentiles[0]);
+            double parray[NBp];
+            double pvalarray[NBp];
 
-            printf("95 percent      (->vp95)     %20.18e\n",
-                   array[(long)(0.95 * nelements)]);
-            if(mode == 1)
+            for(long k = 0; k < NBp; k++)
             {
-                fprintf(fp, "percentile95             %20.18e\n",
-                        array[(long)(0.95 * nelements)]);
+                parray[k] = imstats_percentiles[k].p;
             }
-            create_variable_ID("vp95", array[(long)(0.95 * nelements)]);
-
-            printf("99 percent      (->vp99)     %20.18e\n",
-                   array[(long)(0.99 * nelements)]);
-            if(mode == 1)
+            if(pixmask == NULL)
             {
-                fprintf(fp, "percentile99             %20.18e\n",
-                        array[(long)(0.99 * nelements)]);
+                info_statcache_percentiles(ID, parray, NBp, pvalarray);
             }
-            create_variable_ID("vp99", array[(long)(0.99 * nelements)]);
-
-            printf("99.5 percent    (->vp995)    %20.18e\n",
-                   array[(long)(0.995 * nelements)]);
-            if(mode == 1)
+            else
             {
-                fprintf(fp, "percentile995            %20.18e\n",
-                        array[(long)(0.995 * nelements)]);
+                info_robust_percentiles(ID, 0, nelements, pixmask, parray, NBp,
+                                        pvalarray);
             }
-            create_variable_ID("vp995", array[(long)(0.995 * nelements)]);
 
-            printf("99.8 percent    (->vp998)    %20.18e\n",
-                   array[(long)(0.998 * nelements)]);
-            if(mode == 1)
+            printf("\n");
+            printf("percentile values:\n");
+            for(long k = 0; k < NBp; k++)
             {
-                fprintf(fp, "percentile998            %20.18e\n",
-                        array[(long)(0.998 * nelements)]);
-            }
-            create_variable_ID("vp998", array[(long)(0.998 * nelements)]);
+                double pval = pvalarray[k];
 
-            printf("99.9 percent    (->vp999)    %20.18e\n",
-                   array[(long)(0.999 * nelements)]);
-            if(mode == 1)
-            {
-                fprintf(fp, "percentile999            %20.18e\n",
-                        array[(long)(0.999 * nelements)]);
+                sprintf(vname, "(->%s)", imstats_percentiles[k].vname);
+                printf("%-16s%-13s%20.18e\n", imstats_percentiles[k].label, vname, pval);
+                if(mode == 1)
+                {
+                    fprintf(fp, "percentile%-15s%20.18e\n",
+                            imstats_percentiles[k].vname + 2, pval);
+                }
+                create_variable_ID(imstats_percentiles[k].vname, pval);
             }
-            create_variable_ID("vp999", array[(long)(0.999 * nelements)]);
 
             printf("\n");
-            free(array);
+        }
+
+        if(pixmask != NULL)
+        {
+            info_pixmask_free(pixmask);
         }
     }
 
@@ -2399,6 +3291,39 @@ errno_t info_image_stats(
 
 
 
+// option "fileout"    : output to file imstat.info.txt
+// option "nthreads=N" : use N threads for reductions (default: all)
+//                       results do not depend on N
+//                       the previous thread setting is restored on return
+// option "mask=im"    : only use pixels where mask image im > 0.5
+// option "roi=xmin:xmax,ymin:ymax" : only use pixels in region of interest,
+//                       xmax and ymax excluded
+// mask and roi apply to the first 2D plane of the image
+errno_t info_image_stats(
+    const char *ID_name,
+    const char *options
+)
+{
+    const char *optstr = strstr(options, "nthreads=");
+    int         NBthreads_prev = info_pixstats_get_NBthreads_setting();
+    int         NBthreads = 0;
+    errno_t     ret;
+
+    if(optstr != NULL)
+    {
+        NBthreads = atoi(optstr + strlen("nthreads="));
+    }
+    info_pixstats_set_NBthreads(NBthreads);
+
+    ret = info_image_stats_run(ID_name, options);
+
+    info_pixstats_set_NBthreads(NBthreads_prev);
+
+    return ret;
+}
+
+
+
 // mask pixel values are 0 or 1
 // prints:
 //		index
@@ -2408,24 +3333,25 @@ errno_t info_image_stats(
 //		average
 //		tot power
 //		RMS
+// slice correlation versus lag is computed separately, see info_cubecorr()
+//
+// The mask is converted once to spans of selected pixels (pixmask.h), and
+// each slice is reduced over these spans only, accumulating in double.
+// Statistics are computed over finite pixels within the mask.
+// Slices are processed in parallel into a table written at the end, as
+// text or, if outfname ends with ".fits", as a FITS image. Returns -1 if
+// the table cannot be written.
 imageID info_cubestats(
     const char *ID_name,
     const char *IDmask_name,
     const char *outfname
 )
 {
-    imageID   ID, IDm;
-    float     min, max, tot, tot2;
-    uint64_t  xysize;
-    FILE     *fp;
-    int       init = 0;
-    float     mtot;
-    float     val;
-
-    int       COMPUTE_CORR = 1;
-    long      kcmax = 100;
-    double    valn1, valn2, v1, v2, valxp, vcorr;
-    long      k1, k2, kc;
+    imageID        ID, IDm, IDtable;
+    uint64_t       xysize;
+    uint32_t       zsize;
+    INFO_PIXMASK   pixmask;
+    char           tablename[STRINGMAXLEN_IMGNAME];
 
     ID = image_ID(ID_name);
     if(data.image[ID].md[0].naxis != 3)
@@ -2435,86 +3361,55 @@ imageID info_cubestats(
     }
 
     IDm = image_ID(IDmask_name);
+    if(IDm == -1)
+    {
+        PRINT_ERROR("mask image %s not found", IDmask_name);
+        return -1;
+    }
+    if((data.image[IDm].md[0].size[0] != data.image[ID].md[0].size[0])
+            || (data.image[IDm].md[0].size[1] != data.image[ID].md[0].size[1]))
+    {
+        PRINT_ERROR("mask image %s size does not match image %s",
+                    IDmask_name, ID_name);
+        return -1;
+    }
 
+    xysize = (uint64_t) data.image[ID].md[0].size[0] * data.image[ID].md[0].size[1];
+    zsize = data.image[ID].md[0].size[2];
 
-    xysize = data.image[ID].md[0].size[0] * data.image[ID].md[0].size[1];
+    if(info_pixmask_build_image(&pixmask, IDm) != RETURN_SUCCESS)
+    {
+        return -1;
+    }
 
-    mtot = 0.0;
-    for(unsigned long ii = 0; ii < xysize; ii++)
+    IDtable = info_cubestats_table_create(zsize, tablename);
+    if(IDtable == -1)
     {
-        mtot += data.image[IDm].array.F[ii];
+        info_pixmask_free(&pixmask);
+        return -1;
     }
 
+    int NBthreads = info_pixstats_get_NBthreads();
+    (void) NBthreads;
 
-    fp = fopen(outfname, "w");
-    for(unsigned long kk = 0; kk < data.image[ID].md[0].size[2]; kk++)
+#ifdef _OPENMP
+    #pragma omp parallel for schedule(dynamic, 64) num_threads(NBthreads)
+#endif
+    for(uint32_t kk = 0; kk < zsize; kk++)
     {
-        init = 0;
-        tot = 0.0;
-        tot2 = 0.0;
-        for(unsigned long ii = 0; ii < xysize; ii++)
-        {
-            if(data.image[IDm].array.F[ii] > 0.5)
-            {
-                val = data.image[ID].array.F[kk * xysize + ii];
-                if(init == 0)
-                {
-                    init = 1;
-                    min = val;
-                    max = val;
-                }
-                if(val > max)
-                {
-                    max = val;
-                }
-                if(val < min)
-                {
-                    min = val;
-                }
-                tot += val;
-                tot2 += val * val;
-            }
-        }
-        fprintf(fp, "%5ld  %20f  %20f  %20f  %20f  %20f  %20f\n", kk, min, max, tot,
-                tot / mtot, tot2, sqrt((tot2 - tot * tot / mtot) / mtot));
+        info_cubestats_frame(ID, kk * xysize, &pixmask,
+                             data.image[IDtable].array.D + (uint64_t) kk * INFO_CUBESTATS_NBSTAT);
     }
-    fclose(fp);
 
+    info_pixmask_free(&pixmask);
 
-    if(COMPUTE_CORR == 1)
+    errno_t ret = info_cubestats_table_write(IDtable, outfname);
+    delete_image_ID(tablename);
+    if(ret != RETURN_SUCCESS)
     {
-        fp = fopen("corr.txt", "w");
-        for(kc = 1; kc < kcmax; kc++)
-        {
-            vcorr = 0.0;
-            for(unsigned long kk = 0;
-                    kk < (unsigned long)(data.image[ID].md[0].size[2] - kc); kk++)
-            {
-                k1 = kk;
-                k2 = kk + kc;
-                valn1 = 0.0;
-                valn2 = 0.0;
-                valxp = 0.0;
-                for(unsigned long ii = 0; ii < xysize; ii++)
-                {
-                    if(data.image[IDm].array.F[ii] > 0.5)
-                    {
-                        v1 = data.image[ID].array.F[k1 * xysize + ii];
-                        v2 = data.image[ID].array.F[k2 * xysize + ii];
-                        valn1 += v1 * v1;
-                        valn2 += v2 * v2;
-                        valxp += v1 * v2;
-                    }
-                }
-                vcorr += valxp / sqrt(valn1 * valn2);
-            }
-            vcorr /= data.image[ID].md[0].size[2] - kc;
-            fprintf(fp, "%3ld   %g\n", kc, vcorr);
-        }
-        fclose(fp);
+        return -1;
     }
 
-
     return(ID);
 }
 
@@ -2522,38 +3417,26 @@ imageID info_cubestats(
 
 double img_min(const char *ID_name)
 {
-    int ID;
-    double min;
+    imageID ID;
+    INFO_PIXSTATS pixstats;
 
     ID = image_ID(ID_name);
+    info_statcache_pixstats(ID, &pixstats);
 
-    min = data.image[ID].array.F[0];
-    for(unsigned long ii = 0; ii < data.image[ID].md[0].nelement; ii++)
-        if(min > data.image[ID].array.F[ii])
-        {
-            min = data.image[ID].array.F[ii];
-        }
-
-    return(min);
+    return(pixstats.min);
 }
 
 
 
 double img_max(const char *ID_name)
 {
-    int ID;
-    double max;
+    imageID ID;
+    INFO_PIXSTATS pixstats;
 
     ID = image_ID(ID_name);
+    info_statcache_pixstats(ID, &pixstats);
 
-    max = data.image[ID].array.F[0];
-    for(unsigned long ii = 0; ii < data.image[ID].md[0].nelement; ii++)
-        if(max < data.image[ID].array.F[ii])
-        {
-            max = data.image[ID].array.F[ii];
-        }
-
-    return(max);
+    return(pixstats.max);
 }
 
 
@@ -2844,7 +3727,6 @@ double background_photon_noise(
     imageID        ID;
     uint32_t       naxes[2];
     double         value1, value2, value3, value;
-    double        *array;
     uint64_t       nelements;
 
     ID = image_ID(ID_name);
@@ -2852,15 +3734,6 @@ double background_photon_noise(
     naxes[1] = data.image[ID].md[0].size[1];
     nelements = naxes[0] * naxes[1];
 
-    array = (double *) malloc(naxes[1] * naxes[0] * sizeof(double));
-    for(unsigned long jj = 0; jj < naxes[1]; jj++)
-        for(unsigned long ii = 0; ii < naxes[0]; ii++)
-        {
-            array[jj * naxes[0] + ii] = data.image[ID].array.F[jj * naxes[0] + ii];
-        }
-
-    quick_sort_double(array, nelements);
-
     /* uses the repartition function F of the normal distribution law */
     /* F(0) = 0.5 */
     /* F(-0.1 * sig) = 0.460172162723 */
@@ -2877,28 +3750,29 @@ double background_photon_noise(
     /* F(-1.2 * sig) = 0.115069670222 */
     /* F(-1.3 * sig) = 0.0968004845855 */
 
+    /* F values for -1.3, -0.9, -0.6 and -0.3 sigma */
+    double parray[4] = { 0.0968004845855, 0.184060125347, 0.27425311775, 0.382088577811 };
+    double pvalarray[4];
+
+    info_robust_percentiles(ID, 0, nelements, NULL, parray, 4, pvalarray);
+
     /* calculation using F(-0.9*sig) and F(-1.3*sig) */
-    value1 = array[(long)(0.184060125347 * naxes[1] * naxes[0])] - array[(long)(
-                 0.0968004845855 * naxes[1] * naxes[0])];
+    value1 = pvalarray[1] - pvalarray[0];
     value1 /= (1.3 - 0.9);
     printf("(-1.3 -0.9) %f\n", value1);
 
     /* calculation using F(-0.6*sig) and F(-1.3*sig) */
-    value2 = array[(long)(0.27425311775 * naxes[1] * naxes[0])] - array[(long)(
-                 0.0968004845855 * naxes[1] * naxes[0])];
+    value2 = pvalarray[2] - pvalarray[0];
     value2 /= (1.3 - 0.6);
     printf("(-1.3 -0.6) %f\n", value2);
 
     /* calculation using F(-0.3*sig) and F(-1.3*sig) */
-    value3 = array[(long)(0.382088577811 * naxes[1] * naxes[0])] - array[(long)(
-                 0.0968004845855 * naxes[1] * naxes[0])];
+    value3 = pvalarray[3] - pvalarray[0];
     value3 /= (1.3 - 0.3);
     printf("(-1.3 -0.3) %f\n", value3);
 
     value = value3;
 
-    free(array);
-
     return(value);
 }
 
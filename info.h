@@ -37,8 +37,25 @@ double img_percentile(
     double      p
 );
 
+// default fraction of brightest pixels written by img_histoc
+#define INFO_HISTOC_FRACTION 0.01
 
-int img_histoc(const char *ID_name, const char *fname);
+errno_t img_histoc_float(
+    const char *ID_name,
+    const char *fname,
+    double      frac
+);
+
+errno_t img_histoc_double(
+    const char *ID_name,
+    const char *fname,
+    double      frac
+);
+
+errno_t img_histoc(
+    const char *ID_name,
+    const char *fname
+);
 
 errno_t make_histogram(
     const char *ID_name,
@@ -0,0 +1,384 @@
+/**
+ * @file    lucky.c
+ * @brief   Lucky imaging : slice sharpness scores and best slice selection
+ *
+ * Each slice of a cube is scored by a sharpness metric, computed over
+ * the pixels of a mask in a single pass (pixstats.h), slices in parallel.
+ * The k best slices are then found with a min-heap of size k holding the
+ * best slices seen so far, in N log k instead of sorting all scores.
+ *
+ * Selected slices can be copied to a new cube, best first, reading only
+ * these slices again.
+ *
+ */
+
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+
+#include "CommandLineInterface/CLIcore.h"
+#include "COREMOD_memory/COREMOD_memory.h"
+
+#include "info/pixstats.h"
+#include "info/pixmask.h"
+#include "info/lucky.h"
+
+
+
+
+// slice a ranks better than slice b : higher score, lower index on ties
+static inline int lucky_better(
+    const double *score,
+    long          a,
+    long          b
+)
+{
+    return (score[a] > score[b]) || ((score[a] == score[b]) && (a < b));
+}
+
+
+
+
+// restore min-heap order (worst slice at root) below position i
+static void lucky_heap_down(
+    const double *score,
+    long         *heap,
+    long          n,
+    long          i
+)
+{
+    for(;;)
+    {
+        long worst = i;
+        long l = 2 * i + 1;
+        long r = l + 1;
+
+        if((l < n) && lucky_better(score, heap[worst], heap[l]))
+        {
+            worst = l;
+        }
+        if((r < n) && lucky_better(score, heap[worst], heap[r]))
+        {
+            worst = r;
+        }
+        if(worst == i)
+        {
+            return;
+        }
+
+        long tmp = heap[i];
+        heap[i] = heap[worst];
+        heap[worst] = tmp;
+        i = worst;
+    }
+}
+
+
+
+
+/**
+ * @brief Sharpness score of each slice of 3D image ID
+ *
+ * Scores are computed over finite pixels within pixmask, or all pixels if
+ * pixmask is NULL. score receives one value per slice, NaN for slices
+ * without finite pixel.
+ */
+errno_t info_lucky_scores(
+    imageID             ID,
+    const INFO_PIXMASK *pixmask,
+    int                 metric,
+    double             *score
+)
+{
+    uint64_t xysize;
+    long     zsize;
+
+    if(data.image[ID].md[0].naxis != 3)
+    {
+        PRINT_ERROR("3D image required");
+        return RETURN_FAILURE;
+    }
+    if(info_pixstats_datatype_supported(data.image[ID].md[0].datatype) == 0)
+    {
+        PRINT_ERROR("datatype %d not supported",
+                    (int) data.image[ID].md[0].datatype);
+        return RETURN_FAILURE;
+    }
+    if((metric < INFO_LUCKY_PEAK) || (metric > INFO_LUCKY_SHARPNESS))
+    {
+        PRINT_ERROR("unknown metric %d", metric);
+        return RETURN_FAILURE;
+    }
+
+    xysize = (uint64_t) data.image[ID].md[0].size[0] * data.image[ID].md[0].size[1];
+    zsize = data.image[ID].md[0].size[2];
+
+    int NBthreads = info_pixstats_get_NBthreads();
+    (void) NBthreads;
+
+#ifdef _OPENMP
+    #pragma omp parallel for schedule(dynamic, 16) num_threads(NBthreads)
+#endif
+    for(long kk = 0; kk < zsize; kk++)
+    {
+        INFO_PIXSTATS pixstats;
+
+        score[kk] = NAN;
+        if(info_pixstats_compute(ID, kk * xysize, xysize, pixmask,
+                                 &pixstats) != RETURN_SUCCESS)
+        {
+            continue;
+        }
+        if(pixstats.nelement == pixstats.NBnan + pixstats.NBinf)
+        {
+            continue;
+        }
+
+        switch(metric)
+        {
+            case INFO_LUCKY_PEAK:
+                score[kk] = pixstats.max;
+                break;
+
+            case INFO_LUCKY_POWER:
+                score[kk] = pixstats.ssquare;
+                break;
+
+            case INFO_LUCKY_SHARPNESS:
+                score[kk] = pixstats.ssquare / (pixstats.total * pixstats.total);
+                break;
+        }
+    }
+
+    return RETURN_SUCCESS;
+}
+
+
+
+
+/**
+ * @brief Indices of the k highest scores, best first
+ *
+ * NaN scores are never selected. Ties are broken by lower index.
+ * index must hold k values. Returns the number of indices written,
+ * k or fewer if less than k scores are not NaN.
+ */
+long info_lucky_topk(
+    const double *score,
+    long          n,
+    long          k,
+    long         *index
+)
+{
+    long NBheap = 0;
+
+    if(k <= 0)
+    {
+        return 0;
+    }
+
+    // index is used as heap, worst of the kept slices at root
+    for(long i = 0; i < n; i++)
+    {
+        if(isnan(score[i]))
+        {
+            continue;
+        }
+        if(NBheap < k)
+        {
+            long j = NBheap++;
+            index[j] = i;
+            while(j > 0)
+            {
+                long parent = (j - 1) / 2;
+                if(lucky_better(score, index[j], index[parent]))
+                {
+                    break;
+                }
+                long tmp = index[j];
+                index[j] = index[parent];
+                index[parent] = tmp;
+                j = parent;
+            }
+        }
+        else if(lucky_better(score, i, index[0]))
+        {
+            index[0] = i;
+            lucky_heap_down(score, index, NBheap, 0);
+        }
+    }
+
+    // heap sort, worst moved to the end first
+    for(long j = NBheap - 1; j > 0; j--)
+    {
+        long tmp = index[0];
+        index[0] = index[j];
+        index[j] = tmp;
+        lucky_heap_down(score, index, j, 0);
+    }
+
+    return NBheap;
+}
+
+
+
+
+/**
+ * @brief Rank slices of 3D image by sharpness, keep the k best
+ *
+ * Mask pixels > 0.5 are used ; IDmask_name can be NULL or empty for no
+ * mask. If outfname is not NULL or empty, writes one line per selected
+ * slice : rank, slice index, score. If IDout_name is not NULL or empty,
+ * selected slices are copied to new cube IDout_name, best first.
+ *
+ * Returns output cube ID, or ID of input image if no cube is written,
+ * -1 on error, including when the rank file or output cube cannot be
+ * created.
+ */
+imageID info_image_lucky(
+    const char *ID_name,
+    const char *IDmask_name,
+    int         metric,
+    long        k,
+    const char *outfname,
+    const char *IDout_name
+)
+{
+    imageID      ID;
+    imageID      IDout;
+    INFO_PIXMASK pixmask;
+    INFO_PIXMASK *pmask = NULL;
+    uint64_t     xysize;
+    long         zsize;
+
+    ID = image_ID(ID_name);
+    if(ID == -1)
+    {
+        PRINT_ERROR("image %s not found", ID_name);
+        return -1;
+    }
+    if(data.image[ID].md[0].naxis != 3)
+    {
+        PRINT_ERROR("image %s : 3D image required", ID_name);
+        return -1;
+    }
+    xysize = (uint64_t) data.image[ID].md[0].size[0] * data.image[ID].md[0].size[1];
+    zsize = data.image[ID].md[0].size[2];
+    if(k > zsize)
+    {
+        k = zsize;
+    }
+    if(k < 1)
+    {
+        PRINT_ERROR("number of slices to select must be > 0");
+        return -1;
+    }
+
+    if((IDmask_name != NULL) && (IDmask_name[0] != '\0'))
+    {
+        imageID IDmask = image_ID(IDmask_name);
+        if(IDmask == -1)
+        {
+            PRINT_ERROR("mask image %s not found", IDmask_name);
+            return -1;
+        }
+        if((data.image[IDmask].md[0].size[0] != data.image[ID].md[0].size[0])
+                || (data.image[IDmask].md[0].size[1] != data.image[ID].md[0].size[1]))
+        {
+            PRINT_ERROR("mask image %s size does not match image %s",
+                        IDmask_name, ID_name);
+            return -1;
+        }
+        if(info_pixmask_build_image(&pixmask, IDmask) != RETURN_SUCCESS)
+        {
+            return -1;
+        }
+        pmask = &pixmask;
+    }
+
+    double *score = (double *) malloc(sizeof(double) * zsize);
+    long   *index = (long *) malloc(sizeof(long) * k);
+    if((score == NULL) || (index == NULL))
+    {
+        PRINT_ERROR("malloc error");
+        free(score);
+        free(index);
+        if(pmask != NULL)
+        {
+            info_pixmask_free(pmask);
+        }
+        return -1;
+    }
+
+    errno_t ret = info_lucky_scores(ID, pmask, metric, score);
+    if(pmask != NULL)
+    {
+        info_pixmask_free(pmask);
+    }
+    if(ret != RETURN_SUCCESS)
+    {
+        free(score);
+        free(index);
+        return -1;
+    }
+
+    long NBsel = info_lucky_topk(score, zsize, k, index);
+
+    if((outfname != NULL) && (outfname[0] != '\0'))
+    {
+        FILE *fp = fopen(outfname, "w");
+        if(fp == NULL)
+        {
+            PRINT_ERROR("cannot create file %s", outfname);
+            free(score);
+            free(index);
+            return -1;
+        }
+        for(long i = 0; i < NBsel; i++)
+        {
+            fprintf(fp, "%5ld  %5ld  %20g\n", i, index[i], score[index[i]]);
+        }
+        fclose(fp);
+    }
+
+    IDout = ID;
+    if((IDout_name != NULL) && (IDout_name[0] != '\0') && (NBsel > 0))
+    {
+        uint32_t outsize[3] = { data.image[ID].md[0].size[0],
+                                data.image[ID].md[0].size[1],
+                                (uint32_t) NBsel
+                              };
+        uint8_t  datatype = data.image[ID].md[0].datatype;
+
+        IDout = create_image_ID(IDout_name, 3, outsize, datatype, 0, 0);
+        if(IDout == -1)
+        {
+            PRINT_ERROR("cannot create image %s", IDout_name);
+            free(score);
+            free(index);
+            return -1;
+        }
+        for(long i = 0; i < NBsel; i++)
+        {
+            switch(datatype)
+            {
+#define INFO_LUCKY_CASE_COPY(TS, PIXTYPE, DTYPE, ...)                               \
+                case DTYPE:                                                         \
+                    memcpy(data.image[IDout].array.TS + (uint64_t) i * xysize,      \
+                           data.image[ID].array.TS + (uint64_t) index[i] * xysize,  \
+                           sizeof(PIXTYPE) * xysize);                               \
+                    break;
+                    INFO_PIXSTATS_TYPELIST(INFO_LUCKY_CASE_COPY)
+#undef INFO_LUCKY_CASE_COPY
+            }
+        }
+    }
+
+    free(score);
+    free(index);
+
+    return IDout;
+}
@@ -0,0 +1,44 @@
+/**
+ * @file    lucky.h
+ * @brief   Lucky imaging : slice sharpness scores and best slice selection
+ *
+ */
+
+#if !defined(INFO_LUCKY_H)
+#define INFO_LUCKY_H
+
+#include "info/pixmask.h"
+
+
+// sharpness metrics
+#define INFO_LUCKY_PEAK       0  // maximum pixel value
+#define INFO_LUCKY_POWER      1  // sum of squared pixel values
+#define INFO_LUCKY_SHARPNESS  2  // sum of squares / square of sum
+
+
+
+errno_t info_lucky_scores(
+    imageID             ID,
+    const INFO_PIXMASK *pixmask,
+    int                 metric,
+    double             *score
+);
+
+long info_lucky_topk(
+    const double *score,
+    long          n,
+    long          k,
+    long         *index
+);
+
+imageID info_image_lucky(
+    const char *ID_name,
+    const char *IDmask_name,
+    int         metric,
+    long        k,
+    const char *outfname,
+    const char *IDout_name
+);
+
+
+#endif
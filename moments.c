@@ -0,0 +1,280 @@
+/**
+ * @file    moments.c
+ * @brief   Image moments : total, centroid, second moments
+ *
+ * Total, first and second moments are accumulated in a single row-major
+ * pass. Each row span is reduced to three sums (v, v.x, v.x^2) in a
+ * vectorized loop, which are then weighted by y and y^2 to form the 2D
+ * moments. Unmasked images are processed as a mask of full rows.
+ * Coordinates are taken relative to the image center to limit
+ * cancellation when forming central moments.
+ *
+ * Spans are grouped in fixed-size chunks processed in parallel, and chunk
+ * sums are combined pairwise in a fixed order (see pixstats.c).
+ *
+ */
+
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <math.h>
+
+#include "CommandLineInterface/CLIcore.h"
+#include "COREMOD_memory/COREMOD_memory.h"
+
+#include "info/pixstats.h"
+#include "info/pixmask.h"
+#include "info/moments.h"
+
+
+
+
+typedef struct
+{
+    double    s0;
+    double    sx;
+    double    sy;
+    double    sxx;
+    double    syy;
+    double    sxy;
+    uint64_t  NBbad;   // non-finite pixels
+} MOMENTSUMS;
+
+
+
+
+/* ================================================================== */
+/*            GENERIC KERNEL                                          */
+/* ================================================================== */
+
+// Non-finite pixels propagate to the span sums ; such spans are scanned
+// again with a branch-free mask (see pixstats.c)
+//
+// x is the coordinate of the first pixel, y the row coordinate, both
+// relative to the image center. Sums are added to msums.
+
+#define INFO_MOMENTS_KERNEL(TS, PIXTYPE, DTYPE, SUMTYPE, SQTYPE,              \
+                            PIXMIN, PIXMAX, ISFLOAT)                          \
+                                                                              \
+static void moments_span_##TS(                                                \
+    const PIXTYPE *restrict row,                                              \
+    uint64_t                nbpix,                                            \
+    double                  xstart,                                           \
+    double                  y,                                                \
+    MOMENTSUMS             *msums                                             \
+)                                                                             \
+{                                                                             \
+    SUMTYPE r0 = 0;                                                           \
+    double  rx = 0.0;                                                         \
+    double  rxx = 0.0;                                                        \
+    INFO_PRAGMA_SIMD(reduction(+:r0,rx,rxx))                                  \
+    for(uint64_t ii = 0; ii < nbpix; ii++)                                    \
+    {                                                                         \
+        double x = xstart + (double) ii;                                      \
+        double v = (double) row[ii];                                          \
+        r0 += (SUMTYPE) row[ii];                                              \
+        rx += v * x;                                                          \
+        rxx += v * x * x;                                                     \
+    }                                                                         \
+                                                                              \
+    if(ISFLOAT && !isfinite((double) r0 + rx + rxx))                          \
+    {                                                                         \
+        uint64_t rbad = 0;                                                    \
+        r0 = 0;                                                               \
+        rx = 0.0;                                                             \
+        rxx = 0.0;                                                            \
+        INFO_PRAGMA_SIMD(reduction(+:r0,rx,rxx,rbad))                         \
+        for(uint64_t ii = 0; ii < nbpix; ii++)                                \
+        {                                                                     \
+            int     ok = isfinite((double) row[ii]);                          \
+            PIXTYPE vok = ok ? row[ii] : 0;                                   \
+            double  x = xstart + (double) ii;                                 \
+            r0 += (SUMTYPE) vok;                                              \
+            rx += (double) vok * x;                                           \
+            rxx += (double) vok * x * x;                                      \
+            rbad += !ok;                                                      \
+        }                                                                     \
+        msums->NBbad += rbad;                                                 \
+    }                                                                         \
+                                                                              \
+    msums->s0 += (double) r0;                                                 \
+    msums->sx += rx;                                                          \
+    msums->sxx += rxx;                                                        \
+    msums->sy += y * (double) r0;                                             \
+    msums->syy += y * y * (double) r0;                                        \
+    msums->sxy += y * rx;                                                     \
+}
+
+
+INFO_PIXSTATS_TYPELIST(INFO_MOMENTS_KERNEL)
+
+
+
+
+/**
+ * @brief Moments of the 2D plane starting at pixel offset
+ *
+ * offset is 0 for a 2D image, or kk*xsize*ysize for slice kk of a cube.
+ * If pixmask is not NULL, only pixels selected by the mask are used ; the
+ * mask must be row-aligned on the image plane (see pixmask.h).
+ * NaN and Inf pixels are skipped.
+ */
+errno_t info_moments_compute(
+    imageID             ID,
+    uint64_t            offset,
+    const INFO_PIXMASK *pixmask,
+    INFO_MOMENTS       *moments
+)
+{
+    uint32_t     xsize = data.image[ID].md[0].size[0];
+    uint32_t     ysize = 1;
+    INFO_PIXMASK planemask;
+
+    if(data.image[ID].md[0].naxis > 1)
+    {
+        ysize = data.image[ID].md[0].size[1];
+    }
+
+    if(info_pixstats_datatype_supported(data.image[ID].md[0].datatype) == 0)
+    {
+        PRINT_ERROR("datatype %d not supported",
+                    (int) data.image[ID].md[0].datatype);
+        return RETURN_FAILURE;
+    }
+
+    if(pixmask == NULL)
+    {
+        if(info_pixmask_build_roi(&planemask, xsize, ysize, 0, xsize, 0,
+                                  ysize) != RETURN_SUCCESS)
+        {
+            return RETURN_FAILURE;
+        }
+        pixmask = &planemask;
+    }
+    else if((pixmask->xsize != xsize) || (pixmask->ysize != ysize))
+    {
+        PRINT_ERROR("mask size %u x %u does not match image size %u x %u",
+                    pixmask->xsize, pixmask->ysize, xsize, ysize);
+        return RETURN_FAILURE;
+    }
+
+    double x0 = 0.5 * (xsize - 1);
+    double y0 = 0.5 * (ysize - 1);
+
+    long NBchunk = pixmask->NBchunk;
+    MOMENTSUMS *partial = (MOMENTSUMS *) calloc(NBchunk + 1, sizeof(MOMENTSUMS));
+    if(partial == NULL)
+    {
+        PRINT_ERROR("calloc error");
+        if(pixmask == &planemask)
+        {
+            info_pixmask_free(&planemask);
+        }
+        return RETURN_FAILURE;
+    }
+
+    int NBthreads = info_pixstats_get_NBthreads();
+    (void) NBthreads;
+
+#ifdef _OPENMP
+    #pragma omp parallel for schedule(static) num_threads(NBthreads) if(NBchunk > 1)
+#endif
+    for(long chunk = 0; chunk < NBchunk; chunk++)
+    {
+        for(long spanindex = pixmask->chunkspan[chunk];
+                spanindex < pixmask->chunkspan[chunk + 1]; spanindex++)
+        {
+            uint64_t start = pixmask->span[spanindex].start;
+            uint64_t length = pixmask->span[spanindex].length;
+            double   xstart = (double)(start % xsize) - x0;
+            double   y = (double)(start / xsize) - y0;
+
+            switch(data.image[ID].md[0].datatype)
+            {
+#define INFO_MOMENTS_CASE(TS, PIXTYPE, DTYPE, ...)                          \
+                case DTYPE:                                                 \
+                    moments_span_##TS(data.image[ID].array.TS + offset +    \
+                                      start, length, xstart, y,             \
+                                      &partial[chunk]);                     \
+                    break;
+                    INFO_PIXSTATS_TYPELIST(INFO_MOMENTS_CASE)
+#undef INFO_MOMENTS_CASE
+            }
+        }
+    }
+
+    // pairwise combination, fixed order
+    for(long stride = 1; stride < NBchunk; stride *= 2)
+    {
+        for(long chunk = 0; chunk + stride < NBchunk; chunk += 2 * stride)
+        {
+            MOMENTSUMS *a = &partial[chunk];
+            MOMENTSUMS *b = &partial[chunk + stride];
+
+            a->s0 += b->s0;
+            a->sx += b->sx;
+            a->sy += b->sy;
+            a->sxx += b->sxx;
+            a->syy += b->syy;
+            a->sxy += b->sxy;
+            a->NBbad += b->NBbad;
+        }
+    }
+    MOMENTSUMS ms = partial[0];
+    uint64_t NBpix = pixmask->NBpix;
+    free(partial);
+    if(pixmask == &planemask)
+    {
+        info_pixmask_free(&planemask);
+    }
+
+
+    double xc = ms.sx / ms.s0;
+    double yc = ms.sy / ms.s0;
+
+    moments->NBpix = NBpix - ms.NBbad;
+    moments->total = ms.s0;
+    moments->xc = x0 + xc;
+    moments->yc = y0 + yc;
+    moments->mxx = ms.sxx / ms.s0 - xc * xc;
+    moments->myy = ms.syy / ms.s0 - yc * yc;
+    moments->mxy = ms.sxy / ms.s0 - xc * yc;
+
+    double mhalfdiff = 0.5 * (moments->mxx - moments->myy);
+    double mmean = 0.5 * (moments->mxx + moments->myy);
+    double dl = sqrt(mhalfdiff * mhalfdiff + moments->mxy * moments->mxy);
+
+    moments->lmajor = mmean + dl;
+    moments->lminor = mmean - dl;
+    moments->angle = 0.5 * atan2(2.0 * moments->mxy, moments->mxx - moments->myy);
+    moments->ellipticity = 0.0;
+    if(moments->lmajor > 0.0)
+    {
+        moments->ellipticity = 1.0 - sqrt(moments->lminor / moments->lmajor);
+    }
+    // FWHM = 2 sqrt(2 ln 2) sigma for a gaussian
+    moments->fwhm = 2.0 * sqrt(2.0 * log(2.0)) * sqrt(mmean);
+
+    return RETURN_SUCCESS;
+}
+
+
+
+
+errno_t info_image_moments(
+    const char   *ID_name,
+    INFO_MOMENTS *moments
+)
+{
+    imageID ID;
+
+    ID = image_ID(ID_name);
+    if(ID == -1)
+    {
+        PRINT_ERROR("image %s not found", ID_name);
+        return RETURN_FAILURE;
+    }
+
+    return info_moments_compute(ID, 0, NULL, moments);
+}
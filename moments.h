@@ -0,0 +1,42 @@
+/**
+ * @file    moments.h
+ * @brief   Image moments : total, centroid, second moments
+ *
+ */
+
+#if !defined(INFO_MOMENTS_H)
+#define INFO_MOMENTS_H
+
+
+typedef struct
+{
+    uint64_t  NBpix;        // number of finite pixels
+    double    total;        // sum of pixel values
+    double    xc;           // centroid [pix]
+    double    yc;
+    double    mxx;          // second central moments (covariance) [pix^2]
+    double    myy;
+    double    mxy;
+    double    lmajor;       // covariance eigenvalues [pix^2]
+    double    lminor;
+    double    angle;        // major axis angle from x axis [rad]
+    double    ellipticity;  // 1 - sqrt(lminor/lmajor)
+    double    fwhm;         // gaussian-equivalent FWHM [pix]
+} INFO_MOMENTS;
+
+
+
+errno_t info_moments_compute(
+    imageID             ID,
+    uint64_t            offset,
+    const INFO_PIXMASK *pixmask,
+    INFO_MOMENTS       *moments
+);
+
+errno_t info_image_moments(
+    const char   *ID_name,
+    INFO_MOMENTS *moments
+);
+
+
+#endif
@@ -0,0 +1,766 @@
+/**
+ * @file    outlier.c
+ * @brief   Outlier and cosmic-ray detection across cube slices
+ *
+ * Pixel values deviating from their own temporal statistics are flagged :
+ * value v of a pixel in a slice is an outlier if
+ * |v - median| > nsigma x sigma, median and sigma = IQR / 1.349 being
+ * computed over all slices for this pixel, finite values only. A pixel
+ * with zero IQR flags any value different from its median.
+ *
+ * Quartiles and median are estimated in a single streaming pass with the
+ * extended P2 algorithm (Jain & Chlamtac, Raatikainen) : 9 markers per
+ * pixel track the 0.125 ... 0.875 quantiles and the extremes, adjusted by
+ * piecewise-parabolic interpolation as values arrive. Memory is fixed per
+ * pixel, whatever the number of slices. Heights are kept in double, so
+ * that quartiles of images with a large offset are not quantized. Values are exact for pixels with
+ * fewer than 9 finite values.
+ *
+ * Slices are streamed in blocks : the whole cube for an image in memory,
+ * or blocks read from file for FITS cubes larger than memory (see
+ * fitsblock.h), the file being read twice. Pixels are updated in parallel
+ * by chunks, each chunk state staying in cache while slices stream
+ * through.
+ *
+ * Flags are written bit-packed, one bit per pixel : bit (x % 8) of byte
+ * x / 8 of each row, in a uint8 cube of (xsize+7)/8 x ysize x zsize.
+ * For FITS cubes, the flag cube can be written to a FITS file block by
+ * block instead, so that memory use does not grow with the number of
+ * slices.
+ *
+ */
+
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <fitsio.h>
+
+#include "CommandLineInterface/CLIcore.h"
+#include "COREMOD_memory/COREMOD_memory.h"
+
+#include "info/pixstats.h"
+#include "info/fitsblock.h"
+#include "info/outlier.h"
+
+
+
+
+// pixels per chunk for marker update
+#define INFO_OUTLIER_CHUNK 4096
+
+
+// quantile tracked by each marker
+static const double outlier_p[INFO_OUTLIER_NBMARKER] =
+{
+    0.0, 0.125, 0.25, 0.375, 0.5, 0.625, 0.75, 0.875, 1.0
+};
+
+
+
+// nbpix contiguous pixels to double row
+#define INFO_OUTLIER_GATHER(TS, PIXTYPE, DTYPE, SUMTYPE, SQTYPE,              \
+                            PIXMIN, PIXMAX, ISFLOAT)                          \
+static void outlier_gather_##TS(                                              \
+    const PIXTYPE *restrict array,                                            \
+    long                    nbpix,                                            \
+    double        *restrict row                                               \
+)                                                                             \
+{                                                                             \
+    for(long j = 0; j < nbpix; j++)                                           \
+    {                                                                         \
+        row[j] = (double) array[j];                                           \
+    }                                                                         \
+}
+
+INFO_PIXSTATS_TYPELIST(INFO_OUTLIER_GATHER)
+
+
+
+static void outlier_gather(
+    imageID   ID,
+    uint64_t  offset,
+    long      nbpix,
+    double   *row
+)
+{
+    switch(data.image[ID].md[0].datatype)
+    {
+#define INFO_OUTLIER_CASE_GATHER(TS, PIXTYPE, DTYPE, ...)                           \
+        case DTYPE:                                                                 \
+            outlier_gather_##TS(data.image[ID].array.TS + offset, nbpix, row);      \
+            break;
+            INFO_PIXSTATS_TYPELIST(INFO_OUTLIER_CASE_GATHER)
+#undef INFO_OUTLIER_CASE_GATHER
+    }
+}
+
+
+
+
+// add finite value x to markers of one pixel
+// pos[NBMARKER-1] is the number of values ; while lower than NBMARKER,
+// heights hold the values received so far, sorted
+static void outlier_p2_add(
+    double  *height,
+    int32_t *pos,
+    double   x
+)
+{
+    const int M = INFO_OUTLIER_NBMARKER;
+    int32_t   cnt = pos[M - 1];
+
+    if(cnt < M)
+    {
+        int i = cnt;
+        while((i > 0) && (height[i - 1] > x))
+        {
+            height[i] = height[i - 1];
+            i--;
+        }
+        height[i] = x;
+        cnt++;
+        pos[M - 1] = cnt;
+        if(cnt == M)
+        {
+            for(int m = 0; m < M; m++)
+            {
+                pos[m] = m + 1;
+            }
+        }
+        return;
+    }
+
+    // cell k : height[k] <= x < height[k+1]
+    int k;
+    if(x < height[0])
+    {
+        height[0] = x;
+        k = 0;
+    }
+    else if(x >= height[M - 1])
+    {
+        height[M - 1] = x;
+        k = M - 2;
+    }
+    else
+    {
+        k = 0;
+        while(x >= height[k + 1])
+        {
+            k++;
+        }
+    }
+    for(int m = k + 1; m < M; m++)
+    {
+        pos[m]++;
+    }
+
+    double total = (double) pos[M - 1];
+    for(int m = 1; m < M - 1; m++)
+    {
+        double d = 1.0 + (total - 1.0) * outlier_p[m] - pos[m];
+
+        if(((d >= 1.0) && (pos[m + 1] - pos[m] > 1))
+                || ((d <= -1.0) && (pos[m - 1] - pos[m] < -1)))
+        {
+            int    ds = (d > 0.0) ? 1 : -1;
+            double hm = height[m];
+            double hp = height[m + 1];
+            double hn = height[m - 1];
+            double np = pos[m + 1] - pos[m];
+            double nn = pos[m] - pos[m - 1];
+
+            // piecewise-parabolic prediction
+            double h = hm + ds / (np + nn) *
+                       ((nn + ds) * (hp - hm) / np + (np - ds) * (hm - hn) / nn);
+            if((h <= hn) || (h >= hp))
+            {
+                // linear
+                double hd = (ds > 0) ? hp : hn;
+                double nd = (ds > 0) ? np : -nn;
+                h = hm + ds * (hd - hm) / nd;
+            }
+            height[m] = h;
+            pos[m] += ds;
+        }
+    }
+}
+
+
+
+
+/**
+ * @brief Initialize per-pixel temporal statistics for N pixels
+ */
+errno_t info_outlier_init(
+    INFO_OUTLIER *outlier,
+    uint64_t      N
+)
+{
+    outlier->N = N;
+    outlier->height = (double *) calloc(N * INFO_OUTLIER_NBMARKER + 1, sizeof(double));
+    outlier->pos = (int32_t *) calloc(N * INFO_OUTLIER_NBMARKER + 1, sizeof(int32_t));
+    outlier->median = NULL;
+    outlier->sigma = NULL;
+
+    if((outlier->height == NULL) || (outlier->pos == NULL))
+    {
+        PRINT_ERROR("malloc error");
+        info_outlier_free(outlier);
+        return RETURN_FAILURE;
+    }
+
+    return RETURN_SUCCESS;
+}
+
+
+
+
+/**
+ * @brief Add the first NBslice slices of image ID to statistics
+ *
+ * Slices are the first N pixels of each consecutive N-pixel plane.
+ * NaN and Inf values are ignored.
+ */
+errno_t info_outlier_update(
+    INFO_OUTLIER *outlier,
+    imageID       ID,
+    long          NBslice
+)
+{
+    uint64_t N = outlier->N;
+    long     NBchunk = (N + INFO_OUTLIER_CHUNK - 1) / INFO_OUTLIER_CHUNK;
+
+    if(info_pixstats_datatype_supported(data.image[ID].md[0].datatype) == 0)
+    {
+        PRINT_ERROR("datatype %d not supported",
+                    (int) data.image[ID].md[0].datatype);
+        return RETURN_FAILURE;
+    }
+
+    int NBthreads = info_pixstats_get_NBthreads();
+    (void) NBthreads;
+    int allocerr = 0;
+
+#ifdef _OPENMP
+    #pragma omp parallel num_threads(NBthreads) if(NBchunk > 1)
+#endif
+    {
+        double *row = (double *) malloc(sizeof(double) * INFO_OUTLIER_CHUNK);
+        if(row == NULL)
+        {
+            PRINT_ERROR("malloc error");
+#ifdef _OPENMP
+            #pragma omp atomic write
+#endif
+            allocerr = 1;
+        }
+
+#ifdef _OPENMP
+        #pragma omp for schedule(dynamic)
+#endif
+        for(long chunk = 0; chunk < NBchunk; chunk++)
+        {
+            int skip;
+#ifdef _OPENMP
+            #pragma omp atomic read
+#endif
+            skip = allocerr;
+            if(skip)
+            {
+                continue;
+            }
+
+            uint64_t j0 = (uint64_t) chunk * INFO_OUTLIER_CHUNK;
+            long     nbj = INFO_OUTLIER_CHUNK;
+            if(j0 + nbj > N)
+            {
+                nbj = N - j0;
+            }
+
+            for(long kk = 0; kk < NBslice; kk++)
+            {
+                outlier_gather(ID, (uint64_t) kk * N + j0, nbj, row);
+                for(long j = 0; j < nbj; j++)
+                {
+                    if(isfinite(row[j]))
+                    {
+                        uint64_t ii = (j0 + j) * INFO_OUTLIER_NBMARKER;
+                        outlier_p2_add(outlier->height + ii, outlier->pos + ii, row[j]);
+                    }
+                }
+            }
+        }
+
+        free(row);
+    }
+
+    if(allocerr)
+    {
+        return RETURN_FAILURE;
+    }
+
+    return RETURN_SUCCESS;
+}
+
+
+
+
+/**
+ * @brief Per-pixel median and robust sigma from accumulated statistics
+ */
+errno_t info_outlier_finalize(
+    INFO_OUTLIER *outlier
+)
+{
+    uint64_t N = outlier->N;
+    const int M = INFO_OUTLIER_NBMARKER;
+
+    free(outlier->median);
+    free(outlier->sigma);
+    outlier->median = (double *) malloc(sizeof(double) * (N + 1));
+    outlier->sigma = (double *) malloc(sizeof(double) * (N + 1));
+    if((outlier->median == NULL) || (outlier->sigma == NULL))
+    {
+        PRINT_ERROR("malloc error");
+        return RETURN_FAILURE;
+    }
+
+    for(uint64_t ii = 0; ii < N; ii++)
+    {
+        const double *h = outlier->height + ii * M;
+        int32_t      cnt = outlier->pos[ii * M + M - 1];
+        double       q1, q3;
+
+        if(cnt == 0)
+        {
+            outlier->median[ii] = NAN;
+            outlier->sigma[ii] = NAN;
+            continue;
+        }
+        if(cnt < M)
+        {
+            // exact, values are sorted
+            outlier->median[ii] = h[cnt / 2];
+            q1 = h[(int)(0.25 * cnt)];
+            q3 = h[(int)(0.75 * cnt)];
+        }
+        else
+        {
+            outlier->median[ii] = h[4];
+            q1 = h[2];
+            q3 = h[6];
+        }
+        outlier->sigma[ii] = (q3 - q1) / 1.349;
+    }
+
+    return RETURN_SUCCESS;
+}
+
+
+
+
+/**
+ * @brief Flag outliers in the first NBslice slices of image ID
+ *
+ * Slices are written to slices kkstart ... kkstart+NBslice-1 of flag
+ * cube IDflag (see file description for bit layout). count receives the
+ * number of outliers of each of the NBslice slices.
+ * info_outlier_finalize() must have been called.
+ */
+errno_t info_outlier_flag(
+    const INFO_OUTLIER *outlier,
+    imageID             ID,
+    long                NBslice,
+    double              nsigma,
+    imageID             IDflag,
+    long                kkstart,
+    uint32_t           *count
+)
+{
+    uint64_t N = outlier->N;
+    long     xsize = data.image[ID].md[0].size[0];
+    long     ysize = N / xsize;
+    long     xbytes = (xsize + 7) / 8;
+
+    if((outlier->median == NULL) || (outlier->sigma == NULL))
+    {
+        PRINT_ERROR("statistics not finalized");
+        return RETURN_FAILURE;
+    }
+    if((data.image[IDflag].md[0].datatype != _DATATYPE_UINT8)
+            || (data.image[IDflag].md[0].nelement <
+                (uint64_t) xbytes * ysize * (kkstart + NBslice)))
+    {
+        PRINT_ERROR("flag cube size does not match");
+        return RETURN_FAILURE;
+    }
+
+    int NBthreads = info_pixstats_get_NBthreads();
+    (void) NBthreads;
+    int allocerr = 0;
+
+#ifdef _OPENMP
+    #pragma omp parallel num_threads(NBthreads) if(NBslice > 1)
+#endif
+    {
+        double *row = (double *) malloc(sizeof(double) * xsize);
+        if(row == NULL)
+        {
+            PRINT_ERROR("malloc error");
+#ifdef _OPENMP
+            #pragma omp atomic write
+#endif
+            allocerr = 1;
+        }
+
+#ifdef _OPENMP
+        #pragma omp for schedule(dynamic)
+#endif
+        for(long kk = 0; kk < NBslice; kk++)
+        {
+            int skip;
+#ifdef _OPENMP
+            #pragma omp atomic read
+#endif
+            skip = allocerr;
+            if(skip)
+            {
+                continue;
+            }
+
+            uint8_t *flags = data.image[IDflag].array.UI8 +
+                             (uint64_t)(kkstart + kk) * xbytes * ysize;
+            uint32_t cnt = 0;
+
+            memset(flags, 0, (size_t) xbytes * ysize);
+            for(long y = 0; y < ysize; y++)
+            {
+                uint64_t     ii0 = (uint64_t) y * xsize;
+                const double *median = outlier->median + ii0;
+                const double *sigma = outlier->sigma + ii0;
+                uint8_t     *rowflags = flags + y * xbytes;
+
+                outlier_gather(ID, (uint64_t) kk * N + ii0, xsize, row);
+                for(long x = 0; x < xsize; x++)
+                {
+                    if(fabs(row[x] - median[x]) > nsigma * sigma[x])
+                    {
+                        rowflags[x / 8] |= (uint8_t)(1 << (x % 8));
+                        cnt++;
+                    }
+                }
+            }
+            count[kk] = cnt;
+        }
+
+        free(row);
+    }
+
+    if(allocerr)
+    {
+        return RETURN_FAILURE;
+    }
+
+    return RETURN_SUCCESS;
+}
+
+
+
+
+errno_t info_outlier_free(
+    INFO_OUTLIER *outlier
+)
+{
+    free(outlier->height);
+    free(outlier->pos);
+    free(outlier->median);
+    free(outlier->sigma);
+    outlier->height = NULL;
+    outlier->pos = NULL;
+    outlier->median = NULL;
+    outlier->sigma = NULL;
+
+    return RETURN_SUCCESS;
+}
+
+
+
+
+// flag cube of flagz slices and per-slice count image of zsize values
+static errno_t outlier_create_output(
+    uint32_t    xsize,
+    uint32_t    ysize,
+    uint32_t    flagz,
+    uint32_t    zsize,
+    const char *IDflag_name,
+    const char *IDcount_name,
+    imageID    *IDflag,
+    imageID    *IDcount
+)
+{
+    uint32_t flagsize[3] = { (xsize + 7) / 8, ysize, flagz };
+    uint32_t countsize[1] = { zsize };
+
+    *IDflag = create_image_ID(IDflag_name, 3, flagsize, _DATATYPE_UINT8, 0, 0);
+    if(*IDflag == -1)
+    {
+        PRINT_ERROR("cannot create image %s", IDflag_name);
+        return RETURN_FAILURE;
+    }
+    *IDcount = create_image_ID(IDcount_name, 1, countsize, _DATATYPE_UINT32, 0, 0);
+    if(*IDcount == -1)
+    {
+        PRINT_ERROR("cannot create image %s", IDcount_name);
+        delete_image_ID(IDflag_name);
+        *IDflag = -1;
+        return RETURN_FAILURE;
+    }
+
+    return RETURN_SUCCESS;
+}
+
+
+
+
+// flags of slices kkstart ... kkstart+NBslice-1, first slices of IDflag,
+// to FITS file
+static errno_t outlier_write_flags(
+    fitsfile *fptr,
+    imageID   IDflag,
+    long      kkstart,
+    long      NBslice
+)
+{
+    uint64_t planebytes = (uint64_t) data.image[IDflag].md[0].size[0] *
+                          data.image[IDflag].md[0].size[1];
+    long     firstpix[3] = { 1, 1, kkstart + 1 };
+    int      status = 0;
+
+    if(fits_write_pix(fptr, TBYTE, firstpix, (long long)(planebytes * NBslice),
+                      data.image[IDflag].array.UI8, &status))
+    {
+        fits_report_error(stderr, status);
+        return RETURN_FAILURE;
+    }
+
+    return RETURN_SUCCESS;
+}
+
+
+
+
+/**
+ * @brief Flag outliers of 3D image against per-pixel temporal statistics
+ *
+ * Writes bit-packed flag cube IDflag_name and per-slice outlier count
+ * IDcount_name (uint32, one value per slice). Returns flag cube ID.
+ */
+imageID info_image_outlier(
+    const char *ID_name,
+    double      nsigma,
+    const char *IDflag_name,
+    const char *IDcount_name
+)
+{
+    imageID      ID, IDflag, IDcount;
+    INFO_OUTLIER outlier;
+
+    ID = image_ID(ID_name);
+    if(ID == -1)
+    {
+        PRINT_ERROR("image %s not found", ID_name);
+        return -1;
+    }
+    if(data.image[ID].md[0].naxis != 3)
+    {
+        PRINT_ERROR("image %s : 3D image required", ID_name);
+        return -1;
+    }
+
+    uint32_t xsize = data.image[ID].md[0].size[0];
+    uint32_t ysize = data.image[ID].md[0].size[1];
+    uint32_t zsize = data.image[ID].md[0].size[2];
+
+    if(info_outlier_init(&outlier, (uint64_t) xsize * ysize) != RETURN_SUCCESS)
+    {
+        return -1;
+    }
+
+    if((info_outlier_update(&outlier, ID, zsize) != RETURN_SUCCESS)
+            || (info_outlier_finalize(&outlier) != RETURN_SUCCESS)
+            || (outlier_create_output(xsize, ysize, zsize, zsize, IDflag_name,
+                                      IDcount_name, &IDflag, &IDcount) != RETURN_SUCCESS))
+    {
+        info_outlier_free(&outlier);
+        return -1;
+    }
+    if(info_outlier_flag(&outlier, ID, zsize, nsigma, IDflag, 0,
+                         data.image[IDcount].array.UI32) != RETURN_SUCCESS)
+    {
+        delete_image_ID(IDflag_name);
+        delete_image_ID(IDcount_name);
+        info_outlier_free(&outlier);
+        return -1;
+    }
+
+    info_outlier_free(&outlier);
+
+    return IDflag;
+}
+
+
+
+
+/**
+ * @brief Flag outliers of FITS cube read out-of-core in blocks of slices
+ *
+ * Same output as info_image_outlier(), for a cube read from file fname
+ * in blocks of NBslice slices (default size if NBslice <= 0). The file is
+ * read twice : statistics, then flags.
+ *
+ * If IDflag_name ends with ".fits", the flag cube is written to this FITS
+ * file one block at a time, and only the count image is kept in memory ;
+ * the count image ID is then returned.
+ */
+imageID info_outlier_fits(
+    const char *fname,
+    double      nsigma,
+    const char *IDflag_name,
+    const char *IDcount_name,
+    long        NBslice
+)
+{
+    INFO_FITSBLOCK fitsblock;
+    INFO_OUTLIER   outlier;
+    imageID        IDbuf, IDflag, IDcount;
+    long           kkstart, nbslice;
+
+    // pass 1 : statistics
+    if(info_fitsblock_open(&fitsblock, fname, NBslice) != RETURN_SUCCESS)
+    {
+        return -1;
+    }
+    uint32_t xsize = fitsblock.size[0];
+    uint32_t ysize = fitsblock.size[1];
+    uint32_t zsize = fitsblock.size[2];
+
+    if(info_outlier_init(&outlier, (uint64_t) xsize * ysize) != RETURN_SUCCESS)
+    {
+        info_fitsblock_close(&fitsblock);
+        return -1;
+    }
+    errno_t ret = RETURN_SUCCESS;
+    while((ret == RETURN_SUCCESS)
+            && ((IDbuf = info_fitsblock_next(&fitsblock, &kkstart, &nbslice)) != -1))
+    {
+        ret = info_outlier_update(&outlier, IDbuf, nbslice);
+    }
+    if(info_fitsblock_close(&fitsblock) != RETURN_SUCCESS)
+    {
+        PRINT_ERROR("read error on file %s", fname);
+        ret = RETURN_FAILURE;
+    }
+    if(ret == RETURN_SUCCESS)
+    {
+        ret = info_outlier_finalize(&outlier);
+    }
+    if(ret != RETURN_SUCCESS)
+    {
+        info_outlier_free(&outlier);
+        return -1;
+    }
+
+    // pass 2 : flags, to file if IDflag_name is a FITS file name
+    size_t    len = strlen(IDflag_name);
+    int       tofile = (len > 5) && (strcmp(IDflag_name + len - 5, ".fits") == 0);
+    char      flagname[STRINGMAXLEN_IMGNAME];
+    fitsfile *fptr = NULL;
+    int       status = 0;
+
+    if(info_fitsblock_open(&fitsblock, fname, NBslice) != RETURN_SUCCESS)
+    {
+        info_outlier_free(&outlier);
+        return -1;
+    }
+    if(tofile)
+    {
+        // block flag buffer
+        int index = 0;
+        do
+        {
+            snprintf(flagname, STRINGMAXLEN_IMGNAME, "_outlierflag%lx_%d",
+                     (unsigned long) flagname, index++);
+        }
+        while(image_ID(flagname) != -1);
+    }
+    else
+    {
+        snprintf(flagname, STRINGMAXLEN_IMGNAME, "%s", IDflag_name);
+    }
+    if(outlier_create_output(xsize, ysize, tofile ? fitsblock.NBslice : zsize, zsize,
+                             flagname, IDcount_name, &IDflag, &IDcount) != RETURN_SUCCESS)
+    {
+        info_fitsblock_close(&fitsblock);
+        info_outlier_free(&outlier);
+        return -1;
+    }
+    if(tofile)
+    {
+        char fitsname[STRINGMAXLEN_FILENAME];
+        long naxes[3] = { (xsize + 7) / 8, ysize, zsize };
+
+        snprintf(fitsname, STRINGMAXLEN_FILENAME, "!%s", IDflag_name);
+        if(fits_create_file(&fptr, fitsname, &status)
+                || fits_create_img(fptr, BYTE_IMG, 3, naxes, &status))
+        {
+            fits_report_error(stderr, status);
+            ret = RETURN_FAILURE;
+        }
+    }
+    while((ret == RETURN_SUCCESS)
+            && ((IDbuf = info_fitsblock_next(&fitsblock, &kkstart, &nbslice)) != -1))
+    {
+        ret = info_outlier_flag(&outlier, IDbuf, nbslice, nsigma, IDflag,
+                                tofile ? 0 : kkstart,
+                                data.image[IDcount].array.UI32 + kkstart);
+        if((ret == RETURN_SUCCESS) && tofile)
+        {
+            ret = outlier_write_flags(fptr, IDflag, kkstart, nbslice);
+        }
+    }
+    info_outlier_free(&outlier);
+    if(info_fitsblock_close(&fitsblock) != RETURN_SUCCESS)
+    {
+        PRINT_ERROR("read error on file %s", fname);
+        ret = RETURN_FAILURE;
+    }
+    if(fptr != NULL)
+    {
+        status = 0;
+        if(fits_close_file(fptr, &status))
+        {
+            fits_report_error(stderr, status);
+            ret = RETURN_FAILURE;
+        }
+    }
+    if(tofile)
+    {
+        delete_image_ID(flagname);
+        IDflag = IDcount;
+    }
+    if(ret != RETURN_SUCCESS)
+    {
+        if(!tofile)
+        {
+            delete_image_ID(flagname);
+        }
+        delete_image_ID(IDcount_name);
+        return -1;
+    }
+
+    return IDflag;
+}
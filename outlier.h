@@ -0,0 +1,71 @@
+/**
+ * @file    outlier.h
+ * @brief   Outlier and cosmic-ray detection across cube slices
+ *
+ */
+
+#if !defined(INFO_OUTLIER_H)
+#define INFO_OUTLIER_H
+
+
+// number of P2 markers per pixel, for quantiles 0.25, 0.5, 0.75
+#define INFO_OUTLIER_NBMARKER 9
+
+
+typedef struct
+{
+    uint64_t  N;          // number of pixels
+    double   *height;     // N x INFO_OUTLIER_NBMARKER marker heights
+    int32_t  *pos;        // N x INFO_OUTLIER_NBMARKER marker positions
+    double   *median;     // per-pixel median, set by info_outlier_finalize
+    double   *sigma;      // per-pixel robust sigma = IQR / 1.349
+} INFO_OUTLIER;
+
+
+
+errno_t info_outlier_init(
+    INFO_OUTLIER *outlier,
+    uint64_t      N
+);
+
+errno_t info_outlier_update(
+    INFO_OUTLIER *outlier,
+    imageID       ID,
+    long          NBslice
+);
+
+errno_t info_outlier_finalize(
+    INFO_OUTLIER *outlier
+);
+
+errno_t info_outlier_flag(
+    const INFO_OUTLIER *outlier,
+    imageID             ID,
+    long                NBslice,
+    double              nsigma,
+    imageID             IDflag,
+    long                kkstart,
+    uint32_t           *count
+);
+
+errno_t info_outlier_free(
+    INFO_OUTLIER *outlier
+);
+
+imageID info_image_outlier(
+    const char *ID_name,
+    double      nsigma,
+    const char *IDflag_name,
+    const char *IDcount_name
+);
+
+imageID info_outlier_fits(
+    const char *fname,
+    double      nsigma,
+    const char *IDflag_name,
+    const char *IDcount_name,
+    long        NBslice
+);
+
+
+#endif
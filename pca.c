@@ -0,0 +1,760 @@
+/**
+ * @file    pca.c
+ * @brief   Principal components of image cubes from the slice Gram matrix
+ *
+ * Principal components (KL modes) of the slices of a cube, after
+ * subtraction of the temporal mean of each pixel. With Z slices of
+ * N pixels and Z << N, the eigenvectors of the Z x Z slice Gram matrix
+ * G = X X^T give the mode coefficients versus time, and spatial modes are
+ * X^T v / sqrt(lambda). The N x N pixel covariance is never formed.
+ *
+ * G is accumulated over chunks of pixels : each chunk (all slices) is
+ * transposed to pixel-major vectors and added as a rank-k update of the
+ * packed lower triangle of G (see info_covar_rankk). The leading
+ * eigenvectors are found by subspace iteration with Rayleigh-Ritz
+ * projection, the small projected problem being solved by Jacobi
+ * rotations. Spatial modes are computed in a second pass over the cube.
+ *
+ * NaN and Inf pixels are replaced by the pixel temporal mean.
+ *
+ */
+
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+
+#include "CommandLineInterface/CLIcore.h"
+#include "COREMOD_memory/COREMOD_memory.h"
+
+#include "info/pixstats.h"
+#include "info/covar.h"
+#include "info/pca.h"
+
+
+
+
+// pixel chunk buffer size, in doubles
+#define INFO_PCA_CHUNKSIZE 1048576
+
+// modes with eigenvalue below this fraction of the largest are roundoff,
+// and are set to zero
+#define INFO_PCA_RANKTOL 1.0e-10
+
+// extra vectors in subspace iteration
+#define INFO_PCA_OVERSAMPLE 8
+
+// number of independent accumulators of the Gram matrix product
+#define INFO_PCA_NBLANE 16
+
+#define INFO_PCA_MAXITER 300
+#define INFO_PCA_TOL     1.0e-12
+
+
+
+// nbpix contiguous pixels of a slice, written with stride Z
+// non-finite pixels are set to NAN
+#define INFO_PCA_GATHER(TS, PIXTYPE, DTYPE, SUMTYPE, SQTYPE,                  \
+                        PIXMIN, PIXMAX, ISFLOAT)                              \
+static void pca_gather_##TS(                                                  \
+    const PIXTYPE *restrict array,                                            \
+    long                    nbpix,                                            \
+    double        *restrict buffer,                                           \
+    long                    Z                                                 \
+)                                                                             \
+{                                                                             \
+    for(long j = 0; j < nbpix; j++)                                           \
+    {                                                                         \
+        double v = (double) array[j];                                         \
+        if(ISFLOAT && !isfinite(v))                                           \
+        {                                                                     \
+            v = NAN;                                                          \
+        }                                                                     \
+        buffer[j * Z] = v;                                                    \
+    }                                                                         \
+}
+
+INFO_PIXSTATS_TYPELIST(INFO_PCA_GATHER)
+
+
+
+
+// pixels j0 ... j0+nbj-1 of all slices, to pixel-major buffer (nbj x Z),
+// temporal mean subtracted
+static void pca_gather_chunk(
+    imageID   ID,
+    uint64_t  j0,
+    long      nbj,
+    double   *buffer
+)
+{
+    uint64_t xysize = (uint64_t) data.image[ID].md[0].size[0] * data.image[ID].md[0].size[1];
+    long     Z = data.image[ID].md[0].size[2];
+
+    for(long kk = 0; kk < Z; kk++)
+    {
+        uint64_t offset = (uint64_t) kk * xysize + j0;
+        switch(data.image[ID].md[0].datatype)
+        {
+#define INFO_PCA_CASE_GATHER(TS, PIXTYPE, DTYPE, ...)                               \
+            case DTYPE:                                                             \
+                pca_gather_##TS(data.image[ID].array.TS + offset, nbj,              \
+                                buffer + kk, Z);                                    \
+                break;
+                INFO_PIXSTATS_TYPELIST(INFO_PCA_CASE_GATHER)
+#undef INFO_PCA_CASE_GATHER
+        }
+    }
+
+    for(long j = 0; j < nbj; j++)
+    {
+        double *x = buffer + j * Z;
+        double  sum = 0.0;
+        long    cnt = 0;
+
+        for(long kk = 0; kk < Z; kk++)
+        {
+            if(!isnan(x[kk]))
+            {
+                sum += x[kk];
+                cnt++;
+            }
+        }
+        double mean = (cnt > 0) ? sum / cnt : 0.0;
+        for(long kk = 0; kk < Z; kk++)
+        {
+            x[kk] = isnan(x[kk]) ? 0.0 : x[kk] - mean;
+        }
+    }
+}
+
+
+
+
+// pixels per chunk for Z slices
+static long pca_chunk_pixels(
+    long Z
+)
+{
+    long nbj = INFO_PCA_CHUNKSIZE / Z;
+
+    return (nbj < 1) ? 1 : nbj;
+}
+
+
+
+
+/**
+ * @brief Slice Gram matrix of 3D image ID, temporal mean subtracted
+ *
+ * gram receives the packed lower triangle, Z(Z+1)/2 values : element
+ * (i, j), j <= i, is at i(i+1)/2 + j.
+ */
+errno_t info_pca_gram(
+    imageID  ID,
+    double  *gram
+)
+{
+    if(data.image[ID].md[0].naxis != 3)
+    {
+        PRINT_ERROR("3D image required");
+        return RETURN_FAILURE;
+    }
+    if(info_pixstats_datatype_supported(data.image[ID].md[0].datatype) == 0)
+    {
+        PRINT_ERROR("datatype %d not supported",
+                    (int) data.image[ID].md[0].datatype);
+        return RETURN_FAILURE;
+    }
+
+    uint64_t xysize = (uint64_t) data.image[ID].md[0].size[0] * data.image[ID].md[0].size[1];
+    long     Z = data.image[ID].md[0].size[2];
+    long     nbjmax = pca_chunk_pixels(Z);
+
+    double *buffer = (double *) malloc(sizeof(double) * nbjmax * Z);
+    if(buffer == NULL)
+    {
+        PRINT_ERROR("malloc error");
+        return RETURN_FAILURE;
+    }
+
+    memset(gram, 0, sizeof(double) * Z * (Z + 1) / 2);
+    for(uint64_t j0 = 0; j0 < xysize; j0 += nbjmax)
+    {
+        long nbj = nbjmax;
+        if(j0 + nbj > xysize)
+        {
+            nbj = xysize - j0;
+        }
+        pca_gather_chunk(ID, j0, nbj, buffer);
+        info_covar_rankk(gram, buffer, Z, nbj);
+    }
+
+    free(buffer);
+
+    return RETURN_SUCCESS;
+}
+
+
+
+
+// W = G V for packed symmetric G (n x n), V and W n x m row-major
+// rows are split in fixed lanes, so results do not depend on thread count
+static void pca_gram_product(
+    const double *gram,
+    long          n,
+    const double *V,
+    long          m,
+    double       *W,
+    double       *lanebuf
+)
+{
+    int NBlane = INFO_PCA_NBLANE;
+    if(NBlane > n)
+    {
+        NBlane = n;
+    }
+
+    int NBthreads = info_pixstats_get_NBthreads();
+    (void) NBthreads;
+
+    // lanes hold interleaved row blocks of similar total length
+#ifdef _OPENMP
+    #pragma omp parallel for schedule(dynamic, 1) num_threads(NBthreads)
+#endif
+    for(int lane = 0; lane < NBlane; lane++)
+    {
+        double *Wl = lanebuf + (size_t) lane * n * m;
+        memset(Wl, 0, sizeof(double) * n * m);
+
+        for(long i = lane; i < n; i += NBlane)
+        {
+            const double *Gi = gram + (uint64_t) i * (i + 1) / 2;
+            const double *vi = V + i * m;
+            double       *wi = Wl + i * m;
+
+            for(long j = 0; j < i; j++)
+            {
+                double        g = Gi[j];
+                const double *vj = V + j * m;
+                double       *wj = Wl + j * m;
+                for(long k = 0; k < m; k++)
+                {
+                    wi[k] += g * vj[k];
+                    wj[k] += g * vi[k];
+                }
+            }
+            for(long k = 0; k < m; k++)
+            {
+                wi[k] += Gi[i] * vi[k];
+            }
+        }
+    }
+
+    memset(W, 0, sizeof(double) * n * m);
+    for(int lane = 0; lane < NBlane; lane++)
+    {
+        const double *Wl = lanebuf + (size_t) lane * n * m;
+        for(long ii = 0; ii < n * m; ii++)
+        {
+            W[ii] += Wl[ii];
+        }
+    }
+}
+
+
+
+
+// orthonormalize columns of V (n x m row-major), modified Gram-Schmidt
+static void pca_orthonormalize(
+    double *V,
+    long    n,
+    long    m
+)
+{
+    for(long k = 0; k < m; k++)
+    {
+        for(long l = 0; l < k; l++)
+        {
+            double dot = 0.0;
+            for(long i = 0; i < n; i++)
+            {
+                dot += V[i * m + k] * V[i * m + l];
+            }
+            for(long i = 0; i < n; i++)
+            {
+                V[i * m + k] -= dot * V[i * m + l];
+            }
+        }
+
+        double norm = 0.0;
+        for(long i = 0; i < n; i++)
+        {
+            norm += V[i * m + k] * V[i * m + k];
+        }
+        norm = sqrt(norm);
+        for(long i = 0; i < n; i++)
+        {
+            V[i * m + k] = (norm > 0.0) ? V[i * m + k] / norm : 0.0;
+        }
+    }
+}
+
+
+
+
+// eigenvalues d and eigenvectors U (columns) of symmetric A (m x m),
+// cyclic Jacobi rotations, A is destroyed
+// sorted by decreasing eigenvalue
+static void pca_jacobi(
+    double *A,
+    long    m,
+    double *d,
+    double *U
+)
+{
+    for(long i = 0; i < m * m; i++)
+    {
+        U[i] = 0.0;
+    }
+    for(long i = 0; i < m; i++)
+    {
+        U[i * m + i] = 1.0;
+    }
+
+    for(int sweep = 0; sweep < 100; sweep++)
+    {
+        double off = 0.0;
+        double diag = 0.0;
+        for(long p = 0; p < m; p++)
+        {
+            diag += A[p * m + p] * A[p * m + p];
+            for(long q = p + 1; q < m; q++)
+            {
+                off += A[p * m + q] * A[p * m + q];
+            }
+        }
+        if(off <= 1.0e-30 * diag)
+        {
+            break;
+        }
+
+        for(long p = 0; p < m; p++)
+        {
+            for(long q = p + 1; q < m; q++)
+            {
+                double apq = A[p * m + q];
+                if(apq == 0.0)
+                {
+                    continue;
+                }
+                double theta = (A[q * m + q] - A[p * m + p]) / (2.0 * apq);
+                double t = ((theta >= 0.0) ? 1.0 : -1.0) /
+                           (fabs(theta) + sqrt(theta * theta + 1.0));
+                double c = 1.0 / sqrt(t * t + 1.0);
+                double s = t * c;
+
+                for(long k = 0; k < m; k++)
+                {
+                    double akp = A[k * m + p];
+                    double akq = A[k * m + q];
+                    A[k * m + p] = c * akp - s * akq;
+                    A[k * m + q] = s * akp + c * akq;
+                }
+                for(long k = 0; k < m; k++)
+                {
+                    double apk = A[p * m + k];
+                    double aqk = A[q * m + k];
+                    A[p * m + k] = c * apk - s * aqk;
+                    A[q * m + k] = s * apk + c * aqk;
+                }
+                for(long k = 0; k < m; k++)
+                {
+                    double ukp = U[k * m + p];
+                    double ukq = U[k * m + q];
+                    U[k * m + p] = c * ukp - s * ukq;
+                    U[k * m + q] = s * ukp + c * ukq;
+                }
+            }
+        }
+    }
+
+    for(long i = 0; i < m; i++)
+    {
+        d[i] = A[i * m + i];
+    }
+
+    // selection sort of eigenpairs, decreasing
+    for(long i = 0; i < m; i++)
+    {
+        long imax = i;
+        for(long j = i + 1; j < m; j++)
+        {
+            if(d[j] > d[imax])
+            {
+                imax = j;
+            }
+        }
+        if(imax != i)
+        {
+            double tmp = d[i];
+            d[i] = d[imax];
+            d[imax] = tmp;
+            for(long k = 0; k < m; k++)
+            {
+                tmp = U[k * m + i];
+                U[k * m + i] = U[k * m + imax];
+                U[k * m + imax] = tmp;
+            }
+        }
+    }
+}
+
+
+
+
+/**
+ * @brief Leading K eigenpairs of packed symmetric matrix gram (n x n)
+ *
+ * eigval receives K eigenvalues in decreasing order, eigvec K unit
+ * eigenvectors of n values (K x n). Subspace iteration on K +
+ * INFO_PCA_OVERSAMPLE vectors with Rayleigh-Ritz projection.
+ */
+errno_t info_pca_eigen(
+    const double *gram,
+    long          n,
+    long          K,
+    double       *eigval,
+    double       *eigvec
+)
+{
+    if((K < 1) || (K > n))
+    {
+        PRINT_ERROR("number of modes %ld out of range 1 ... %ld", K, n);
+        return RETURN_FAILURE;
+    }
+
+    long m = K + INFO_PCA_OVERSAMPLE;
+    if(m > n)
+    {
+        m = n;
+    }
+
+    double *V = (double *) malloc(sizeof(double) * n * m);
+    double *W = (double *) malloc(sizeof(double) * n * m);
+    double *lanebuf = (double *) malloc(sizeof(double) * n * m * INFO_PCA_NBLANE);
+    double *H = (double *) malloc(sizeof(double) * m * m);
+    double *U = (double *) malloc(sizeof(double) * m * m);
+    double *d = (double *) malloc(sizeof(double) * m);
+    double *dprev = (double *) malloc(sizeof(double) * m);
+    if((V == NULL) || (W == NULL) || (lanebuf == NULL) || (H == NULL)
+            || (U == NULL) || (d == NULL) || (dprev == NULL))
+    {
+        PRINT_ERROR("malloc error");
+        free(V);
+        free(W);
+        free(lanebuf);
+        free(H);
+        free(U);
+        free(d);
+        free(dprev);
+        return RETURN_FAILURE;
+    }
+
+    // deterministic pseudo-random start
+    uint64_t state = 88172645463325252ULL;
+    for(long ii = 0; ii < n * m; ii++)
+    {
+        state ^= state << 13;
+        state ^= state >> 7;
+        state ^= state << 17;
+        V[ii] = (double)(state >> 11) / 9007199254740992.0 - 0.5;
+    }
+    pca_orthonormalize(V, n, m);
+
+    for(long k = 0; k < m; k++)
+    {
+        dprev[k] = 0.0;
+    }
+
+    for(int iter = 0; iter < INFO_PCA_MAXITER; iter++)
+    {
+        pca_gram_product(gram, n, V, m, W, lanebuf);
+
+        // Rayleigh-Ritz : H = V^T G V
+        for(long k = 0; k < m; k++)
+        {
+            for(long l = 0; l < m; l++)
+            {
+                double h = 0.0;
+                for(long i = 0; i < n; i++)
+                {
+                    h += V[i * m + k] * W[i * m + l];
+                }
+                H[k * m + l] = h;
+            }
+        }
+        for(long k = 0; k < m; k++)
+        {
+            for(long l = 0; l < k; l++)
+            {
+                double h = 0.5 * (H[k * m + l] + H[l * m + k]);
+                H[k * m + l] = h;
+                H[l * m + k] = h;
+            }
+        }
+        pca_jacobi(H, m, d, U);
+
+        // rotate V to Ritz vectors, and G V accordingly
+        double *row = H;
+        for(long i = 0; i < n; i++)
+        {
+            for(long k = 0; k < m; k++)
+            {
+                double v = 0.0;
+                for(long l = 0; l < m; l++)
+                {
+                    v += V[i * m + l] * U[l * m + k];
+                }
+                row[k] = v;
+            }
+            memcpy(V + i * m, row, sizeof(double) * m);
+            for(long k = 0; k < m; k++)
+            {
+                double w = 0.0;
+                for(long l = 0; l < m; l++)
+                {
+                    w += W[i * m + l] * U[l * m + k];
+                }
+                row[k] = w;
+            }
+            memcpy(W + i * m, row, sizeof(double) * m);
+        }
+
+        int converged = 1;
+        for(long k = 0; k < K; k++)
+        {
+            if(fabs(d[k] - dprev[k]) > INFO_PCA_TOL * fabs(d[0]))
+            {
+                converged = 0;
+            }
+            dprev[k] = d[k];
+        }
+        if(converged)
+        {
+            break;
+        }
+
+        memcpy(V, W, sizeof(double) * n * m);
+        pca_orthonormalize(V, n, m);
+    }
+
+    for(long k = 0; k < K; k++)
+    {
+        eigval[k] = d[k];
+        for(long i = 0; i < n; i++)
+        {
+            eigvec[k * n + i] = V[i * m + k];
+        }
+    }
+
+    free(V);
+    free(W);
+    free(lanebuf);
+    free(H);
+    free(U);
+    free(d);
+    free(dprev);
+
+    return RETURN_SUCCESS;
+}
+
+
+
+
+/**
+ * @brief First K principal components of the slices of a 3D image
+ *
+ * Writes spatial modes IDmodes_name (xsize x ysize x K, unit norm) and
+ * coefficients IDcoeff_name (Z x K, row k is the time series of mode k),
+ * such that slice kk minus the temporal mean is approximated by the sum
+ * over k of coeff[k][kk] x mode k. Coefficients of mode k have a sum of
+ * squares equal to its eigenvalue. Returns modes image ID.
+ *
+ * The mean-subtracted slices span at most Z-1 dimensions, so K <= Z-1.
+ * Modes with eigenvalue below INFO_PCA_RANKTOL times the largest (cube
+ * of lower rank) are set to zero, with zero coefficients.
+ */
+imageID info_image_pca(
+    const char *ID_name,
+    long        K,
+    const char *IDmodes_name,
+    const char *IDcoeff_name
+)
+{
+    imageID ID, IDmodes, IDcoeff;
+
+    ID = image_ID(ID_name);
+    if(ID == -1)
+    {
+        PRINT_ERROR("image %s not found", ID_name);
+        return -1;
+    }
+    if(data.image[ID].md[0].naxis != 3)
+    {
+        PRINT_ERROR("image %s : 3D image required", ID_name);
+        return -1;
+    }
+
+    uint32_t xsize = data.image[ID].md[0].size[0];
+    uint32_t ysize = data.image[ID].md[0].size[1];
+    uint64_t xysize = (uint64_t) xsize * ysize;
+    long     Z = data.image[ID].md[0].size[2];
+
+    if((K < 1) || (K > Z - 1))
+    {
+        PRINT_ERROR("number of modes %ld out of range 1 ... %ld", K, Z - 1);
+        return -1;
+    }
+
+    double *gram = (double *) malloc(sizeof(double) * Z * (Z + 1) / 2);
+    double *eigval = (double *) malloc(sizeof(double) * K);
+    double *eigvec = (double *) malloc(sizeof(double) * K * Z);
+    if((gram == NULL) || (eigval == NULL) || (eigvec == NULL))
+    {
+        PRINT_ERROR("malloc error");
+        free(gram);
+        free(eigval);
+        free(eigvec);
+        return -1;
+    }
+
+    if((info_pca_gram(ID, gram) != RETURN_SUCCESS)
+            || (info_pca_eigen(gram, Z, K, eigval, eigvec) != RETURN_SUCCESS))
+    {
+        free(gram);
+        free(eigval);
+        free(eigvec);
+        return -1;
+    }
+    free(gram);
+
+    for(long k = 0; k < K; k++)
+    {
+        if(!(eigval[k] > INFO_PCA_RANKTOL * eigval[0]))
+        {
+            eigval[k] = 0.0;
+        }
+    }
+
+    IDcoeff = create_2Dimage_ID_double(IDcoeff_name, Z, K);
+    if(IDcoeff == -1)
+    {
+        PRINT_ERROR("cannot create image %s", IDcoeff_name);
+        free(eigval);
+        free(eigvec);
+        return -1;
+    }
+    for(long k = 0; k < K; k++)
+    {
+        double a = (eigval[k] > 0.0) ? sqrt(eigval[k]) : 0.0;
+        printf("mode %4ld   eigenvalue %g\n", k, eigval[k]);
+        for(long kk = 0; kk < Z; kk++)
+        {
+            data.image[IDcoeff].array.D[k * Z + kk] = a * eigvec[k * Z + kk];
+        }
+    }
+
+    // spatial modes : X^T v / sqrt(lambda), chunks of pixels in parallel
+    uint32_t modesize[3] = { xsize, ysize, (uint32_t) K };
+    IDmodes = create_image_ID(IDmodes_name, 3, modesize, _DATATYPE_FLOAT, 0, 0);
+    if(IDmodes == -1)
+    {
+        PRINT_ERROR("cannot create image %s", IDmodes_name);
+        delete_image_ID(IDcoeff_name);
+        free(eigval);
+        free(eigvec);
+        return -1;
+    }
+
+    long nbjmax = pca_chunk_pixels(Z);
+    long NBchunk = (xysize + nbjmax - 1) / nbjmax;
+
+    int NBthreads = info_pixstats_get_NBthreads();
+    (void) NBthreads;
+    int allocerr = 0;
+
+#ifdef _OPENMP
+    #pragma omp parallel num_threads(NBthreads) if(NBchunk > 1)
+#endif
+    {
+        double *buffer = (double *) malloc(sizeof(double) * nbjmax * Z);
+        if(buffer == NULL)
+        {
+            PRINT_ERROR("malloc error");
+#ifdef _OPENMP
+            #pragma omp atomic write
+#endif
+            allocerr = 1;
+        }
+
+#ifdef _OPENMP
+        #pragma omp for schedule(dynamic)
+#endif
+        for(long chunk = 0; chunk < NBchunk; chunk++)
+        {
+            int skip;
+#ifdef _OPENMP
+            #pragma omp atomic read
+#endif
+            skip = allocerr;
+            if(skip)
+            {
+                continue;
+            }
+
+            uint64_t j0 = (uint64_t) chunk * nbjmax;
+            long     nbj = nbjmax;
+            if(j0 + nbj > xysize)
+            {
+                nbj = xysize - j0;
+            }
+            pca_gather_chunk(ID, j0, nbj, buffer);
+
+            for(long k = 0; k < K; k++)
+            {
+                const double *v = eigvec + k * Z;
+                double        scale = (eigval[k] > 0.0) ? 1.0 / sqrt(eigval[k]) : 0.0;
+                float        *mode = data.image[IDmodes].array.F + k * xysize + j0;
+
+                for(long j = 0; j < nbj; j++)
+                {
+                    const double *x = buffer + j * Z;
+                    double        dot = 0.0;
+                    INFO_PRAGMA_SIMD(reduction(+:dot))
+                    for(long kk = 0; kk < Z; kk++)
+                    {
+                        dot += x[kk] * v[kk];
+                    }
+                    mode[j] = (float)(dot * scale);
+                }
+            }
+        }
+
+        free(buffer);
+    }
+
+    free(eigval);
+    free(eigvec);
+
+    if(allocerr)
+    {
+        delete_image_ID(IDcoeff_name);
+        delete_image_ID(IDmodes_name);
+        return -1;
+    }
+
+    return IDmodes;
+}
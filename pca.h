@@ -0,0 +1,32 @@
+/**
+ * @file    pca.h
+ * @brief   Principal components of image cubes from the slice Gram matrix
+ *
+ */
+
+#if !defined(INFO_PCA_H)
+#define INFO_PCA_H
+
+
+errno_t info_pca_gram(
+    imageID  ID,
+    double  *gram
+);
+
+errno_t info_pca_eigen(
+    const double *gram,
+    long          n,
+    long          K,
+    double       *eigval,
+    double       *eigvec
+);
+
+imageID info_image_pca(
+    const char *ID_name,
+    long        K,
+    const char *IDmodes_name,
+    const char *IDcoeff_name
+);
+
+
+#endif
@@ -0,0 +1,336 @@
+/**
+ * @file    pixmask.c
+ * @brief   Run-length pixel masks for masked and ROI statistics
+ *
+ * A mask is converted once to a list of spans (runs of contiguous selected
+ * pixels). Reduction kernels then run unmodified over each span, so masked
+ * statistics cost is proportional to the number of selected pixels, with
+ * no per-pixel test.
+ *
+ * Spans are grouped in chunks of about INFO_PIXSTATS_CHUNKSIZE pixels, the
+ * unit of parallel work. Chunks only depend on the mask, so masked results
+ * are also independent of the number of threads.
+ *
+ */
+
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <math.h>
+
+#include "CommandLineInterface/CLIcore.h"
+
+#include "info/pixstats.h"
+#include "info/pixmask.h"
+
+
+
+
+// a chunk is closed after this number of spans, even if short
+#define INFO_PIXMASK_CHUNKMAXSPAN 4096
+
+
+
+#define INFO_PIXMASK_ROWCOPY(TS, PIXTYPE, DTYPE, ...)                         \
+static void pixmask_rowcopy_##TS(                                             \
+    const PIXTYPE *restrict row,                                              \
+    uint32_t                xsize,                                            \
+    double        *restrict drow                                              \
+)                                                                             \
+{                                                                             \
+    for(uint32_t ii = 0; ii < xsize; ii++)                                    \
+    {                                                                         \
+        drow[ii] = (double) row[ii];                                          \
+    }                                                                         \
+}
+
+INFO_PIXSTATS_TYPELIST(INFO_PIXMASK_ROWCOPY)
+
+
+
+
+static errno_t pixmask_init(
+    INFO_PIXMASK *pixmask,
+    long          NBspanmax
+)
+{
+    pixmask->NBpix = 0;
+    pixmask->NBspan = 0;
+    pixmask->NBchunk = 0;
+    pixmask->chunkspan = NULL;
+    pixmask->span = (INFO_PIXSPAN *) malloc(sizeof(INFO_PIXSPAN) * (NBspanmax + 1));
+    if(pixmask->span == NULL)
+    {
+        PRINT_ERROR("malloc error");
+        return RETURN_FAILURE;
+    }
+
+    return RETURN_SUCCESS;
+}
+
+
+
+
+// append span, split in pieces of at most INFO_PIXSTATS_CHUNKSIZE pixels
+// on failure the mask is freed, as for pixmask_set_chunks()
+static errno_t pixmask_add_span(
+    INFO_PIXMASK *pixmask,
+    uint64_t      start,
+    uint64_t      length,
+    long         *NBspanmax
+)
+{
+    while(length > 0)
+    {
+        uint64_t len = length;
+        if(len > INFO_PIXSTATS_CHUNKSIZE)
+        {
+            len = INFO_PIXSTATS_CHUNKSIZE;
+        }
+
+        if(pixmask->NBspan == *NBspanmax)
+        {
+            *NBspanmax *= 2;
+            INFO_PIXSPAN *span = (INFO_PIXSPAN *) realloc(pixmask->span,
+                                 sizeof(INFO_PIXSPAN) * (*NBspanmax));
+            if(span == NULL)
+            {
+                PRINT_ERROR("realloc error");
+                info_pixmask_free(pixmask);
+                return RETURN_FAILURE;
+            }
+            pixmask->span = span;
+        }
+        pixmask->span[pixmask->NBspan].start = start;
+        pixmask->span[pixmask->NBspan].length = len;
+        pixmask->NBspan++;
+        pixmask->NBpix += len;
+
+        start += len;
+        length -= len;
+    }
+
+    return RETURN_SUCCESS;
+}
+
+
+
+
+static errno_t pixmask_set_chunks(
+    INFO_PIXMASK *pixmask
+)
+{
+    pixmask->chunkspan = (long *) malloc(sizeof(long) * (pixmask->NBspan + 2));
+    if(pixmask->chunkspan == NULL)
+    {
+        PRINT_ERROR("malloc error");
+        info_pixmask_free(pixmask);
+        return RETURN_FAILURE;
+    }
+
+    pixmask->NBchunk = 0;
+    uint64_t chunkpix = 0;
+    long     chunkNBspan = 0;
+    for(long spanindex = 0; spanindex < pixmask->NBspan; spanindex++)
+    {
+        if(chunkNBspan == 0)
+        {
+            pixmask->chunkspan[pixmask->NBchunk] = spanindex;
+            pixmask->NBchunk++;
+        }
+        chunkpix += pixmask->span[spanindex].length;
+        chunkNBspan++;
+        if((chunkpix >= INFO_PIXSTATS_CHUNKSIZE)
+                || (chunkNBspan == INFO_PIXMASK_CHUNKMAXSPAN))
+        {
+            chunkpix = 0;
+            chunkNBspan = 0;
+        }
+    }
+    pixmask->chunkspan[pixmask->NBchunk] = pixmask->NBspan;
+
+    return RETURN_SUCCESS;
+}
+
+
+
+
+/**
+ * @brief Mask from image : pixels with value > 0.5 are selected
+ *
+ * Mask image can be of any real datatype. Only its first 2D plane is used.
+ */
+errno_t info_pixmask_build_image(
+    INFO_PIXMASK *pixmask,
+    imageID       IDmask
+)
+{
+    uint32_t xsize = data.image[IDmask].md[0].size[0];
+    uint32_t ysize = 1;
+    long     NBspanmax = 1024;
+
+    if(data.image[IDmask].md[0].naxis > 1)
+    {
+        ysize = data.image[IDmask].md[0].size[1];
+    }
+
+    if(info_pixstats_datatype_supported(data.image[IDmask].md[0].datatype) == 0)
+    {
+        PRINT_ERROR("mask datatype %d not supported",
+                    (int) data.image[IDmask].md[0].datatype);
+        return RETURN_FAILURE;
+    }
+
+    double *row = (double *) malloc(sizeof(double) * xsize);
+    if(row == NULL)
+    {
+        PRINT_ERROR("malloc error");
+        return RETURN_FAILURE;
+    }
+
+    if(pixmask_init(pixmask, NBspanmax) != RETURN_SUCCESS)
+    {
+        free(row);
+        return RETURN_FAILURE;
+    }
+    pixmask->xsize = xsize;
+    pixmask->ysize = ysize;
+
+    for(uint32_t jj = 0; jj < ysize; jj++)
+    {
+        uint32_t ii = 0;
+
+        switch(data.image[IDmask].md[0].datatype)
+        {
+#define INFO_PIXMASK_CASE_ROWCOPY(TS, PIXTYPE, DTYPE, ...)                  \
+            case DTYPE:                                                     \
+                pixmask_rowcopy_##TS(data.image[IDmask].array.TS +          \
+                                     (uint64_t) jj * xsize, xsize, row);    \
+                break;
+                INFO_PIXSTATS_TYPELIST(INFO_PIXMASK_CASE_ROWCOPY)
+#undef INFO_PIXMASK_CASE_ROWCOPY
+        }
+
+        // NaN compares false : not selected
+        while(ii < xsize)
+        {
+            while((ii < xsize) && !(row[ii] > 0.5))
+            {
+                ii++;
+            }
+            uint32_t ii0 = ii;
+            while((ii < xsize) && (row[ii] > 0.5))
+            {
+                ii++;
+            }
+            if(ii > ii0)
+            {
+                if(pixmask_add_span(pixmask, (uint64_t) jj * xsize + ii0, ii - ii0,
+                                    &NBspanmax) != RETURN_SUCCESS)
+                {
+                    free(row);
+                    return RETURN_FAILURE;
+                }
+            }
+        }
+    }
+    free(row);
+
+    return pixmask_set_chunks(pixmask);
+}
+
+
+
+
+/**
+ * @brief Mask from rectangular region of interest [xmin,xmax[ x [ymin,ymax[
+ */
+errno_t info_pixmask_build_roi(
+    INFO_PIXMASK *pixmask,
+    uint32_t      xsize,
+    uint32_t      ysize,
+    uint32_t      xmin,
+    uint32_t      xmax,
+    uint32_t      ymin,
+    uint32_t      ymax
+)
+{
+    long NBspanmax = 1024;
+
+    if(xmax > xsize)
+    {
+        xmax = xsize;
+    }
+    if(ymax > ysize)
+    {
+        ymax = ysize;
+    }
+
+    if(pixmask_init(pixmask, NBspanmax) != RETURN_SUCCESS)
+    {
+        return RETURN_FAILURE;
+    }
+    pixmask->xsize = xsize;
+    pixmask->ysize = ysize;
+
+    for(uint32_t jj = ymin; jj < ymax; jj++)
+    {
+        if(xmax > xmin)
+        {
+            if(pixmask_add_span(pixmask, (uint64_t) jj * xsize + xmin, xmax - xmin,
+                                &NBspanmax) != RETURN_SUCCESS)
+            {
+                return RETURN_FAILURE;
+            }
+        }
+    }
+
+    return pixmask_set_chunks(pixmask);
+}
+
+
+
+
+/**
+ * @brief Unmasked range [0, nbpix[, not row-aligned
+ */
+errno_t info_pixmask_build_range(
+    INFO_PIXMASK *pixmask,
+    uint64_t      nbpix
+)
+{
+    long NBspanmax = nbpix / INFO_PIXSTATS_CHUNKSIZE + 1;
+
+    if(pixmask_init(pixmask, NBspanmax) != RETURN_SUCCESS)
+    {
+        return RETURN_FAILURE;
+    }
+    pixmask->xsize = 0;
+    pixmask->ysize = 0;
+
+    if(pixmask_add_span(pixmask, 0, nbpix, &NBspanmax) != RETURN_SUCCESS)
+    {
+        return RETURN_FAILURE;
+    }
+
+    return pixmask_set_chunks(pixmask);
+}
+
+
+
+
+errno_t info_pixmask_free(
+    INFO_PIXMASK *pixmask
+)
+{
+    free(pixmask->span);
+    free(pixmask->chunkspan);
+    pixmask->span = NULL;
+    pixmask->chunkspan = NULL;
+    pixmask->NBspan = 0;
+    pixmask->NBchunk = 0;
+    pixmask->NBpix = 0;
+
+    return RETURN_SUCCESS;
+}
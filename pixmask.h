@@ -0,0 +1,59 @@
+/**
+ * @file    pixmask.h
+ * @brief   Run-length pixel masks for masked and ROI statistics
+ *
+ */
+
+#if !defined(INFO_PIXMASK_H)
+#define INFO_PIXMASK_H
+
+
+// contiguous run of selected pixels
+typedef struct
+{
+    uint64_t  start;    // first pixel, relative to start of plane
+    uint64_t  length;
+} INFO_PIXSPAN;
+
+
+typedef struct
+{
+    uint32_t       xsize;      // plane size, 0 if spans are not row-aligned
+    uint32_t       ysize;
+    uint64_t       NBpix;      // number of selected pixels
+    long           NBspan;
+    INFO_PIXSPAN  *span;       // sorted, each span within a single row
+    long           NBchunk;
+    long          *chunkspan;  // first span of each chunk, NBchunk+1 entries
+} INFO_PIXMASK;
+
+
+
+// the build functions leave nothing allocated when they fail,
+// info_pixmask_free() is only needed after a successful build
+errno_t info_pixmask_build_image(
+    INFO_PIXMASK *pixmask,
+    imageID       IDmask
+);
+
+errno_t info_pixmask_build_roi(
+    INFO_PIXMASK *pixmask,
+    uint32_t      xsize,
+    uint32_t      ysize,
+    uint32_t      xmin,
+    uint32_t      xmax,
+    uint32_t      ymin,
+    uint32_t      ymax
+);
+
+errno_t info_pixmask_build_range(
+    INFO_PIXMASK *pixmask,
+    uint64_t      nbpix
+);
+
+errno_t info_pixmask_free(
+    INFO_PIXMASK *pixmask
+);
+
+
+#endif
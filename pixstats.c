@@ -0,0 +1,883 @@
+/**
+ * @file    pixstats.c
+ * @brief   Datatype-specialized pixel statistics kernels
+ *
+ * One kernel per image datatype, all expanded from the same generic
+ * definition. Pixel values are read in their native type and accumulated
+ * in a wider type : integer images up to 32 bit are summed exactly in
+ * 64-bit integers, floating point and 64-bit integer images are summed
+ * in double.
+ *
+ * Images are split in fixed-size chunks, independently of the number of
+ * threads. Chunks are processed in parallel (OpenMP) and their partial
+ * results are combined pairwise in a fixed order, so results are
+ * bit-identical for any thread count.
+ *
+ * Percentiles of 8- and 16-bit integer images are read from a counting
+ * histogram built in one pass, with no copy or sort.
+ *
+ * All reductions accept an optional pixel mask (pixmask.h) : kernels then
+ * run over the mask spans only.
+ *
+ */
+
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <math.h>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+#include "CommandLineInterface/CLIcore.h"
+
+#include "info/pixstats.h"
+#include "info/pixmask.h"
+
+
+
+
+// Pixels are scanned in blocks of this size.
+// Extrema are tracked per block, so that the inner loop carries no index
+// and the extremum position is only searched for within a single block.
+#define INFO_PIXSTATS_BLOCKSIZE 4096
+
+
+
+// Datatypes with exact counting histogram
+// columns : array suffix, pixel type, datatype code, number of bins, bin offset
+//
+#define INFO_PIXSTATS_HISTO_TYPELIST(X)                      \
+    X(UI8,  uint8_t,  _DATATYPE_UINT8,  256,   0)             \
+    X(SI8,  int8_t,   _DATATYPE_INT8,   256,   128)           \
+    X(UI16, uint16_t, _DATATYPE_UINT16, 65536, 0)             \
+    X(SI16, int16_t,  _DATATYPE_INT16,  65536, 32768)
+
+
+
+// number of threads, 0 for OpenMP default
+static int pixstats_NBthreads = 0;
+
+
+
+
+/* ================================================================== */
+/*            GENERIC KERNELS                                         */
+/* ================================================================== */
+
+// NaN and Inf values propagate to the block sums. A block is first scanned
+// without any test ; only if its sums are not finite, it is scanned again
+// with a branch-free mask that skips and counts NaN and Inf pixels.
+// Pixel values are never modified.
+//
+// Before the first finite pixel, min and max hold the highest and lowest
+// value of the type, so that blocks with no finite pixel leave them untouched.
+
+
+#define INFO_PIXSTATS_KERNELS(TS, PIXTYPE, DTYPE, SUMTYPE, SQTYPE,            \
+                              PIXMIN, PIXMAX, ISFLOAT)                        \
+                                                                              \
+static void pixstats_scan_##TS(                                               \
+    const PIXTYPE *restrict array,                                            \
+    uint64_t                nbpix,                                            \
+    INFO_PIXSTATS          *pixstats                                          \
+)                                                                             \
+{                                                                             \
+    PIXTYPE  vmin = PIXMAX;                                                   \
+    PIXTYPE  vmax = PIXMIN;                                                   \
+    uint64_t ibmin = 0;                                                       \
+    uint64_t ibmax = 0;                                                       \
+    SUMTYPE  total = 0;                                                       \
+    SQTYPE   ssquare = 0;                                                     \
+    uint64_t NBnan = 0;                                                       \
+    uint64_t NBinf = 0;                                                       \
+                                                                              \
+    for(uint64_t ib = 0; ib < nbpix; ib += INFO_PIXSTATS_BLOCKSIZE)           \
+    {                                                                         \
+        uint64_t ie = ib + INFO_PIXSTATS_BLOCKSIZE;                           \
+        if(ie > nbpix)                                                        \
+        {                                                                     \
+            ie = nbpix;                                                       \
+        }                                                                     \
+        PIXTYPE bmin = PIXMAX;                                                \
+        PIXTYPE bmax = PIXMIN;                                                \
+        SUMTYPE btotal = 0;                                                   \
+        SQTYPE  bssquare = 0;                                                 \
+        INFO_PRAGMA_SIMD(reduction(min:bmin) reduction(max:bmax) reduction(+:btotal,bssquare)) \
+        for(uint64_t ii = ib; ii < ie; ii++)                                  \
+        {                                                                     \
+            PIXTYPE v = array[ii];                                            \
+            bmin = (v < bmin) ? v : bmin;                                     \
+            bmax = (v > bmax) ? v : bmax;                                     \
+            btotal += (SUMTYPE) v;                                            \
+            bssquare += (SQTYPE) v * (SQTYPE) v;                              \
+        }                                                                     \
+                                                                              \
+        if(ISFLOAT && !isfinite((double) btotal + (double) bssquare))         \
+        {                                                                     \
+            uint64_t bNBnan = 0;                                              \
+            uint64_t bNBbad = 0;                                              \
+            bmin = PIXMAX;                                                    \
+            bmax = PIXMIN;                                                    \
+            btotal = 0;                                                       \
+            bssquare = 0;                                                     \
+            INFO_PRAGMA_SIMD(reduction(min:bmin) reduction(max:bmax) reduction(+:btotal,bssquare,bNBnan,bNBbad)) \
+            for(uint64_t ii = ib; ii < ie; ii++)                              \
+            {                                                                 \
+                PIXTYPE v = array[ii];                                        \
+                int     ok = isfinite((double) v);                            \
+                PIXTYPE vok = ok ? v : 0;                                     \
+                bmin = (ok && (v < bmin)) ? v : bmin;                         \
+                bmax = (ok && (v > bmax)) ? v : bmax;                         \
+                btotal += (SUMTYPE) vok;                                      \
+                bssquare += (SQTYPE) vok * (SQTYPE) vok;                      \
+                bNBnan += isnan((double) v);                                  \
+                bNBbad += !ok;                                                \
+            }                                                                 \
+            NBnan += bNBnan;                                                  \
+            NBinf += bNBbad - bNBnan;                                         \
+        }                                                                     \
+                                                                              \
+        if(bmin < vmin)                                                       \
+        {                                                                     \
+            vmin = bmin;                                                      \
+            ibmin = ib;                                                       \
+        }                                                                     \
+        if(bmax > vmax)                                                       \
+        {                                                                     \
+            vmax = bmax;                                                      \
+            ibmax = ib;                                                       \
+        }                                                                     \
+        total += btotal;                                                      \
+        ssquare += bssquare;                                                  \
+    }                                                                         \
+                                                                              \
+    while((ibmin < nbpix - 1) && (array[ibmin] != vmin))                      \
+    {                                                                         \
+        ibmin++;                                                              \
+    }                                                                         \
+    while((ibmax < nbpix - 1) && (array[ibmax] != vmax))                      \
+    {                                                                         \
+        ibmax++;                                                              \
+    }                                                                         \
+                                                                              \
+    pixstats->nelement = nbpix;                                               \
+    pixstats->NBnan = NBnan;                                                  \
+    pixstats->NBinf = NBinf;                                                  \
+    pixstats->min = (double) vmin;                                            \
+    pixstats->max = (double) vmax;                                            \
+    pixstats->iimin = ibmin;                                                  \
+    pixstats->iimax = ibmax;                                                  \
+    pixstats->total = (double) total;                                         \
+    pixstats->ssquare = (double) ssquare;                                     \
+}                                                                             \
+                                                                              \
+                                                                              \
+static uint64_t pixstats_copy_double_##TS(                                    \
+    const PIXTYPE *restrict array,                                            \
+    uint64_t                nbpix,                                            \
+    double        *restrict darray                                            \
+)                                                                             \
+{                                                                             \
+    uint64_t nbcopy = 0;                                                      \
+                                                                              \
+    if(ISFLOAT)                                                               \
+    {                                                                         \
+        for(uint64_t ii = 0; ii < nbpix; ii++)                                \
+        {                                                                     \
+            darray[nbcopy] = (double) array[ii];                              \
+            nbcopy += isfinite((double) array[ii]);                           \
+        }                                                                     \
+    }                                                                         \
+    else                                                                      \
+    {                                                                         \
+        for(uint64_t ii = 0; ii < nbpix; ii++)                                \
+        {                                                                     \
+            darray[ii] = (double) array[ii];                                  \
+        }                                                                     \
+        nbcopy = nbpix;                                                       \
+    }                                                                         \
+                                                                              \
+    return nbcopy;                                                            \
+}                                                                             \
+                                                                              \
+                                                                              \
+static double pixstats_sumsqdev_##TS(                                         \
+    const PIXTYPE *restrict array,                                            \
+    uint64_t                nbpix,                                            \
+    double                  center                                            \
+)                                                                             \
+{                                                                             \
+    double sumsq = 0.0;                                                       \
+                                                                              \
+    INFO_PRAGMA_SIMD(reduction(+:sumsq))                                      \
+    for(uint64_t ii = 0; ii < nbpix; ii++)                                    \
+    {                                                                         \
+        double d = (double) array[ii] - center;                               \
+        if(ISFLOAT)                                                           \
+        {                                                                     \
+            d = isfinite(d) ? d : 0.0;                                        \
+        }                                                                     \
+        sumsq += d * d;                                                       \
+    }                                                                         \
+                                                                              \
+    return sumsq;                                                             \
+}
+
+
+INFO_PIXSTATS_TYPELIST(INFO_PIXSTATS_KERNELS)
+
+
+
+#define INFO_PIXSTATS_HISTO_KERNEL(TS, PIXTYPE, DTYPE, NBBIN, BINOFFSET)     \
+                                                                              \
+static void pixstats_histogram_##TS(                                          \
+    const PIXTYPE *restrict array,                                            \
+    uint64_t                nbpix,                                            \
+    uint64_t      *restrict histo                                             \
+)                                                                             \
+{                                                                             \
+    for(uint64_t ii = 0; ii < nbpix; ii++)                                    \
+    {                                                                         \
+        histo[(long) array[ii] + BINOFFSET]++;                                \
+    }                                                                         \
+}
+
+
+INFO_PIXSTATS_HISTO_TYPELIST(INFO_PIXSTATS_HISTO_KERNEL)
+
+
+
+
+/* ================================================================== */
+/*            DATATYPE DISPATCH                                       */
+/* ================================================================== */
+
+
+int info_pixstats_datatype_supported(
+    uint8_t datatype
+)
+{
+    switch(datatype)
+    {
+#define INFO_PIXSTATS_CASE_SUPPORTED(TS, PIXTYPE, DTYPE, ...) \
+        case DTYPE:                                                       \
+            return 1;
+            INFO_PIXSTATS_TYPELIST(INFO_PIXSTATS_CASE_SUPPORTED)
+#undef INFO_PIXSTATS_CASE_SUPPORTED
+
+        default:
+            return 0;
+    }
+}
+
+
+
+
+/**
+ * @brief Set number of threads used by pixel statistics, 0 for default
+ *
+ * Also applies to the other image reductions of this module.
+ */
+errno_t info_pixstats_set_NBthreads(
+    int NBthreads
+)
+{
+    pixstats_NBthreads = NBthreads;
+    if(pixstats_NBthreads < 0)
+    {
+        pixstats_NBthreads = 0;
+    }
+
+    return RETURN_SUCCESS;
+}
+
+
+/**
+ * @brief Thread count setting as passed to info_pixstats_set_NBthreads()
+ *
+ * Used to restore the setting after a call that overrides it.
+ */
+int info_pixstats_get_NBthreads_setting()
+{
+    return pixstats_NBthreads;
+}
+
+
+int info_pixstats_get_NBthreads()
+{
+    int NBthreads = 1;
+
+#ifdef _OPENMP
+    NBthreads = omp_get_max_threads();
+#endif
+    if(pixstats_NBthreads > 0)
+    {
+        NBthreads = pixstats_NBthreads;
+    }
+#ifdef _OPENMP
+    // called from an outer parallel loop, e.g. over cube slices
+    if(omp_in_parallel())
+    {
+        NBthreads = 1;
+    }
+#endif
+
+    return NBthreads;
+}
+
+
+
+
+static errno_t pixstats_scan_span(
+    imageID        ID,
+    uint64_t       offset,
+    uint64_t       nbpix,
+    INFO_PIXSTATS *pixstats
+)
+{
+    switch(data.image[ID].md[0].datatype)
+    {
+#define INFO_PIXSTATS_CASE_SCAN(TS, PIXTYPE, DTYPE, ...)                    \
+        case DTYPE:                                                         \
+            pixstats_scan_##TS(data.image[ID].array.TS + offset, nbpix,     \
+                               pixstats);                                   \
+            break;
+            INFO_PIXSTATS_TYPELIST(INFO_PIXSTATS_CASE_SCAN)
+#undef INFO_PIXSTATS_CASE_SCAN
+
+        default:
+            // unsupported datatype : empty span
+            pixstats->nelement = 0;
+            return RETURN_FAILURE;
+    }
+
+    pixstats->iimin += offset;
+    pixstats->iimax += offset;
+
+    return RETURN_SUCCESS;
+}
+
+
+
+
+/**
+ * @brief Merge pixstats b into a
+ *
+ * b must cover pixels located after those of a, so that ties on extrema
+ * keep the first occurrence.
+ */
+static void pixstats_merge(
+    INFO_PIXSTATS       *a,
+    const INFO_PIXSTATS *b
+)
+{
+    if(b->nelement == 0)
+    {
+        return;
+    }
+    if(a->nelement == 0)
+    {
+        *a = *b;
+        return;
+    }
+
+    if(b->min < a->min)
+    {
+        a->min = b->min;
+        a->iimin = b->iimin;
+    }
+    if(b->max > a->max)
+    {
+        a->max = b->max;
+        a->iimax = b->iimax;
+    }
+    a->nelement += b->nelement;
+    a->NBnan += b->NBnan;
+    a->NBinf += b->NBinf;
+    a->total += b->total;
+    a->ssquare += b->ssquare;
+}
+
+
+
+
+/**
+ * @brief Min, max, total and sum of squares over pixels [offset, offset+nbpix[
+ *
+ * If pixmask is not NULL, only pixels selected by the mask are used, with
+ * span positions relative to offset, and nbpix is ignored.
+ * NaN and Inf pixels are skipped and counted. If no pixel is finite, min and
+ * max are set to NaN.
+ * Returned pixel indices are relative to the start of the image.
+ */
+errno_t info_pixstats_compute(
+    imageID             ID,
+    uint64_t            offset,
+    uint64_t            nbpix,
+    const INFO_PIXMASK *pixmask,
+    INFO_PIXSTATS      *pixstats
+)
+{
+    INFO_PIXMASK rangemask;
+
+    pixstats->nelement = 0;
+    pixstats->NBnan = 0;
+    pixstats->NBinf = 0;
+    pixstats->min = 0.0;
+    pixstats->max = 0.0;
+    pixstats->iimin = offset;
+    pixstats->iimax = offset;
+    pixstats->total = 0.0;
+    pixstats->ssquare = 0.0;
+
+    if(info_pixstats_datatype_supported(data.image[ID].md[0].datatype) == 0)
+    {
+        PRINT_ERROR("datatype %d not supported",
+                    (int) data.image[ID].md[0].datatype);
+        return RETURN_FAILURE;
+    }
+
+    if(pixmask == NULL)
+    {
+        if(nbpix == 0)
+        {
+            return RETURN_SUCCESS;
+        }
+        if(info_pixmask_build_range(&rangemask, nbpix) != RETURN_SUCCESS)
+        {
+            return RETURN_FAILURE;
+        }
+        pixmask = &rangemask;
+    }
+
+    long NBchunk = pixmask->NBchunk;
+    INFO_PIXSTATS *partial = (INFO_PIXSTATS *) calloc(NBchunk + 1,
+                             sizeof(INFO_PIXSTATS));
+    if(partial == NULL)
+    {
+        PRINT_ERROR("calloc error");
+        if(pixmask == &rangemask)
+        {
+            info_pixmask_free(&rangemask);
+        }
+        return RETURN_FAILURE;
+    }
+
+    int NBthreads = info_pixstats_get_NBthreads();
+    (void) NBthreads;
+
+#ifdef _OPENMP
+    #pragma omp parallel for schedule(static) num_threads(NBthreads) if(NBchunk > 1)
+#endif
+    for(long chunk = 0; chunk < NBchunk; chunk++)
+    {
+        for(long spanindex = pixmask->chunkspan[chunk];
+                spanindex < pixmask->chunkspan[chunk + 1]; spanindex++)
+        {
+            INFO_PIXSTATS spanstats;
+
+            pixstats_scan_span(ID, offset + pixmask->span[spanindex].start,
+                               pixmask->span[spanindex].length, &spanstats);
+            pixstats_merge(&partial[chunk], &spanstats);
+        }
+    }
+
+    // pairwise combination, fixed order
+    for(long stride = 1; stride < NBchunk; stride *= 2)
+    {
+        for(long chunk = 0; chunk + stride < NBchunk; chunk += 2 * stride)
+        {
+            pixstats_merge(&partial[chunk], &partial[chunk + stride]);
+        }
+    }
+    if(partial[0].nelement > 0)
+    {
+        *pixstats = partial[0];
+    }
+
+    free(partial);
+    if(pixmask == &rangemask)
+    {
+        info_pixmask_free(&rangemask);
+    }
+
+    if(pixstats->NBnan + pixstats->NBinf == pixstats->nelement)
+    {
+        pixstats->min = NAN;
+        pixstats->max = NAN;
+    }
+
+    return RETURN_SUCCESS;
+}
+
+
+
+
+/**
+ * @brief Sum of squared deviations from center of pixels [offset, offset+nbpix[
+ *
+ * Second pass of a two-pass variance, center being the mean : unlike
+ * ssquare/N - mean^2, does not lose precision on images with a large
+ * offset. If pixmask is not NULL, only selected pixels are used.
+ * NaN and Inf pixels are skipped. Result does not depend on thread count.
+ */
+errno_t info_pixstats_sumsqdev(
+    imageID             ID,
+    uint64_t            offset,
+    uint64_t            nbpix,
+    const INFO_PIXMASK *pixmask,
+    double              center,
+    double             *sumsqdev
+)
+{
+    INFO_PIXMASK rangemask;
+
+    *sumsqdev = 0.0;
+
+    if(info_pixstats_datatype_supported(data.image[ID].md[0].datatype) == 0)
+    {
+        PRINT_ERROR("datatype %d not supported",
+                    (int) data.image[ID].md[0].datatype);
+        return RETURN_FAILURE;
+    }
+
+    if(pixmask == NULL)
+    {
+        if(nbpix == 0)
+        {
+            return RETURN_SUCCESS;
+        }
+        if(info_pixmask_build_range(&rangemask, nbpix) != RETURN_SUCCESS)
+        {
+            return RETURN_FAILURE;
+        }
+        pixmask = &rangemask;
+    }
+
+    long NBchunk = pixmask->NBchunk;
+    double *partial = (double *) calloc(NBchunk + 1, sizeof(double));
+    if(partial == NULL)
+    {
+        PRINT_ERROR("calloc error");
+        if(pixmask == &rangemask)
+        {
+            info_pixmask_free(&rangemask);
+        }
+        return RETURN_FAILURE;
+    }
+
+    int NBthreads = info_pixstats_get_NBthreads();
+    (void) NBthreads;
+
+#ifdef _OPENMP
+    #pragma omp parallel for schedule(static) num_threads(NBthreads) if(NBchunk > 1)
+#endif
+    for(long chunk = 0; chunk < NBchunk; chunk++)
+    {
+        for(long spanindex = pixmask->chunkspan[chunk];
+                spanindex < pixmask->chunkspan[chunk + 1]; spanindex++)
+        {
+            uint64_t spanoffset = offset + pixmask->span[spanindex].start;
+            uint64_t spanlength = pixmask->span[spanindex].length;
+
+            switch(data.image[ID].md[0].datatype)
+            {
+#define INFO_PIXSTATS_CASE_SUMSQDEV(TS, PIXTYPE, DTYPE, ...)                      \
+                case DTYPE:                                                       \
+                    partial[chunk] += pixstats_sumsqdev_##TS(                     \
+                                          data.image[ID].array.TS + spanoffset,   \
+                                          spanlength, center);                    \
+                    break;
+                    INFO_PIXSTATS_TYPELIST(INFO_PIXSTATS_CASE_SUMSQDEV)
+#undef INFO_PIXSTATS_CASE_SUMSQDEV
+            }
+        }
+    }
+
+    // pairwise combination, fixed order
+    for(long stride = 1; stride < NBchunk; stride *= 2)
+    {
+        for(long chunk = 0; chunk + stride < NBchunk; chunk += 2 * stride)
+        {
+            partial[chunk] += partial[chunk + stride];
+        }
+    }
+    *sumsqdev = partial[0];
+
+    free(partial);
+    if(pixmask == &rangemask)
+    {
+        info_pixmask_free(&rangemask);
+    }
+
+    return RETURN_SUCCESS;
+}
+
+
+
+
+static uint64_t pixstats_copy_span(
+    imageID   ID,
+    uint64_t  offset,
+    uint64_t  nbpix,
+    double   *array
+)
+{
+    uint64_t nbcopy = 0;
+
+    switch(data.image[ID].md[0].datatype)
+    {
+#define INFO_PIXSTATS_CASE_COPY(TS, PIXTYPE, DTYPE, ...)                    \
+        case DTYPE:                                                         \
+            nbcopy = pixstats_copy_double_##TS(data.image[ID].array.TS +    \
+                                               offset, nbpix, array);       \
+            break;
+            INFO_PIXSTATS_TYPELIST(INFO_PIXSTATS_CASE_COPY)
+#undef INFO_PIXSTATS_CASE_COPY
+    }
+
+    return nbcopy;
+}
+
+
+
+
+/**
+ * @brief Copy finite pixels of [offset, offset+nbpix[ to a double array
+ *
+ * If pixmask is not NULL, only selected pixels are copied (see
+ * info_pixstats_compute). NaN and Inf pixels are not copied. Number of
+ * values written to array is returned in nbcopy.
+ */
+errno_t info_pixstats_copy_double(
+    imageID             ID,
+    uint64_t            offset,
+    uint64_t            nbpix,
+    const INFO_PIXMASK *pixmask,
+    double             *array,
+    uint64_t           *nbcopy
+)
+{
+    *nbcopy = 0;
+
+    if(info_pixstats_datatype_supported(data.image[ID].md[0].datatype) == 0)
+    {
+        PRINT_ERROR("datatype %d not supported",
+                    (int) data.image[ID].md[0].datatype);
+        return RETURN_FAILURE;
+    }
+
+    if(pixmask == NULL)
+    {
+        *nbcopy = pixstats_copy_span(ID, offset, nbpix, array);
+    }
+    else
+    {
+        for(long spanindex = 0; spanindex < pixmask->NBspan; spanindex++)
+        {
+            *nbcopy += pixstats_copy_span(ID, offset + pixmask->span[spanindex].start,
+                                          pixmask->span[spanindex].length, array + *nbcopy);
+        }
+    }
+
+    return RETURN_SUCCESS;
+}
+
+
+
+
+int info_pixstats_histo_supported(
+    uint8_t datatype
+)
+{
+    switch(datatype)
+    {
+#define INFO_PIXSTATS_CASE_HISTO_SUPPORTED(TS, PIXTYPE, DTYPE, NBBIN, BINOFFSET) \
+        case DTYPE:                                                              \
+            return 1;
+            INFO_PIXSTATS_HISTO_TYPELIST(INFO_PIXSTATS_CASE_HISTO_SUPPORTED)
+#undef INFO_PIXSTATS_CASE_HISTO_SUPPORTED
+
+        default:
+            return 0;
+    }
+}
+
+
+
+
+/**
+ * @brief Exact percentiles of pixels [offset, offset+nbpix[ from a counting histogram
+ *
+ * Only for 8- and 16-bit integer images, see info_pixstats_histo_supported().
+ * If pixmask is not NULL, only selected pixels are used (see
+ * info_pixstats_compute).
+ * values[k] is the pixel value of rank (long)(p[k]*N) in the sorted list of
+ * the N pixels, as would be read from a sorted copy of the pixels.
+ *
+ * Each thread fills its own histogram over a set of chunks; histograms are
+ * summed at the end.
+ */
+errno_t info_pixstats_histo_percentiles(
+    imageID             ID,
+    uint64_t            offset,
+    uint64_t            nbpix,
+    const INFO_PIXMASK *pixmask,
+    const double       *p,
+    long                NBp,
+    double             *values
+)
+{
+    long         NBbin;
+    long         binoffset;
+    INFO_PIXMASK rangemask;
+
+    switch(data.image[ID].md[0].datatype)
+    {
+#define INFO_PIXSTATS_CASE_HISTO_SIZE(TS, PIXTYPE, DTYPE, NBBIN, BINOFFSET) \
+        case DTYPE:                                                         \
+            NBbin = NBBIN;                                                  \
+            binoffset = BINOFFSET;                                          \
+            break;
+            INFO_PIXSTATS_HISTO_TYPELIST(INFO_PIXSTATS_CASE_HISTO_SIZE)
+#undef INFO_PIXSTATS_CASE_HISTO_SIZE
+
+        default:
+            PRINT_ERROR("datatype %d has no counting histogram",
+                        (int) data.image[ID].md[0].datatype);
+            return RETURN_FAILURE;
+    }
+
+    if(pixmask == NULL)
+    {
+        if(info_pixmask_build_range(&rangemask, nbpix) != RETURN_SUCCESS)
+        {
+            return RETURN_FAILURE;
+        }
+        pixmask = &rangemask;
+    }
+    nbpix = pixmask->NBpix;
+
+    if(nbpix == 0)
+    {
+        for(long k = 0; k < NBp; k++)
+        {
+            values[k] = NAN;
+        }
+        if(pixmask == &rangemask)
+        {
+            info_pixmask_free(&rangemask);
+        }
+        return RETURN_SUCCESS;
+    }
+
+    long NBchunk = pixmask->NBchunk;
+    int NBthreads = info_pixstats_get_NBthreads();
+    if(NBthreads > NBchunk)
+    {
+        NBthreads = NBchunk;
+    }
+
+    uint64_t *histo = (uint64_t *) calloc((size_t) NBbin * NBthreads,
+                                          sizeof(uint64_t));
+    if(histo == NULL)
+    {
+        PRINT_ERROR("calloc error");
+        if(pixmask == &rangemask)
+        {
+            info_pixmask_free(&rangemask);
+        }
+        return RETURN_FAILURE;
+    }
+
+#ifdef _OPENMP
+    #pragma omp parallel num_threads(NBthreads)
+#endif
+    {
+        int thread = 0;
+#ifdef _OPENMP
+        thread = omp_get_thread_num();
+#endif
+        uint64_t *thisto = histo + (size_t) NBbin * thread;
+
+#ifdef _OPENMP
+        #pragma omp for schedule(static)
+#endif
+        for(long chunk = 0; chunk < NBchunk; chunk++)
+        {
+            for(long spanindex = pixmask->chunkspan[chunk];
+                    spanindex < pixmask->chunkspan[chunk + 1]; spanindex++)
+            {
+                uint64_t spanoffset = offset + pixmask->span[spanindex].start;
+                uint64_t spanlength = pixmask->span[spanindex].length;
+
+                switch(data.image[ID].md[0].datatype)
+                {
+#define INFO_PIXSTATS_CASE_HISTO(TS, PIXTYPE, DTYPE, NBBIN, BINOFFSET)               \
+                    case DTYPE:                                                      \
+                        pixstats_histogram_##TS(data.image[ID].array.TS + spanoffset, \
+                                                spanlength, thisto);                 \
+                        break;
+                        INFO_PIXSTATS_HISTO_TYPELIST(INFO_PIXSTATS_CASE_HISTO)
+#undef INFO_PIXSTATS_CASE_HISTO
+                }
+            }
+        }
+    }
+
+    if(pixmask == &rangemask)
+    {
+        info_pixmask_free(&rangemask);
+    }
+
+    // merge per-thread histograms and integrate
+    for(int thread = 1; thread < NBthreads; thread++)
+    {
+        uint64_t *thisto = histo + (size_t) NBbin * thread;
+        for(long bin = 0; bin < NBbin; bin++)
+        {
+            histo[bin] += thisto[bin];
+        }
+    }
+    for(long bin = 1; bin < NBbin; bin++)
+    {
+        histo[bin] += histo[bin - 1];
+    }
+
+    for(long k = 0; k < NBp; k++)
+    {
+        uint64_t rank = 0;
+        if(p[k] > 0.0)
+        {
+            rank = (uint64_t)(p[k] * nbpix);
+        }
+        if(rank > nbpix - 1)
+        {
+            rank = nbpix - 1;
+        }
+
+        // first bin with cumulative count > rank
+        long binlow = 0;
+        long binhigh = NBbin - 1;
+        while(binlow < binhigh)
+        {
+            long binmid = (binlow + binhigh) / 2;
+            if(histo[binmid] > rank)
+            {
+                binhigh = binmid;
+            }
+            else
+            {
+                binlow = binmid + 1;
+            }
+        }
+        values[k] = (double)(binlow - binoffset);
+    }
+
+    free(histo);
+
+    return RETURN_SUCCESS;
+}
@@ -0,0 +1,114 @@
+/**
+ * @file    pixstats.h
+ * @brief   Datatype-specialized pixel statistics kernels
+ *
+ */
+
+#if !defined(INFO_PIXSTATS_H)
+#define INFO_PIXSTATS_H
+
+#include "info/pixmask.h"
+
+
+// Unit of work distributed to threads, and of the pairwise combination.
+// Must not depend on the number of threads.
+#define INFO_PIXSTATS_CHUNKSIZE 65536
+
+
+// Vectorization hint for the inner loops, argument is the clause list.
+// Expands to nothing when built without OpenMP.
+#define INFO_PRAGMA_STR(x) #x
+#ifdef _OPENMP
+#define INFO_PRAGMA_SIMD(x) _Pragma(INFO_PRAGMA_STR(omp simd x))
+#else
+#define INFO_PRAGMA_SIMD(x)
+#endif
+
+
+
+// Datatypes handled by the kernels
+// columns : array suffix, pixel type, datatype code, sum type, square sum type,
+//           lowest value, highest value, floating point flag
+//
+#define INFO_PIXSTATS_TYPELIST(X)                                                    \
+    X(UI8,  uint8_t,  _DATATYPE_UINT8,  int64_t, uint64_t, 0,          UINT8_MAX,  0) \
+    X(SI8,  int8_t,   _DATATYPE_INT8,   int64_t, int64_t,  INT8_MIN,   INT8_MAX,   0) \
+    X(UI16, uint16_t, _DATATYPE_UINT16, int64_t, uint64_t, 0,          UINT16_MAX, 0) \
+    X(SI16, int16_t,  _DATATYPE_INT16,  int64_t, int64_t,  INT16_MIN,  INT16_MAX,  0) \
+    X(UI32, uint32_t, _DATATYPE_UINT32, int64_t, double,   0,          UINT32_MAX, 0) \
+    X(SI32, int32_t,  _DATATYPE_INT32,  int64_t, double,   INT32_MIN,  INT32_MAX,  0) \
+    X(UI64, uint64_t, _DATATYPE_UINT64, double,  double,   0,          UINT64_MAX, 0) \
+    X(SI64, int64_t,  _DATATYPE_INT64,  double,  double,   INT64_MIN,  INT64_MAX,  0) \
+    X(F,    float,    _DATATYPE_FLOAT,  double,  double,   -HUGE_VALF, HUGE_VALF,  1) \
+    X(D,    double,   _DATATYPE_DOUBLE, double,  double,   -HUGE_VAL,  HUGE_VAL,   1)
+
+
+typedef struct
+{
+    uint64_t  nelement;   // number of pixels scanned
+    uint64_t  NBnan;      // number of NaN pixels, excluded from statistics
+    uint64_t  NBinf;      // number of +/-Inf pixels, excluded from statistics
+    double    min;
+    double    max;
+    uint64_t  iimin;      // pixel index of first minimum
+    uint64_t  iimax;      // pixel index of first maximum
+    double    total;      // sum of pixel values
+    double    ssquare;    // sum of squared pixel values
+} INFO_PIXSTATS;
+
+
+
+int info_pixstats_datatype_supported(
+    uint8_t datatype
+);
+
+errno_t info_pixstats_set_NBthreads(
+    int NBthreads
+);
+
+int info_pixstats_get_NBthreads_setting();
+
+int info_pixstats_get_NBthreads();
+
+errno_t info_pixstats_compute(
+    imageID             ID,
+    uint64_t            offset,
+    uint64_t            nbpix,
+    const INFO_PIXMASK *pixmask,
+    INFO_PIXSTATS      *pixstats
+);
+
+errno_t info_pixstats_sumsqdev(
+    imageID             ID,
+    uint64_t            offset,
+    uint64_t            nbpix,
+    const INFO_PIXMASK *pixmask,
+    double              center,
+    double             *sumsqdev
+);
+
+errno_t info_pixstats_copy_double(
+    imageID             ID,
+    uint64_t            offset,
+    uint64_t            nbpix,
+    const INFO_PIXMASK *pixmask,
+    double             *array,
+    uint64_t           *nbcopy
+);
+
+int info_pixstats_histo_supported(
+    uint8_t datatype
+);
+
+errno_t info_pixstats_histo_percentiles(
+    imageID             ID,
+    uint64_t            offset,
+    uint64_t            nbpix,
+    const INFO_PIXMASK *pixmask,
+    const double       *p,
+    long                NBp,
+    double             *values
+);
+
+
+#endif
@@ -0,0 +1,322 @@
+/**
+ * @file    robust.c
+ * @brief   Robust statistics : median, MAD, interquartile range, percentiles
+ *
+ * Finite pixel values are copied once to a scratch buffer, then order
+ * statistics are obtained by linear-time selection (select.c) instead of a
+ * full sort. The median selection partitions the buffer, so quartiles are
+ * selected within each half only. The MAD is the median of the absolute
+ * deviations, computed in place in the same buffer.
+ *
+ * The order statistic of fraction p is the element of rank (long)(p*N),
+ * as for percentiles in info_image_stats.
+ *
+ * Any number of percentiles of any supported datatype are obtained from a
+ * single scratch copy by info_robust_percentiles : 8- and 16-bit images
+ * are read from a counting histogram, other types by a multi-rank
+ * selection (info_select_percentiles_double).
+ *
+ */
+
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <math.h>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+#include "CommandLineInterface/CLIcore.h"
+#include "COREMOD_memory/COREMOD_memory.h"
+
+#include "info/pixstats.h"
+#include "info/pixmask.h"
+#include "info/select.h"
+#include "info/robust.h"
+
+
+
+
+/**
+ * @brief Median, MAD and quartiles of pixels [offset, offset+nbpix[
+ *
+ * If pixmask is not NULL, only pixels selected by the mask are used (see
+ * info_pixstats_compute). NaN and Inf pixels are ignored.
+ * scratch must hold the number of pixels scanned, or be NULL to be
+ * allocated internally.
+ */
+errno_t info_robust_compute(
+    imageID             ID,
+    uint64_t            offset,
+    uint64_t            nbpix,
+    const INFO_PIXMASK *pixmask,
+    double             *scratch,
+    INFO_ROBUST        *robust
+)
+{
+    double  *buffer = scratch;
+    uint64_t n;
+
+    robust->NBpix = 0;
+    robust->median = NAN;
+    robust->mad = NAN;
+    robust->sigma = NAN;
+    robust->q1 = NAN;
+    robust->q3 = NAN;
+    robust->iqr = NAN;
+
+    if(info_pixstats_datatype_supported(data.image[ID].md[0].datatype) == 0)
+    {
+        PRINT_ERROR("datatype %d not supported",
+                    (int) data.image[ID].md[0].datatype);
+        return RETURN_FAILURE;
+    }
+
+    if(buffer == NULL)
+    {
+        uint64_t nbmax = (pixmask == NULL) ? nbpix : pixmask->NBpix;
+        buffer = (double *) malloc(sizeof(double) * (nbmax + 1));
+        if(buffer == NULL)
+        {
+            PRINT_ERROR("malloc error");
+            return RETURN_FAILURE;
+        }
+    }
+
+    info_pixstats_copy_double(ID, offset, nbpix, pixmask, buffer, &n);
+
+    if(n > 0)
+    {
+        uint64_t k2 = n / 2;
+        uint64_t k1 = (uint64_t)(0.25 * n);
+        uint64_t k3 = (uint64_t)(0.75 * n);
+
+        robust->NBpix = n;
+        robust->median = info_select_double(buffer, n, k2);
+
+        // [0, k2[ <= median <= ]k2, n[
+        robust->q1 = robust->median;
+        if(k1 < k2)
+        {
+            robust->q1 = info_select_double(buffer, k2, k1);
+        }
+        robust->q3 = robust->median;
+        if(k3 > k2)
+        {
+            robust->q3 = info_select_double(buffer + k2 + 1, n - k2 - 1, k3 - k2 - 1);
+        }
+        robust->iqr = robust->q3 - robust->q1;
+
+        double median = robust->median;
+        INFO_PRAGMA_SIMD()
+        for(uint64_t i = 0; i < n; i++)
+        {
+            buffer[i] = fabs(buffer[i] - median);
+        }
+        robust->mad = info_select_double(buffer, n, k2);
+        robust->sigma = 1.4826 * robust->mad;
+    }
+
+    if(scratch == NULL)
+    {
+        free(buffer);
+    }
+
+    return RETURN_SUCCESS;
+}
+
+
+
+
+/**
+ * @brief Percentiles of pixels [offset, offset+nbpix[
+ *
+ * values[k] is the value of rank (long)(p[k]*N) among the N finite pixels
+ * (selected by pixmask if not NULL) sorted in increasing order, or NaN if
+ * there is no finite pixel. Image is not modified.
+ */
+errno_t info_robust_percentiles(
+    imageID             ID,
+    uint64_t            offset,
+    uint64_t            nbpix,
+    const INFO_PIXMASK *pixmask,
+    const double       *p,
+    long                NBp,
+    double             *values
+)
+{
+    uint8_t  datatype = data.image[ID].md[0].datatype;
+    double  *buffer;
+    uint64_t n;
+
+    if(info_pixstats_datatype_supported(datatype) == 0)
+    {
+        PRINT_ERROR("datatype %d not supported", (int) datatype);
+        return RETURN_FAILURE;
+    }
+
+    if(info_pixstats_histo_supported(datatype) == 1)
+    {
+        return info_pixstats_histo_percentiles(ID, offset, nbpix, pixmask, p, NBp,
+                                               values);
+    }
+
+    uint64_t nbmax = (pixmask == NULL) ? nbpix : pixmask->NBpix;
+    buffer = (double *) malloc(sizeof(double) * (nbmax + 1));
+    if(buffer == NULL)
+    {
+        PRINT_ERROR("malloc error");
+        return RETURN_FAILURE;
+    }
+
+    info_pixstats_copy_double(ID, offset, nbpix, pixmask, buffer, &n);
+
+    errno_t ret = RETURN_SUCCESS;
+    if(n > 0)
+    {
+        ret = info_select_percentiles_double(buffer, n, p, NBp, values);
+        if(ret != RETURN_SUCCESS)
+        {
+            PRINT_ERROR("malloc error");
+        }
+    }
+    else
+    {
+        for(long k = 0; k < NBp; k++)
+        {
+            values[k] = NAN;
+        }
+    }
+
+    free(buffer);
+
+    return ret;
+}
+
+
+
+
+errno_t info_image_robust(
+    const char  *ID_name,
+    INFO_ROBUST *robust
+)
+{
+    imageID ID;
+
+    ID = image_ID(ID_name);
+    if(ID == -1)
+    {
+        PRINT_ERROR("image %s not found", ID_name);
+        return RETURN_FAILURE;
+    }
+
+    return info_robust_compute(ID, 0, data.image[ID].md[0].nelement, NULL, NULL,
+                               robust);
+}
+
+
+
+
+/**
+ * @brief Per-slice robust statistics table of a 3D image
+ *
+ * Output is a 2D double image of size INFO_ROBUST_NBSTAT x zsize, row kk
+ * holding the statistics of slice kk (see robust.h for columns).
+ * Slices are processed in parallel, with one scratch buffer per thread.
+ */
+imageID info_image_robust_slices(
+    const char *ID_name,
+    const char *IDout_name
+)
+{
+    imageID   ID;
+    imageID   IDout;
+    uint32_t  zsize;
+    uint64_t  xysize;
+
+    ID = image_ID(ID_name);
+    if(ID == -1)
+    {
+        PRINT_ERROR("image %s not found", ID_name);
+        return -1;
+    }
+    if(info_pixstats_datatype_supported(data.image[ID].md[0].datatype) == 0)
+    {
+        PRINT_ERROR("datatype %d not supported",
+                    (int) data.image[ID].md[0].datatype);
+        return -1;
+    }
+
+    xysize = (uint64_t) data.image[ID].md[0].size[0] * data.image[ID].md[0].size[1];
+    zsize = 1;
+    if(data.image[ID].md[0].naxis == 3)
+    {
+        zsize = data.image[ID].md[0].size[2];
+    }
+
+    IDout = create_2Dimage_ID_double(IDout_name, INFO_ROBUST_NBSTAT, zsize);
+    if(IDout == -1)
+    {
+        PRINT_ERROR("cannot create image %s", IDout_name);
+        return -1;
+    }
+
+    int NBthreads = info_pixstats_get_NBthreads();
+    (void) NBthreads;
+    int allocerr = 0;
+
+#ifdef _OPENMP
+    #pragma omp parallel num_threads(NBthreads)
+#endif
+    {
+        double *scratch = (double *) malloc(sizeof(double) * xysize);
+        if(scratch == NULL)
+        {
+            PRINT_ERROR("malloc error");
+#ifdef _OPENMP
+            #pragma omp atomic write
+#endif
+            allocerr = 1;
+        }
+
+#ifdef _OPENMP
+        #pragma omp for schedule(dynamic)
+#endif
+        for(uint32_t kk = 0; kk < zsize; kk++)
+        {
+            int skip;
+#ifdef _OPENMP
+            #pragma omp atomic read
+#endif
+            skip = allocerr;
+            if(skip)
+            {
+                continue;
+            }
+
+            INFO_ROBUST robust;
+            double *statrow = data.image[IDout].array.D + (uint64_t) kk * INFO_ROBUST_NBSTAT;
+
+            info_robust_compute(ID, (uint64_t) kk * xysize, xysize, NULL, scratch, &robust);
+            statrow[INFO_ROBUST_MEDIAN] = robust.median;
+            statrow[INFO_ROBUST_MAD] = robust.mad;
+            statrow[INFO_ROBUST_SIGMA] = robust.sigma;
+            statrow[INFO_ROBUST_Q1] = robust.q1;
+            statrow[INFO_ROBUST_Q3] = robust.q3;
+            statrow[INFO_ROBUST_IQR] = robust.iqr;
+            statrow[INFO_ROBUST_NBPIX] = (double) robust.NBpix;
+        }
+
+        free(scratch);
+    }
+
+    if(allocerr)
+    {
+        delete_image_ID(IDout_name);
+        return -1;
+    }
+
+    return IDout;
+}
@@ -0,0 +1,67 @@
+/**
+ * @file    robust.h
+ * @brief   Robust statistics : median, MAD, interquartile range, percentiles
+ *
+ */
+
+#if !defined(INFO_ROBUST_H)
+#define INFO_ROBUST_H
+
+#include "info/pixmask.h"
+
+
+typedef struct
+{
+    uint64_t  NBpix;    // number of finite pixels
+    double    median;
+    double    mad;      // median absolute deviation from median
+    double    sigma;    // gaussian-equivalent sigma, 1.4826 x MAD
+    double    q1;       // first and third quartiles
+    double    q3;
+    double    iqr;      // q3 - q1
+} INFO_ROBUST;
+
+
+// columns of the per-slice robust statistics table
+#define INFO_ROBUST_MEDIAN  0
+#define INFO_ROBUST_MAD     1
+#define INFO_ROBUST_SIGMA   2
+#define INFO_ROBUST_Q1      3
+#define INFO_ROBUST_Q3      4
+#define INFO_ROBUST_IQR     5
+#define INFO_ROBUST_NBPIX   6
+#define INFO_ROBUST_NBSTAT  7
+
+
+
+errno_t info_robust_compute(
+    imageID             ID,
+    uint64_t            offset,
+    uint64_t            nbpix,
+    const INFO_PIXMASK *pixmask,
+    double             *scratch,
+    INFO_ROBUST        *robust
+);
+
+errno_t info_robust_percentiles(
+    imageID             ID,
+    uint64_t            offset,
+    uint64_t            nbpix,
+    const INFO_PIXMASK *pixmask,
+    const double       *p,
+    long                NBp,
+    double             *values
+);
+
+errno_t info_image_robust(
+    const char  *ID_name,
+    INFO_ROBUST *robust
+);
+
+imageID info_image_robust_slices(
+    const char *ID_name,
+    const char *IDout_name
+);
+
+
+#endif
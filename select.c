@@ -0,0 +1,248 @@
+/**
+ * @file    select.c
+ * @brief   Linear-time selection of order statistics
+ *
+ * Quickselect with median-of-three pivot (ninther for large partitions),
+ * finishing with insertion sort on short ranges. Average cost is linear
+ * in the number of elements, against N log N for a full sort.
+ *
+ * On return array[k] is the k-th smallest element, elements before k are
+ * not larger and elements after k are not smaller. Subsequent selections
+ * can therefore be restricted to either side of k.
+ *
+ * Several order statistics are selected together by selecting the middle
+ * requested rank, then recursing on each side with the ranks it holds :
+ * cost is N log M for M ranks, from the same array.
+ *
+ * Arrays must not contain NaN.
+ *
+ */
+
+
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "CommandLineInterface/CLIcore.h"
+
+#include "info/select.h"
+
+
+
+
+// ranges up to this size are finished by insertion sort
+#define INFO_SELECT_SMALL 16
+
+// ranges above this size use the ninther as pivot
+#define INFO_SELECT_NINTHER 1024
+
+
+
+#define INFO_SELECT_FUNC(TYPE, SUFFIX)                                        \
+                                                                              \
+static inline uint64_t select_median3_##SUFFIX(                               \
+    const TYPE *array,                                                        \
+    uint64_t    a,                                                            \
+    uint64_t    b,                                                            \
+    uint64_t    c                                                             \
+)                                                                             \
+{                                                                             \
+    if(array[a] < array[b])                                                   \
+    {                                                                         \
+        if(array[b] < array[c])                                               \
+        {                                                                     \
+            return b;                                                         \
+        }                                                                     \
+        return (array[a] < array[c]) ? c : a;                                 \
+    }                                                                         \
+    if(array[a] < array[c])                                                   \
+    {                                                                         \
+        return a;                                                             \
+    }                                                                         \
+    return (array[b] < array[c]) ? c : b;                                     \
+}                                                                             \
+                                                                              \
+TYPE info_select_##SUFFIX(                                                    \
+    TYPE     *array,                                                          \
+    uint64_t  n,                                                              \
+    uint64_t  k                                                               \
+)                                                                             \
+{                                                                             \
+    uint64_t left = 0;                                                        \
+    uint64_t right = n - 1;                                                   \
+                                                                              \
+    while(right - left > INFO_SELECT_SMALL)                                   \
+    {                                                                         \
+        uint64_t mid = left + (right - left) / 2;                             \
+        uint64_t ipiv;                                                        \
+                                                                              \
+        if(right - left > INFO_SELECT_NINTHER)                                \
+        {                                                                     \
+            uint64_t s = (right - left) / 8;                                  \
+            ipiv = select_median3_##SUFFIX(array,                             \
+                   select_median3_##SUFFIX(array, left, left + s, left + 2 * s), \
+                   select_median3_##SUFFIX(array, mid - s, mid, mid + s),     \
+                   select_median3_##SUFFIX(array, right - 2 * s, right - s, right)); \
+        }                                                                     \
+        else                                                                  \
+        {                                                                     \
+            ipiv = select_median3_##SUFFIX(array, left, mid, right);          \
+        }                                                                     \
+                                                                              \
+        TYPE pivot = array[ipiv];                                             \
+        TYPE tmp;                                                             \
+                                                                              \
+        /* Hoare partition */                                                 \
+        uint64_t i = left;                                                    \
+        uint64_t j = right;                                                   \
+        for(;;)                                                               \
+        {                                                                     \
+            while(array[i] < pivot)                                           \
+            {                                                                 \
+                i++;                                                          \
+            }                                                                 \
+            while(pivot < array[j])                                           \
+            {                                                                 \
+                j--;                                                          \
+            }                                                                 \
+            if(i >= j)                                                        \
+            {                                                                 \
+                break;                                                        \
+            }                                                                 \
+            tmp = array[i];                                                   \
+            array[i] = array[j];                                              \
+            array[j] = tmp;                                                   \
+            i++;                                                              \
+            j--;                                                              \
+        }                                                                     \
+                                                                              \
+        /* [left, j] <= pivot <= [j+1, right] */                              \
+        if(k <= j)                                                            \
+        {                                                                     \
+            right = j;                                                        \
+        }                                                                     \
+        else                                                                  \
+        {                                                                     \
+            left = j + 1;                                                     \
+        }                                                                     \
+    }                                                                         \
+                                                                              \
+    for(uint64_t i = left + 1; i <= right; i++)                               \
+    {                                                                         \
+        TYPE v = array[i];                                                    \
+        uint64_t j = i;                                                       \
+        while((j > left) && (v < array[j - 1]))                               \
+        {                                                                     \
+            array[j] = array[j - 1];                                          \
+            j--;                                                              \
+        }                                                                     \
+        array[j] = v;                                                         \
+    }                                                                         \
+                                                                              \
+    return array[k];                                                          \
+}
+
+
+INFO_SELECT_FUNC(double, double)
+INFO_SELECT_FUNC(float, float)
+
+
+
+
+// select sorted distinct ranks rank[0..NBrank-1] within array[lo, hi[
+static void select_ranks_double(
+    double         *array,
+    uint64_t        lo,
+    uint64_t        hi,
+    const uint64_t *rank,
+    long            NBrank
+)
+{
+    while(NBrank > 0)
+    {
+        long     mid = NBrank / 2;
+        uint64_t r = rank[mid];
+
+        info_select_double(array + lo, hi - lo, r - lo);
+
+        // lower ranks in [lo, r[ , higher ranks in ]r, hi[
+        select_ranks_double(array, lo, r, rank, mid);
+        lo = r + 1;
+        rank += mid + 1;
+        NBrank -= mid + 1;
+    }
+}
+
+
+
+
+static int select_cmp_uint64(
+    const void *a,
+    const void *b
+)
+{
+    uint64_t x = *(const uint64_t *) a;
+    uint64_t y = *(const uint64_t *) b;
+
+    return (x > y) - (x < y);
+}
+
+
+
+
+/**
+ * @brief Percentiles of array, from a single multi-rank selection
+ *
+ * values[k] is the element of rank (uint64_t)(p[k]*n), clamped to
+ * [0, n-1]. Array is reordered. n must be > 0.
+ */
+errno_t info_select_percentiles_double(
+    double       *array,
+    uint64_t      n,
+    const double *p,
+    long          NBp,
+    double       *values
+)
+{
+    uint64_t *rank = (uint64_t *) malloc(sizeof(uint64_t) * (NBp + 1));
+    uint64_t *srank = (uint64_t *) malloc(sizeof(uint64_t) * (NBp + 1));
+    if((rank == NULL) || (srank == NULL))
+    {
+        free(rank);
+        free(srank);
+        return RETURN_FAILURE;
+    }
+
+    for(long k = 0; k < NBp; k++)
+    {
+        double r = p[k] * n;
+        if(!(r > 0.0))
+        {
+            r = 0.0;
+        }
+        rank[k] = (r >= (double)(n - 1)) ? n - 1 : (uint64_t) r;
+        srank[k] = rank[k];
+    }
+
+    // distinct ranks, increasing
+    qsort(srank, NBp, sizeof(uint64_t), select_cmp_uint64);
+    long NBrank = 0;
+    for(long k = 0; k < NBp; k++)
+    {
+        if((NBrank == 0) || (srank[k] != srank[NBrank - 1]))
+        {
+            srank[NBrank++] = srank[k];
+        }
+    }
+
+    select_ranks_double(array, 0, n, srank, NBrank);
+
+    for(long k = 0; k < NBp; k++)
+    {
+        values[k] = array[rank[k]];
+    }
+
+    free(rank);
+    free(srank);
+
+    return RETURN_SUCCESS;
+}
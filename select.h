@@ -0,0 +1,32 @@
+/**
+ * @file    select.h
+ * @brief   Linear-time selection of order statistics
+ *
+ */
+
+#if !defined(INFO_SELECT_H)
+#define INFO_SELECT_H
+
+
+double info_select_double(
+    double   *array,
+    uint64_t  n,
+    uint64_t  k
+);
+
+float info_select_float(
+    float    *array,
+    uint64_t  n,
+    uint64_t  k
+);
+
+errno_t info_select_percentiles_double(
+    double       *array,
+    uint64_t      n,
+    const double *p,
+    long          NBp,
+    double       *values
+);
+
+
+#endif
@@ -0,0 +1,666 @@
+/**
+ * @file    sigclip.c
+ * @brief   Sigma-clipped statistics
+ *
+ * Iterative sigma clipping : pixels outside mean +/- nsigma.rms are
+ * rejected, and mean and rms are recomputed from the kept pixels until the
+ * set of kept pixels no longer changes.
+ *
+ * Rather than rescanning the image at each iteration, pixels are binned
+ * once in a fine histogram holding per-bin count, sum and sum of squares.
+ * Bins located entirely within the clip bounds contribute their sums
+ * directly. Only the bins containing a clip bound need individual pixel
+ * values : these are collected in one additional pass, for a window of
+ * bins around each bound so that later iterations usually stay within the
+ * collected bins. Integer images with a small value range are binned one
+ * value per bin and need no collection pass.
+ *
+ * Histograms are accumulated in a fixed number of lanes, each lane
+ * processing a fixed set of chunks in order, so results do not depend on
+ * the number of threads.
+ *
+ */
+
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+#include "CommandLineInterface/CLIcore.h"
+#include "COREMOD_tools/COREMOD_tools.h"
+#include "COREMOD_memory/COREMOD_memory.h"
+
+#include "info/pixstats.h"
+#include "info/pixmask.h"
+#include "info/statcache.h"
+#include "info/sigclip.h"
+
+
+
+
+// number of histogram bins
+#define INFO_SIGCLIP_NBBIN 16384
+
+// number of independent histograms, sets the maximum parallelism
+#define INFO_SIGCLIP_NBLANE 8
+
+// number of bins collected on each side of a clip bound
+#define INFO_SIGCLIP_EDGEWINDOW 8
+
+
+
+typedef struct
+{
+    uint64_t  count;
+    double    sum;
+    double    ssq;
+} SIGCLIPBIN;
+
+
+// pixel value to bin mapping
+typedef struct
+{
+    double  vmin;
+    double  vmax;
+    double  scale;   // bins per unit value
+    long    NBbin;
+    int     exact;   // one value per bin
+} SIGCLIPMAP;
+
+
+
+
+static inline long sigclip_bin(
+    const SIGCLIPMAP *map,
+    double            v
+)
+{
+    long b = (long)((v - map->vmin) * map->scale);
+
+    if(b < 0)
+    {
+        b = 0;
+    }
+    if(b > map->NBbin - 1)
+    {
+        b = map->NBbin - 1;
+    }
+    return b;
+}
+
+
+
+
+/* ================================================================== */
+/*            GENERIC KERNELS                                         */
+/* ================================================================== */
+
+#define INFO_SIGCLIP_KERNEL(TS, PIXTYPE, DTYPE, SUMTYPE, SQTYPE,              \
+                            PIXMIN, PIXMAX, ISFLOAT)                          \
+                                                                              \
+static void sigclip_histo_##TS(                                               \
+    const PIXTYPE *restrict array,                                            \
+    uint64_t                nbpix,                                            \
+    const SIGCLIPMAP       *map,                                              \
+    SIGCLIPBIN    *restrict histo                                             \
+)                                                                             \
+{                                                                             \
+    for(uint64_t ii = 0; ii < nbpix; ii++)                                    \
+    {                                                                         \
+        double v = (double) array[ii];                                        \
+        if(ISFLOAT && !isfinite(v))                                           \
+        {                                                                     \
+            continue;                                                         \
+        }                                                                     \
+        long b = sigclip_bin(map, v);                                         \
+        histo[b].count++;                                                     \
+        histo[b].sum += v;                                                    \
+        histo[b].ssq += v * v;                                                \
+    }                                                                         \
+}                                                                             \
+                                                                              \
+static uint64_t sigclip_collect_##TS(                                         \
+    const PIXTYPE *restrict array,                                            \
+    uint64_t                nbpix,                                            \
+    const SIGCLIPMAP       *map,                                              \
+    const long             *window,                                           \
+    double        *restrict values                                            \
+)                                                                             \
+{                                                                             \
+    uint64_t nbval = 0;                                                       \
+                                                                              \
+    for(uint64_t ii = 0; ii < nbpix; ii++)                                    \
+    {                                                                         \
+        double v = (double) array[ii];                                        \
+        if(ISFLOAT && !isfinite(v))                                           \
+        {                                                                     \
+            continue;                                                         \
+        }                                                                     \
+        long b = sigclip_bin(map, v);                                         \
+        if(((b >= window[0]) && (b <= window[1]))                             \
+                || ((b >= window[2]) && (b <= window[3])))                    \
+        {                                                                     \
+            values[nbval++] = v;                                              \
+        }                                                                     \
+    }                                                                         \
+    return nbval;                                                             \
+}
+
+
+INFO_PIXSTATS_TYPELIST(INFO_SIGCLIP_KERNEL)
+
+
+
+
+/* ================================================================== */
+/*            PASSES OVER PIXELS                                      */
+/* ================================================================== */
+
+static void sigclip_histo_span(
+    imageID           ID,
+    uint64_t          offset,
+    uint64_t          nbpix,
+    const SIGCLIPMAP *map,
+    SIGCLIPBIN       *histo
+)
+{
+    switch(data.image[ID].md[0].datatype)
+    {
+#define INFO_SIGCLIP_CASE_HISTO(TS, PIXTYPE, DTYPE, ...)                    \
+        case DTYPE:                                                         \
+            sigclip_histo_##TS(data.image[ID].array.TS + offset, nbpix,     \
+                               map, histo);                                 \
+            break;
+            INFO_PIXSTATS_TYPELIST(INFO_SIGCLIP_CASE_HISTO)
+#undef INFO_SIGCLIP_CASE_HISTO
+    }
+}
+
+
+
+
+static uint64_t sigclip_collect_span(
+    imageID           ID,
+    uint64_t          offset,
+    uint64_t          nbpix,
+    const SIGCLIPMAP *map,
+    const long       *window,
+    double           *values
+)
+{
+    uint64_t nbval = 0;
+
+    switch(data.image[ID].md[0].datatype)
+    {
+#define INFO_SIGCLIP_CASE_COLLECT(TS, PIXTYPE, DTYPE, ...)                  \
+        case DTYPE:                                                         \
+            nbval = sigclip_collect_##TS(data.image[ID].array.TS + offset,  \
+                                         nbpix, map, window, values);       \
+            break;
+            INFO_PIXSTATS_TYPELIST(INFO_SIGCLIP_CASE_COLLECT)
+#undef INFO_SIGCLIP_CASE_COLLECT
+    }
+
+    return nbval;
+}
+
+
+
+
+// lane l processes chunks l, l+NBlane, l+2*NBlane ...
+static void sigclip_histo_lanes(
+    imageID             ID,
+    uint64_t            offset,
+    const INFO_PIXMASK *pixmask,
+    const SIGCLIPMAP   *map,
+    int                 NBlane,
+    SIGCLIPBIN         *lanehisto
+)
+{
+    int NBthreads = info_pixstats_get_NBthreads();
+    (void) NBthreads;
+
+#ifdef _OPENMP
+    #pragma omp parallel for schedule(dynamic) num_threads(NBthreads) if(NBlane > 1)
+#endif
+    for(int lane = 0; lane < NBlane; lane++)
+    {
+        SIGCLIPBIN *histo = lanehisto + (size_t) lane * map->NBbin;
+
+        for(long chunk = lane; chunk < pixmask->NBchunk; chunk += NBlane)
+        {
+            for(long spanindex = pixmask->chunkspan[chunk];
+                    spanindex < pixmask->chunkspan[chunk + 1]; spanindex++)
+            {
+                sigclip_histo_span(ID, offset + pixmask->span[spanindex].start,
+                                   pixmask->span[spanindex].length, map, histo);
+            }
+        }
+    }
+}
+
+
+
+
+// collect values of pixels in window bins, sorted
+// values must hold the number of pixels in window bins
+static void sigclip_collect_lanes(
+    imageID             ID,
+    uint64_t            offset,
+    const INFO_PIXMASK *pixmask,
+    const SIGCLIPMAP   *map,
+    int                 NBlane,
+    const SIGCLIPBIN   *lanehisto,
+    const long         *window,
+    double             *values,
+    uint64_t           *nbval
+)
+{
+    uint64_t laneoffset[INFO_SIGCLIP_NBLANE + 1];
+    uint64_t lanenbval[INFO_SIGCLIP_NBLANE];
+
+    // each lane writes its own segment, sized from its histogram
+    laneoffset[0] = 0;
+    for(int lane = 0; lane < NBlane; lane++)
+    {
+        const SIGCLIPBIN *histo = lanehisto + (size_t) lane * map->NBbin;
+        uint64_t cnt = 0;
+
+        for(long b = 0; b < map->NBbin; b++)
+        {
+            if(((b >= window[0]) && (b <= window[1]))
+                    || ((b >= window[2]) && (b <= window[3])))
+            {
+                cnt += histo[b].count;
+            }
+        }
+        laneoffset[lane + 1] = laneoffset[lane] + cnt;
+    }
+
+    int NBthreads = info_pixstats_get_NBthreads();
+    (void) NBthreads;
+
+#ifdef _OPENMP
+    #pragma omp parallel for schedule(dynamic) num_threads(NBthreads) if(NBlane > 1)
+#endif
+    for(int lane = 0; lane < NBlane; lane++)
+    {
+        lanenbval[lane] = 0;
+        for(long chunk = lane; chunk < pixmask->NBchunk; chunk += NBlane)
+        {
+            for(long spanindex = pixmask->chunkspan[chunk];
+                    spanindex < pixmask->chunkspan[chunk + 1]; spanindex++)
+            {
+                lanenbval[lane] += sigclip_collect_span(ID,
+                                                        offset + pixmask->span[spanindex].start,
+                                                        pixmask->span[spanindex].length, map, window,
+                                                        values + laneoffset[lane] + lanenbval[lane]);
+            }
+        }
+    }
+
+    *nbval = laneoffset[NBlane];
+    quick_sort_double(values, *nbval);
+}
+
+
+
+
+/* ================================================================== */
+/*            CLIPPING                                                */
+/* ================================================================== */
+
+typedef struct
+{
+    uint64_t  count;
+    double    sum;
+    double    ssq;
+    int       exact;   // 0 if a bound falls in a bin with no collected values
+} SIGCLIPSUMS;
+
+
+
+
+// sums over pixels within [lo, hi]
+static SIGCLIPSUMS sigclip_sums(
+    const SIGCLIPMAP *map,
+    const SIGCLIPBIN *histo,
+    const long       *window,
+    const double     *values,
+    uint64_t          nbval,
+    double            lo,
+    double            hi
+)
+{
+    SIGCLIPSUMS sums = { 0, 0.0, 0.0, 1 };
+    long blo = -1;
+    long bhi = map->NBbin;
+
+    if(lo > map->vmin)
+    {
+        blo = sigclip_bin(map, lo);
+    }
+    if(hi < map->vmax)
+    {
+        bhi = sigclip_bin(map, hi);
+    }
+
+    for(long b = (blo < 0) ? 0 : blo; (b <= bhi) && (b < map->NBbin); b++)
+    {
+        if(histo[b].count == 0)
+        {
+            continue;
+        }
+        if(((b >= window[0]) && (b <= window[1]))
+                || ((b >= window[2]) && (b <= window[3])))
+        {
+            // added from collected values
+            continue;
+        }
+        if((b == blo) || (b == bhi))
+        {
+            if(map->exact)
+            {
+                // single value bin
+                double v = histo[b].sum / histo[b].count;
+                if((v < lo) || (v > hi))
+                {
+                    continue;
+                }
+            }
+            else
+            {
+                sums.exact = 0;
+                continue;
+            }
+        }
+        sums.count += histo[b].count;
+        sums.sum += histo[b].sum;
+        sums.ssq += histo[b].ssq;
+    }
+
+    for(uint64_t i = 0; i < nbval; i++)
+    {
+        if((values[i] >= lo) && (values[i] <= hi))
+        {
+            sums.count++;
+            sums.sum += values[i];
+            sums.ssq += values[i] * values[i];
+        }
+    }
+
+    return sums;
+}
+
+
+
+
+/**
+ * @brief Sigma-clipped mean and rms of pixels [offset, offset+nbpix[
+ *
+ * If pixmask is not NULL, only pixels selected by the mask are used (see
+ * info_pixstats_compute). NaN and Inf pixels are ignored.
+ * Clipping is repeated until the number of kept pixels no longer changes,
+ * or for at most maxiter iterations.
+ */
+errno_t info_sigclip_compute(
+    imageID             ID,
+    uint64_t            offset,
+    uint64_t            nbpix,
+    const INFO_PIXMASK *pixmask,
+    double              nsigma,
+    int                 maxiter,
+    INFO_SIGCLIP       *sigclip
+)
+{
+    INFO_PIXSTATS pixstats;
+    INFO_PIXMASK  rangemask;
+    SIGCLIPMAP    map;
+    uint8_t       datatype = data.image[ID].md[0].datatype;
+
+    memset(sigclip, 0, sizeof(INFO_SIGCLIP));
+    sigclip->mean = NAN;
+    sigclip->rms = NAN;
+    sigclip->lo = NAN;
+    sigclip->hi = NAN;
+
+    if(info_pixstats_datatype_supported(datatype) == 0)
+    {
+        PRINT_ERROR("datatype %d not supported", (int) datatype);
+        return RETURN_FAILURE;
+    }
+
+    // initial statistics, also gives the histogram range
+    if((pixmask == NULL) && (offset == 0)
+            && (nbpix == data.image[ID].md[0].nelement))
+    {
+        info_statcache_pixstats(ID, &pixstats);
+    }
+    else
+    {
+        info_pixstats_compute(ID, offset, nbpix, pixmask, &pixstats);
+    }
+
+    uint64_t nbvalid = pixstats.nelement - pixstats.NBnan - pixstats.NBinf;
+    if(nbvalid == 0)
+    {
+        return RETURN_SUCCESS;
+    }
+
+    double mean = pixstats.total / nbvalid;
+    double var = pixstats.ssquare / nbvalid - mean * mean;
+    double rms = (var > 0.0) ? sqrt(var) : 0.0;
+
+    sigclip->NBpix = nbvalid;
+    sigclip->mean = mean;
+    sigclip->rms = rms;
+    sigclip->lo = pixstats.min;
+    sigclip->hi = pixstats.max;
+    if(pixstats.max == pixstats.min)
+    {
+        return RETURN_SUCCESS;
+    }
+
+
+    map.vmin = pixstats.min;
+    map.vmax = pixstats.max;
+    map.exact = 0;
+    map.NBbin = INFO_SIGCLIP_NBBIN;
+    map.scale = INFO_SIGCLIP_NBBIN / (pixstats.max - pixstats.min);
+    if((datatype != _DATATYPE_FLOAT) && (datatype != _DATATYPE_DOUBLE)
+            && (pixstats.max - pixstats.min < INFO_SIGCLIP_NBBIN))
+    {
+        map.exact = 1;
+        map.NBbin = (long)(pixstats.max - pixstats.min) + 1;
+        map.scale = 1.0;
+    }
+
+    if(pixmask == NULL)
+    {
+        if(info_pixmask_build_range(&rangemask, nbpix) != RETURN_SUCCESS)
+        {
+            return RETURN_FAILURE;
+        }
+        pixmask = &rangemask;
+    }
+
+    int NBlane = INFO_SIGCLIP_NBLANE;
+    if(NBlane > pixmask->NBchunk)
+    {
+        NBlane = pixmask->NBchunk;
+    }
+
+    // lane histograms, followed by their sum
+    SIGCLIPBIN *lanehisto = (SIGCLIPBIN *) calloc((size_t) map.NBbin * (NBlane + 1),
+                            sizeof(SIGCLIPBIN));
+    if(lanehisto == NULL)
+    {
+        PRINT_ERROR("calloc error");
+        if(pixmask == &rangemask)
+        {
+            info_pixmask_free(&rangemask);
+        }
+        return RETURN_FAILURE;
+    }
+    SIGCLIPBIN *histo = lanehisto + (size_t) map.NBbin * NBlane;
+
+    sigclip_histo_lanes(ID, offset, pixmask, &map, NBlane, lanehisto);
+    for(int lane = 0; lane < NBlane; lane++)
+    {
+        const SIGCLIPBIN *lhisto = lanehisto + (size_t) map.NBbin * lane;
+        for(long b = 0; b < map.NBbin; b++)
+        {
+            histo[b].count += lhisto[b].count;
+            histo[b].sum += lhisto[b].sum;
+            histo[b].ssq += lhisto[b].ssq;
+        }
+    }
+
+
+    // no collected values yet
+    long      window[4] = { -1, -2, -1, -2 };
+    double   *values = NULL;
+    uint64_t  nbval = 0;
+    uint64_t  NBkept = nbvalid;
+    int       iter;
+
+    for(iter = 0; iter < maxiter; iter++)
+    {
+        double lo = mean - nsigma * rms;
+        double hi = mean + nsigma * rms;
+
+        SIGCLIPSUMS sums = sigclip_sums(&map, histo, window, values, nbval, lo, hi);
+        if(sums.exact == 0)
+        {
+            // collect pixels in bins around both bounds
+            window[0] = sigclip_bin(&map, lo) - INFO_SIGCLIP_EDGEWINDOW;
+            window[1] = sigclip_bin(&map, lo) + INFO_SIGCLIP_EDGEWINDOW;
+            window[2] = sigclip_bin(&map, hi) - INFO_SIGCLIP_EDGEWINDOW;
+            window[3] = sigclip_bin(&map, hi) + INFO_SIGCLIP_EDGEWINDOW;
+
+            uint64_t nbvalmax = 0;
+            for(long b = 0; b < map.NBbin; b++)
+            {
+                if(((b >= window[0]) && (b <= window[1]))
+                        || ((b >= window[2]) && (b <= window[3])))
+                {
+                    nbvalmax += histo[b].count;
+                }
+            }
+            free(values);
+            values = (double *) malloc(sizeof(double) * (nbvalmax + 1));
+            if(values == NULL)
+            {
+                PRINT_ERROR("malloc error");
+                free(lanehisto);
+                if(pixmask == &rangemask)
+                {
+                    info_pixmask_free(&rangemask);
+                }
+                return RETURN_FAILURE;
+            }
+            sigclip_collect_lanes(ID, offset, pixmask, &map, NBlane, lanehisto, window,
+                                  values, &nbval);
+
+            sums = sigclip_sums(&map, histo, window, values, nbval, lo, hi);
+        }
+
+        if(sums.count == 0)
+        {
+            break;
+        }
+
+        sigclip->lo = lo;
+        sigclip->hi = hi;
+
+        mean = sums.sum / sums.count;
+        var = sums.ssq / sums.count - mean * mean;
+        rms = (var > 0.0) ? sqrt(var) : 0.0;
+
+        if(sums.count == NBkept)
+        {
+            iter++;
+            break;
+        }
+        NBkept = sums.count;
+    }
+
+    free(values);
+    free(lanehisto);
+    if(pixmask == &rangemask)
+    {
+        info_pixmask_free(&rangemask);
+    }
+
+    sigclip->NBpix = NBkept;
+    sigclip->NBclip = nbvalid - NBkept;
+    sigclip->mean = mean;
+    sigclip->rms = rms;
+    sigclip->NBiter = iter;
+
+    return RETURN_SUCCESS;
+}
+
+
+
+
+/**
+ * @brief Sigma-clipped statistics of image, optionally within mask (> 0.5)
+ *
+ * IDmask_name can be NULL or empty for no mask. Mask applies to the first
+ * 2D plane of the image.
+ */
+errno_t info_image_sigclip(
+    const char   *ID_name,
+    const char   *IDmask_name,
+    double        nsigma,
+    int           maxiter,
+    INFO_SIGCLIP *sigclip
+)
+{
+    imageID      ID;
+    INFO_PIXMASK pixmask;
+    errno_t      ret;
+
+    ID = image_ID(ID_name);
+    if(ID == -1)
+    {
+        PRINT_ERROR("image %s not found", ID_name);
+        return RETURN_FAILURE;
+    }
+
+    if((IDmask_name == NULL) || (IDmask_name[0] == '\0'))
+    {
+        return info_sigclip_compute(ID, 0, data.image[ID].md[0].nelement, NULL,
+                                    nsigma, maxiter, sigclip);
+    }
+
+    imageID IDmask = image_ID(IDmask_name);
+    if(IDmask == -1)
+    {
+        PRINT_ERROR("mask image %s not found", IDmask_name);
+        return RETURN_FAILURE;
+    }
+    if((data.image[IDmask].md[0].size[0] != data.image[ID].md[0].size[0])
+            || (data.image[IDmask].md[0].nelement > data.image[ID].md[0].nelement))
+    {
+        PRINT_ERROR("mask image %s size does not match image %s",
+                    IDmask_name, ID_name);
+        return RETURN_FAILURE;
+    }
+
+    if(info_pixmask_build_image(&pixmask, IDmask) != RETURN_SUCCESS)
+    {
+        return RETURN_FAILURE;
+    }
+    ret = info_sigclip_compute(ID, 0, 0, &pixmask, nsigma, maxiter, sigclip);
+    info_pixmask_free(&pixmask);
+
+    return ret;
+}
@@ -0,0 +1,45 @@
+/**
+ * @file    sigclip.h
+ * @brief   Sigma-clipped statistics
+ *
+ */
+
+#if !defined(INFO_SIGCLIP_H)
+#define INFO_SIGCLIP_H
+
+#include "info/pixmask.h"
+
+
+typedef struct
+{
+    uint64_t  NBpix;      // number of pixels kept
+    uint64_t  NBclip;     // number of finite pixels rejected
+    double    mean;       // mean of kept pixels
+    double    rms;        // standard deviation of kept pixels
+    double    lo;         // final clip bounds
+    double    hi;
+    int       NBiter;     // number of clipping iterations
+} INFO_SIGCLIP;
+
+
+
+errno_t info_sigclip_compute(
+    imageID             ID,
+    uint64_t            offset,
+    uint64_t            nbpix,
+    const INFO_PIXMASK *pixmask,
+    double              nsigma,
+    int                 maxiter,
+    INFO_SIGCLIP       *sigclip
+);
+
+errno_t info_image_sigclip(
+    const char   *ID_name,
+    const char   *IDmask_name,
+    double        nsigma,
+    int           maxiter,
+    INFO_SIGCLIP *sigclip
+);
+
+
+#endif
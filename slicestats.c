@@ -0,0 +1,323 @@
+/**
+ * @file    slicestats.c
+ * @brief   Per-slice statistics of 3D cubes
+ *
+ * Computes for each slice of a cube : min, max, total, mean, RMS,
+ * centroid and median, written as one row per slice of a 2D output image
+ * (INFO_SLICESTATS_NBSTAT x number of slices).
+ *
+ * Each slice is read once : a row kernel accumulates extrema, sums and
+ * first moments while copying finite values to a scratch buffer, from
+ * which the median is selected (select.c). Variance sums are taken
+ * relative to the first finite value of the slice, to limit cancellation.
+ * Slices with no finite pixel get NaN statistics.
+ *
+ * Slices are processed in parallel, each slice by a single thread. The
+ * scratch buffer is allocated once per thread.
+ *
+ */
+
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <math.h>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+#include "CommandLineInterface/CLIcore.h"
+#include "COREMOD_memory/COREMOD_memory.h"
+
+#include "info/pixstats.h"
+#include "info/select.h"
+#include "info/slicestats.h"
+
+
+
+
+typedef struct
+{
+    uint64_t  NBvalid;  // finite pixels
+    double    min;
+    double    max;
+    double    total;
+    double    sd;       // sums of v-v0 and (v-v0)^2
+    double    sd2;
+    double    sx;       // first moments, relative to slice center
+    double    sy;
+} SLICESUMS;
+
+
+
+
+/* ================================================================== */
+/*            GENERIC KERNEL                                          */
+/* ================================================================== */
+
+// One row of a slice : min, max, sums and first moments, finite values
+// copied to scratch. Returns number of values copied.
+// Rows with non-finite values propagate them to the sums, and are scanned
+// again with a branch (see pixstats.c). Row is then cache-resident.
+
+#define INFO_SLICESTATS_KERNEL(TS, PIXTYPE, DTYPE, SUMTYPE, SQTYPE,           \
+                               PIXMIN, PIXMAX, ISFLOAT)                       \
+                                                                              \
+static uint64_t slicestats_row_##TS(                                          \
+    const PIXTYPE *restrict row,                                              \
+    uint64_t                nbpix,                                            \
+    double                  xstart,                                           \
+    double                  y,                                                \
+    double                  v0,                                               \
+    double        *restrict scratch,                                          \
+    SLICESUMS              *ss                                                \
+)                                                                             \
+{                                                                             \
+    double   vmin = INFINITY;                                                 \
+    double   vmax = -INFINITY;                                                \
+    SUMTYPE  r0 = 0;                                                          \
+    double   rd = 0.0;                                                        \
+    double   rd2 = 0.0;                                                       \
+    double   rx = 0.0;                                                        \
+    uint64_t n = nbpix;                                                       \
+                                                                              \
+    INFO_PRAGMA_SIMD(reduction(min:vmin) reduction(max:vmax) reduction(+:r0,rd,rd2,rx)) \
+    for(uint64_t ii = 0; ii < nbpix; ii++)                                    \
+    {                                                                         \
+        double v = (double) row[ii];                                          \
+        double d = v - v0;                                                    \
+        scratch[ii] = v;                                                      \
+        vmin = (v < vmin) ? v : vmin;                                         \
+        vmax = (v > vmax) ? v : vmax;                                         \
+        r0 += (SUMTYPE) row[ii];                                              \
+        rd += d;                                                              \
+        rd2 += d * d;                                                         \
+        rx += v * (xstart + (double) ii);                                     \
+    }                                                                         \
+                                                                              \
+    if(ISFLOAT && !isfinite((double) r0 + rd2 + rx))                          \
+    {                                                                         \
+        vmin = INFINITY;                                                      \
+        vmax = -INFINITY;                                                     \
+        r0 = 0;                                                               \
+        rd = 0.0;                                                             \
+        rd2 = 0.0;                                                            \
+        rx = 0.0;                                                             \
+        n = 0;                                                                \
+        for(uint64_t ii = 0; ii < nbpix; ii++)                                \
+        {                                                                     \
+            double v = (double) row[ii];                                      \
+            if(isfinite(v))                                                   \
+            {                                                                 \
+                double d = v - v0;                                            \
+                scratch[n++] = v;                                             \
+                vmin = (v < vmin) ? v : vmin;                                 \
+                vmax = (v > vmax) ? v : vmax;                                 \
+                r0 += (SUMTYPE) row[ii];                                      \
+                rd += d;                                                      \
+                rd2 += d * d;                                                 \
+                rx += v * (xstart + (double) ii);                             \
+            }                                                                 \
+        }                                                                     \
+    }                                                                         \
+                                                                              \
+    ss->NBvalid += n;                                                         \
+    ss->min = (vmin < ss->min) ? vmin : ss->min;                              \
+    ss->max = (vmax > ss->max) ? vmax : ss->max;                              \
+    ss->total += (double) r0;                                                 \
+    ss->sd += rd;                                                             \
+    ss->sd2 += rd2;                                                           \
+    ss->sx += rx;                                                             \
+    ss->sy += y * (double) r0;                                                \
+                                                                              \
+    return n;                                                                 \
+}
+
+
+INFO_PIXSTATS_TYPELIST(INFO_SLICESTATS_KERNEL)
+
+
+
+
+// first finite value of slice, reference for the variance sums
+#define INFO_SLICESTATS_FIRST(TS, PIXTYPE, DTYPE, ...)                        \
+static double slicestats_first_##TS(                                          \
+    const PIXTYPE *array,                                                     \
+    uint64_t       nbpix                                                      \
+)                                                                             \
+{                                                                             \
+    for(uint64_t ii = 0; ii < nbpix; ii++)                                    \
+    {                                                                         \
+        if(isfinite((double) array[ii]))                                      \
+        {                                                                     \
+            return (double) array[ii];                                        \
+        }                                                                     \
+    }                                                                         \
+    return 0.0;                                                               \
+}
+
+INFO_PIXSTATS_TYPELIST(INFO_SLICESTATS_FIRST)
+
+
+
+
+// statistics of one slice, in a single pass over its pixels
+// scratch must hold xsize*ysize values
+static void slicestats_slice(
+    imageID   ID,
+    uint64_t  offset,
+    uint32_t  xsize,
+    uint32_t  ysize,
+    double   *scratch,
+    double   *statrow
+)
+{
+    uint64_t  xysize = (uint64_t) xsize * ysize;
+    double    x0 = 0.5 * (xsize - 1);
+    double    y0 = 0.5 * (ysize - 1);
+    double    v0 = 0.0;
+    uint64_t  n = 0;
+    SLICESUMS ss = { 0, INFINITY, -INFINITY, 0.0, 0.0, 0.0, 0.0, 0.0 };
+
+    switch(data.image[ID].md[0].datatype)
+    {
+#define INFO_SLICESTATS_CASE(TS, PIXTYPE, DTYPE, ...)                       \
+        case DTYPE:                                                         \
+            v0 = slicestats_first_##TS(data.image[ID].array.TS + offset,    \
+                                       xysize);                             \
+            for(uint32_t jj = 0; jj < ysize; jj++)                          \
+            {                                                               \
+                n += slicestats_row_##TS(data.image[ID].array.TS + offset   \
+                                         + (uint64_t) jj * xsize, xsize,    \
+                                         -x0, (double) jj - y0, v0,         \
+                                         scratch + n, &ss);                 \
+            }                                                               \
+            break;
+            INFO_PIXSTATS_TYPELIST(INFO_SLICESTATS_CASE)
+#undef INFO_SLICESTATS_CASE
+    }
+
+    statrow[INFO_SLICESTATS_TOTAL] = ss.total;
+    statrow[INFO_SLICESTATS_NBBAD] = (double)(xysize - n);
+
+    if(n == 0)
+    {
+        statrow[INFO_SLICESTATS_MIN] = NAN;
+        statrow[INFO_SLICESTATS_MAX] = NAN;
+        statrow[INFO_SLICESTATS_MEAN] = NAN;
+        statrow[INFO_SLICESTATS_RMS] = NAN;
+        statrow[INFO_SLICESTATS_XC] = NAN;
+        statrow[INFO_SLICESTATS_YC] = NAN;
+        statrow[INFO_SLICESTATS_MEDIAN] = NAN;
+        return;
+    }
+
+    double dmean = ss.sd / n;
+    double var = ss.sd2 / n - dmean * dmean;
+
+    statrow[INFO_SLICESTATS_MIN] = ss.min;
+    statrow[INFO_SLICESTATS_MAX] = ss.max;
+    statrow[INFO_SLICESTATS_MEAN] = ss.total / n;
+    statrow[INFO_SLICESTATS_RMS] = (var > 0.0) ? sqrt(var) : 0.0;
+    statrow[INFO_SLICESTATS_XC] = x0 + ss.sx / ss.total;
+    statrow[INFO_SLICESTATS_YC] = y0 + ss.sy / ss.total;
+    statrow[INFO_SLICESTATS_MEDIAN] = info_select_double(scratch, n, n / 2);
+}
+
+
+
+
+/**
+ * @brief Per-slice statistics table of a 3D image
+ *
+ * Output is a 2D double image of size INFO_SLICESTATS_NBSTAT x zsize,
+ * row kk holding the statistics of slice kk (see slicestats.h for columns).
+ */
+imageID info_image_slicestats(
+    const char *ID_name,
+    const char *IDout_name
+)
+{
+    imageID   ID;
+    imageID   IDout;
+    uint32_t  xsize, ysize, zsize;
+    uint64_t  xysize;
+
+    ID = image_ID(ID_name);
+    if(ID == -1)
+    {
+        PRINT_ERROR("image %s not found", ID_name);
+        return -1;
+    }
+    if(info_pixstats_datatype_supported(data.image[ID].md[0].datatype) == 0)
+    {
+        PRINT_ERROR("datatype %d not supported",
+                    (int) data.image[ID].md[0].datatype);
+        return -1;
+    }
+
+    xsize = data.image[ID].md[0].size[0];
+    ysize = data.image[ID].md[0].size[1];
+    xysize = (uint64_t) xsize * ysize;
+    zsize = 1;
+    if(data.image[ID].md[0].naxis == 3)
+    {
+        zsize = data.image[ID].md[0].size[2];
+    }
+
+    IDout = create_2Dimage_ID_double(IDout_name, INFO_SLICESTATS_NBSTAT, zsize);
+    if(IDout == -1)
+    {
+        PRINT_ERROR("cannot create image %s", IDout_name);
+        return -1;
+    }
+
+    int NBthreads = info_pixstats_get_NBthreads();
+    (void) NBthreads;
+    int allocerr = 0;
+
+#ifdef _OPENMP
+    #pragma omp parallel num_threads(NBthreads)
+#endif
+    {
+        double *scratch = (double *) malloc(sizeof(double) * (xysize + 1));
+        if(scratch == NULL)
+        {
+            PRINT_ERROR("malloc error");
+#ifdef _OPENMP
+            #pragma omp atomic write
+#endif
+            allocerr = 1;
+        }
+
+#ifdef _OPENMP
+        #pragma omp for schedule(dynamic)
+#endif
+        for(uint32_t kk = 0; kk < zsize; kk++)
+        {
+            int skip;
+#ifdef _OPENMP
+            #pragma omp atomic read
+#endif
+            skip = allocerr;
+            if(skip)
+            {
+                continue;
+            }
+
+            slicestats_slice(ID, (uint64_t) kk * xysize, xsize, ysize, scratch,
+                             data.image[IDout].array.D + (uint64_t) kk * INFO_SLICESTATS_NBSTAT);
+        }
+
+        free(scratch);
+    }
+
+    if(allocerr)
+    {
+        delete_image_ID(IDout_name);
+        return -1;
+    }
+
+    return IDout;
+}
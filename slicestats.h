@@ -0,0 +1,31 @@
+/**
+ * @file    slicestats.h
+ * @brief   Per-slice statistics of 3D cubes
+ *
+ */
+
+#if !defined(INFO_SLICESTATS_H)
+#define INFO_SLICESTATS_H
+
+
+// columns of the per-slice statistics table
+#define INFO_SLICESTATS_MIN     0
+#define INFO_SLICESTATS_MAX     1
+#define INFO_SLICESTATS_TOTAL   2
+#define INFO_SLICESTATS_MEAN    3
+#define INFO_SLICESTATS_RMS     4  // standard deviation
+#define INFO_SLICESTATS_XC      5  // centroid
+#define INFO_SLICESTATS_YC      6
+#define INFO_SLICESTATS_MEDIAN  7
+#define INFO_SLICESTATS_NBBAD   8  // NaN and Inf pixels
+#define INFO_SLICESTATS_NBSTAT  9
+
+
+
+imageID info_image_slicestats(
+    const char *ID_name,
+    const char *IDout_name
+);
+
+
+#endif
@@ -0,0 +1,530 @@
+/**
+ * @file    statcache.c
+ * @brief   Cache of whole-image statistics
+ *
+ * Repeated queries (img_min, img_max, ssquare, rms_dev, img_percentile) on
+ * an unchanged image are served from a small table instead of rescanning
+ * the image. Pixel statistics are filled by the first scan ; a sorted copy
+ * of the finite pixel values is kept once a percentile has been requested.
+ *
+ * Entries are keyed on image index, cnt0, creation time, data pointer,
+ * datatype and size. A stream update increments cnt0 and a re-created
+ * image gets a new creation time, so stale entries are never returned.
+ * Code writing directly into an image array without incrementing cnt0
+ * should call info_statcache_invalidate(). Images with the write flag set
+ * are never cached.
+ *
+ * Percentiles of 8- and 16-bit images are always read from a counting
+ * histogram (see pixstats.c), which is cheaper than storing a sorted copy.
+ * Images that cannot be cached get their percentiles by selection only.
+ * Sorted copies are limited to INFO_STATCACHE_SORTED_MAXBYTES in total,
+ * least recently used copies being dropped first ; larger images are not
+ * kept.
+ *
+ * The key is read before the image is scanned, and results are stored
+ * only if the key still matches and the write flag is clear after the
+ * scan, so that a frame updated during the scan is not cached under the
+ * new cnt0.
+ *
+ */
+
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <pthread.h>
+
+#include "CommandLineInterface/CLIcore.h"
+#include "COREMOD_tools/COREMOD_tools.h"
+
+#include "info/pixstats.h"
+#include "info/select.h"
+#include "info/statcache.h"
+
+
+
+
+// identifies the image content statistics were computed from
+typedef struct
+{
+    imageID          ID;
+    uint64_t         cnt0;
+    struct timespec  creationtime;
+    void            *array;
+    uint8_t          datatype;
+    uint64_t         nelement;
+} STATCACHE_KEY;
+
+
+typedef struct
+{
+    int              used;
+    STATCACHE_KEY    key;
+    uint64_t         lastuse;
+
+    int              pixstats_valid;
+    INFO_PIXSTATS    pixstats;
+
+    int              rms_valid;
+    double           rms;         // two-pass standard deviation
+
+    double          *sorted;      // sorted finite pixel values, NULL if not computed
+    uint64_t         NBsorted;
+} STATCACHE_ENTRY;
+
+
+static STATCACHE_ENTRY statcache[INFO_STATCACHE_NBENTRY];
+static uint64_t        statcache_clock = 0;
+static uint64_t        statcache_sortedbytes = 0;  // held by sorted copies
+static pthread_mutex_t statcache_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+
+
+
+static void statcache_key_snapshot(
+    imageID        ID,
+    STATCACHE_KEY *key
+)
+{
+    key->ID = ID;
+    key->cnt0 = data.image[ID].md[0].cnt0;
+    key->creationtime = data.image[ID].md[0].creationtime;
+    key->array = data.image[ID].array.raw;
+    key->datatype = data.image[ID].md[0].datatype;
+    key->nelement = data.image[ID].md[0].nelement;
+}
+
+
+
+
+static int statcache_key_equal(
+    const STATCACHE_KEY *a,
+    const STATCACHE_KEY *b
+)
+{
+    return (a->ID == b->ID)
+           && (a->cnt0 == b->cnt0)
+           && (a->creationtime.tv_sec == b->creationtime.tv_sec)
+           && (a->creationtime.tv_nsec == b->creationtime.tv_nsec)
+           && (a->array == b->array)
+           && (a->datatype == b->datatype)
+           && (a->nelement == b->nelement);
+}
+
+
+
+
+// image is unchanged since key snapshot, and not being written
+static int statcache_key_current(
+    const STATCACHE_KEY *key
+)
+{
+    STATCACHE_KEY now;
+
+    if(data.image[key->ID].md[0].write != 0)
+    {
+        return 0;
+    }
+    statcache_key_snapshot(key->ID, &now);
+
+    return statcache_key_equal(key, &now);
+}
+
+
+
+
+static void statcache_clear_sorted(
+    STATCACHE_ENTRY *entry
+)
+{
+    if(entry->sorted != NULL)
+    {
+        statcache_sortedbytes -= sizeof(double) * entry->NBsorted;
+    }
+    free(entry->sorted);
+    entry->sorted = NULL;
+    entry->NBsorted = 0;
+}
+
+
+
+
+static void statcache_clear(
+    STATCACHE_ENTRY *entry
+)
+{
+    statcache_clear_sorted(entry);
+    entry->pixstats_valid = 0;
+    entry->rms_valid = 0;
+    entry->used = 0;
+}
+
+
+
+
+// entry for image ID with key matching current image, or NULL
+// must be called with statcache_mutex locked
+static STATCACHE_ENTRY *statcache_find(
+    imageID ID
+)
+{
+    STATCACHE_KEY key;
+
+    statcache_key_snapshot(ID, &key);
+    for(int i = 0; i < INFO_STATCACHE_NBENTRY; i++)
+    {
+        if(statcache[i].used && (statcache[i].key.ID == ID))
+        {
+            if(statcache_key_equal(&statcache[i].key, &key))
+            {
+                statcache[i].lastuse = ++statcache_clock;
+                return &statcache[i];
+            }
+            // image has changed
+            statcache_clear(&statcache[i]);
+            return NULL;
+        }
+    }
+
+    return NULL;
+}
+
+
+
+
+// entry for key, created if needed by evicting least recently used
+// returns NULL if image has changed since key snapshot
+// must be called with statcache_mutex locked
+static STATCACHE_ENTRY *statcache_get(
+    const STATCACHE_KEY *key
+)
+{
+    if(statcache_key_current(key) == 0)
+    {
+        return NULL;
+    }
+
+    STATCACHE_ENTRY *entry = statcache_find(key->ID);
+    if(entry != NULL)
+    {
+        return entry;
+    }
+
+    entry = &statcache[0];
+    for(int i = 0; i < INFO_STATCACHE_NBENTRY; i++)
+    {
+        if(statcache[i].used == 0)
+        {
+            entry = &statcache[i];
+            break;
+        }
+        if(statcache[i].lastuse < entry->lastuse)
+        {
+            entry = &statcache[i];
+        }
+    }
+    statcache_clear(entry);
+
+    entry->used = 1;
+    entry->key = *key;
+    entry->lastuse = ++statcache_clock;
+
+    return entry;
+}
+
+
+
+
+// drop sorted copies of least recently used entries, other than keep,
+// until nbbyte more bytes fit in INFO_STATCACHE_SORTED_MAXBYTES
+// must be called with statcache_mutex locked
+static void statcache_reserve_sorted(
+    uint64_t               nbbyte,
+    const STATCACHE_ENTRY *keep
+)
+{
+    while(statcache_sortedbytes + nbbyte > INFO_STATCACHE_SORTED_MAXBYTES)
+    {
+        STATCACHE_ENTRY *oldest = NULL;
+        for(int i = 0; i < INFO_STATCACHE_NBENTRY; i++)
+        {
+            if((&statcache[i] != keep) && (statcache[i].sorted != NULL)
+                    && ((oldest == NULL) || (statcache[i].lastuse < oldest->lastuse)))
+            {
+                oldest = &statcache[i];
+            }
+        }
+        if(oldest == NULL)
+        {
+            break;
+        }
+        statcache_clear_sorted(oldest);
+    }
+}
+
+
+
+
+static void statcache_read_percentiles(
+    const double *sorted,
+    uint64_t      NBsorted,
+    const double *p,
+    long          NBp,
+    double       *values
+)
+{
+    for(long k = 0; k < NBp; k++)
+    {
+        values[k] = NAN;
+        if(NBsorted > 0)
+        {
+            uint64_t rank = 0;
+            if(p[k] > 0.0)
+            {
+                rank = (uint64_t)(p[k] * NBsorted);
+            }
+            if(rank > NBsorted - 1)
+            {
+                rank = NBsorted - 1;
+            }
+            values[k] = sorted[rank];
+        }
+    }
+}
+
+
+
+
+/**
+ * @brief Pixel statistics of whole image, from cache if image is unchanged
+ */
+errno_t info_statcache_pixstats(
+    imageID        ID,
+    INFO_PIXSTATS *pixstats
+)
+{
+    STATCACHE_KEY key;
+    int           cacheable = (data.image[ID].md[0].write == 0);
+
+    statcache_key_snapshot(ID, &key);
+
+    if(cacheable)
+    {
+        pthread_mutex_lock(&statcache_mutex);
+        STATCACHE_ENTRY *entry = statcache_find(ID);
+        if((entry != NULL) && entry->pixstats_valid)
+        {
+            *pixstats = entry->pixstats;
+            pthread_mutex_unlock(&statcache_mutex);
+            return RETURN_SUCCESS;
+        }
+        pthread_mutex_unlock(&statcache_mutex);
+    }
+
+    if(info_pixstats_compute(ID, 0, data.image[ID].md[0].nelement, NULL,
+                             pixstats) != RETURN_SUCCESS)
+    {
+        return RETURN_FAILURE;
+    }
+
+    if(cacheable)
+    {
+        // stored only if image did not change during the scan
+        pthread_mutex_lock(&statcache_mutex);
+        STATCACHE_ENTRY *entry = statcache_get(&key);
+        if(entry != NULL)
+        {
+            entry->pixstats = *pixstats;
+            entry->pixstats_valid = 1;
+        }
+        pthread_mutex_unlock(&statcache_mutex);
+    }
+
+    return RETURN_SUCCESS;
+}
+
+
+
+
+/**
+ * @brief Standard deviation of finite pixels of whole image
+ *
+ * Two passes : mean from pixel statistics (cached), then sum of squared
+ * deviations from the mean.
+ */
+errno_t info_statcache_rms(
+    imageID  ID,
+    double  *rms
+)
+{
+    STATCACHE_KEY key;
+    INFO_PIXSTATS pixstats;
+    int           cacheable = (data.image[ID].md[0].write == 0);
+
+    *rms = NAN;
+    statcache_key_snapshot(ID, &key);
+
+    if(cacheable)
+    {
+        pthread_mutex_lock(&statcache_mutex);
+        STATCACHE_ENTRY *entry = statcache_find(ID);
+        if((entry != NULL) && entry->rms_valid)
+        {
+            *rms = entry->rms;
+            pthread_mutex_unlock(&statcache_mutex);
+            return RETURN_SUCCESS;
+        }
+        pthread_mutex_unlock(&statcache_mutex);
+    }
+
+    if(info_statcache_pixstats(ID, &pixstats) != RETURN_SUCCESS)
+    {
+        return RETURN_FAILURE;
+    }
+
+    uint64_t nbvalid = pixstats.nelement - pixstats.NBnan - pixstats.NBinf;
+    if(nbvalid == 0)
+    {
+        return RETURN_SUCCESS;
+    }
+
+    double sumsqdev;
+    if(info_pixstats_sumsqdev(ID, 0, data.image[ID].md[0].nelement, NULL,
+                              pixstats.total / nbvalid, &sumsqdev) != RETURN_SUCCESS)
+    {
+        return RETURN_FAILURE;
+    }
+    *rms = sqrt(sumsqdev / nbvalid);
+
+    if(cacheable)
+    {
+        // stored only if image did not change during the scans
+        pthread_mutex_lock(&statcache_mutex);
+        STATCACHE_ENTRY *entry = statcache_get(&key);
+        if(entry != NULL)
+        {
+            entry->rms = *rms;
+            entry->rms_valid = 1;
+        }
+        pthread_mutex_unlock(&statcache_mutex);
+    }
+
+    return RETURN_SUCCESS;
+}
+
+
+
+
+/**
+ * @brief Percentiles of finite pixels of whole image
+ *
+ * values[k] is the value of rank (long)(p[k]*N) among the N finite pixels
+ * sorted in increasing order. The sorted copy is kept in cache if it fits
+ * in INFO_STATCACHE_SORTED_MAXBYTES.
+ */
+errno_t info_statcache_percentiles(
+    imageID       ID,
+    const double *p,
+    long          NBp,
+    double       *values
+)
+{
+    STATCACHE_KEY key;
+    uint64_t      nelement = data.image[ID].md[0].nelement;
+    int           cacheable = (data.image[ID].md[0].write == 0)
+                              && (sizeof(double) * nelement <= INFO_STATCACHE_SORTED_MAXBYTES);
+
+    if(info_pixstats_histo_supported(data.image[ID].md[0].datatype) == 1)
+    {
+        return info_pixstats_histo_percentiles(ID, 0, nelement, NULL, p, NBp, values);
+    }
+
+    statcache_key_snapshot(ID, &key);
+
+    if(cacheable)
+    {
+        pthread_mutex_lock(&statcache_mutex);
+        STATCACHE_ENTRY *entry = statcache_find(ID);
+        if((entry != NULL) && (entry->sorted != NULL))
+        {
+            statcache_read_percentiles(entry->sorted, entry->NBsorted, p, NBp, values);
+            pthread_mutex_unlock(&statcache_mutex);
+            return RETURN_SUCCESS;
+        }
+        pthread_mutex_unlock(&statcache_mutex);
+    }
+
+    double  *sorted = (double *) malloc(sizeof(double) * (nelement + 1));
+    uint64_t NBsorted;
+    if(sorted == NULL)
+    {
+        PRINT_ERROR("malloc error");
+        return RETURN_FAILURE;
+    }
+    if(info_pixstats_copy_double(ID, 0, nelement, NULL, sorted,
+                                 &NBsorted) != RETURN_SUCCESS)
+    {
+        free(sorted);
+        return RETURN_FAILURE;
+    }
+    if(!cacheable)
+    {
+        // copy is not kept : selection of the requested ranks only
+        if(NBsorted > 0)
+        {
+            info_select_percentiles_double(sorted, NBsorted, p, NBp, values);
+        }
+        else
+        {
+            statcache_read_percentiles(sorted, 0, p, NBp, values);
+        }
+        free(sorted);
+        return RETURN_SUCCESS;
+    }
+
+    quick_sort_double(sorted, NBsorted);
+
+    statcache_read_percentiles(sorted, NBsorted, p, NBp, values);
+
+    // stored only if image did not change during the copy
+    pthread_mutex_lock(&statcache_mutex);
+    STATCACHE_ENTRY *entry = statcache_get(&key);
+    if(entry != NULL)
+    {
+        statcache_clear_sorted(entry);
+        statcache_reserve_sorted(sizeof(double) * NBsorted, entry);
+        entry->sorted = sorted;
+        entry->NBsorted = NBsorted;
+        statcache_sortedbytes += sizeof(double) * NBsorted;
+        sorted = NULL;
+    }
+    pthread_mutex_unlock(&statcache_mutex);
+    free(sorted);
+
+    return RETURN_SUCCESS;
+}
+
+
+
+
+/**
+ * @brief Drop cached statistics of image ID
+ */
+errno_t info_statcache_invalidate(
+    imageID ID
+)
+{
+    pthread_mutex_lock(&statcache_mutex);
+    for(int i = 0; i < INFO_STATCACHE_NBENTRY; i++)
+    {
+        if(statcache[i].used && (statcache[i].key.ID == ID))
+        {
+            statcache_clear(&statcache[i]);
+        }
+    }
+    pthread_mutex_unlock(&statcache_mutex);
+
+    return RETURN_SUCCESS;
+}
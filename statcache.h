@@ -0,0 +1,43 @@
+/**
+ * @file    statcache.h
+ * @brief   Cache of whole-image statistics
+ *
+ */
+
+#if !defined(INFO_STATCACHE_H)
+#define INFO_STATCACHE_H
+
+#include "info/pixstats.h"
+
+
+// number of images with cached statistics
+#define INFO_STATCACHE_NBENTRY 16
+
+// total size of cached sorted pixel copies, bytes
+#define INFO_STATCACHE_SORTED_MAXBYTES (256UL * 1024 * 1024)
+
+
+
+errno_t info_statcache_pixstats(
+    imageID        ID,
+    INFO_PIXSTATS *pixstats
+);
+
+errno_t info_statcache_rms(
+    imageID  ID,
+    double  *rms
+);
+
+errno_t info_statcache_percentiles(
+    imageID       ID,
+    const double *p,
+    long          NBp,
+    double       *values
+);
+
+errno_t info_statcache_invalidate(
+    imageID ID
+);
+
+
+#endif
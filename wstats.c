@@ -0,0 +1,535 @@
+/**
+ * @file    wstats.c
+ * @brief   Weighted statistics with per-pixel weight map
+ *
+ * Weighted mean, variance and centroid are accumulated in a single pass
+ * reading the data and weight images side by side, with no intermediate
+ * product image. Each row is reduced to sums of w, w.v, w.v^2 and w.v.x in
+ * a vectorized loop ; rows containing a non-finite value or weight are
+ * scanned again with a branch-free mask (see pixstats.c). Rows are grouped
+ * in chunks combined pairwise in a fixed order, as in moments.c.
+ *
+ * Weight images can be float or double, data images of any real datatype.
+ * Pixels are used if value and weight are finite and weight is > 0 ; the
+ * same pixels enter mean, variance, centroid and percentiles.
+ *
+ * Weighted percentiles are obtained by weighted selection : (value, weight)
+ * pairs are partitioned as in select.c, descending into the side holding
+ * the target cumulative weight, in linear average time.
+ *
+ */
+
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <math.h>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+#include "CommandLineInterface/CLIcore.h"
+#include "COREMOD_memory/COREMOD_memory.h"
+
+#include "info/pixstats.h"
+#include "info/pixmask.h"
+#include "info/wstats.h"
+
+
+
+
+typedef struct
+{
+    double    sw;
+    double    swv;
+    double    swvv;
+    double    swvx;
+    double    swvy;
+    uint64_t  NBbad;   // pixels with non-finite value or weight, or weight <= 0
+} WSTATSSUMS;
+
+
+typedef struct
+{
+    double  v;
+    double  w;
+} WPIX;
+
+
+
+
+/* ================================================================== */
+/*            GENERIC KERNELS                                         */
+/* ================================================================== */
+
+// x is the coordinate of the first pixel, y the row coordinate, both
+// relative to the image center. Sums are added to wsums.
+//
+// A pixel is used if its value and weight are finite and its weight is
+// > 0, in all statistics : pixels with weight <= 0 are excluded from the
+// sums (not only weighted by 0) and counted as bad, as for percentiles.
+// Non-finite values with weight <= 0 propagate to the row sums, which are
+// then scanned again with the full test.
+
+#define INFO_WSTATS_KERNEL_W(TS, PIXTYPE, WTS, WTYPE)                         \
+                                                                              \
+static void wstats_span_##TS##_##WTS(                                         \
+    const PIXTYPE *restrict row,                                              \
+    const WTYPE   *restrict wrow,                                             \
+    uint64_t                nbpix,                                            \
+    double                  xstart,                                           \
+    double                  y,                                                \
+    WSTATSSUMS             *wsums                                             \
+)                                                                             \
+{                                                                             \
+    double   rw = 0.0;                                                        \
+    double   rwv = 0.0;                                                       \
+    double   rwvv = 0.0;                                                      \
+    double   rwvx = 0.0;                                                      \
+    uint64_t rbad = 0;                                                        \
+    INFO_PRAGMA_SIMD(reduction(+:rw,rwv,rwvv,rwvx,rbad))                      \
+    for(uint64_t ii = 0; ii < nbpix; ii++)                                    \
+    {                                                                         \
+        double v = (double) row[ii];                                          \
+        double w = (double) wrow[ii];                                         \
+        double wok = (w > 0.0) ? w : 0.0;                                     \
+        double wv = wok * v;                                                  \
+        rw += wok;                                                            \
+        rwv += wv;                                                            \
+        rwvv += wv * v;                                                       \
+        rwvx += wv * (xstart + (double) ii);                                  \
+        rbad += !(w > 0.0);                                                   \
+    }                                                                         \
+                                                                              \
+    if(!isfinite(rw + rwv + rwvv + rwvx))                                     \
+    {                                                                         \
+        rbad = 0;                                                             \
+        rw = 0.0;                                                             \
+        rwv = 0.0;                                                            \
+        rwvv = 0.0;                                                           \
+        rwvx = 0.0;                                                           \
+        INFO_PRAGMA_SIMD(reduction(+:rw,rwv,rwvv,rwvx,rbad))                  \
+        for(uint64_t ii = 0; ii < nbpix; ii++)                                \
+        {                                                                     \
+            double v = (double) row[ii];                                      \
+            double w = (double) wrow[ii];                                     \
+            int    ok = isfinite(v) && isfinite(w) && (w > 0.0);              \
+            double vok = ok ? v : 0.0;                                        \
+            double wok = ok ? w : 0.0;                                        \
+            double wv = wok * vok;                                            \
+            rw += wok;                                                        \
+            rwv += wv;                                                        \
+            rwvv += wv * vok;                                                 \
+            rwvx += wv * (xstart + (double) ii);                              \
+            rbad += !ok;                                                      \
+        }                                                                     \
+    }                                                                         \
+                                                                              \
+    wsums->NBbad += rbad;                                                     \
+    wsums->sw += rw;                                                          \
+    wsums->swv += rwv;                                                        \
+    wsums->swvv += rwvv;                                                      \
+    wsums->swvx += rwvx;                                                      \
+    wsums->swvy += y * rwv;                                                   \
+}                                                                             \
+                                                                              \
+static uint64_t wstats_copy_##TS##_##WTS(                                     \
+    const PIXTYPE *restrict array,                                            \
+    const WTYPE   *restrict warray,                                           \
+    uint64_t                nbpix,                                            \
+    WPIX          *restrict wpix                                              \
+)                                                                             \
+{                                                                             \
+    uint64_t nbcopy = 0;                                                      \
+                                                                              \
+    for(uint64_t ii = 0; ii < nbpix; ii++)                                    \
+    {                                                                         \
+        double v = (double) array[ii];                                        \
+        double w = (double) warray[ii];                                       \
+        if(isfinite(v) && isfinite(w) && (w > 0.0))                           \
+        {                                                                     \
+            wpix[nbcopy].v = v;                                               \
+            wpix[nbcopy].w = w;                                               \
+            nbcopy++;                                                         \
+        }                                                                     \
+    }                                                                         \
+    return nbcopy;                                                            \
+}
+
+
+#define INFO_WSTATS_KERNEL(TS, PIXTYPE, ...)                                  \
+    INFO_WSTATS_KERNEL_W(TS, PIXTYPE, F, float)                               \
+    INFO_WSTATS_KERNEL_W(TS, PIXTYPE, D, double)
+
+INFO_PIXSTATS_TYPELIST(INFO_WSTATS_KERNEL)
+
+
+
+
+static int wstats_check_weight(
+    imageID   ID,
+    imageID   IDw,
+    uint64_t  woffset,
+    uint64_t  nbpix
+)
+{
+    uint8_t wdatatype = data.image[IDw].md[0].datatype;
+
+    if(info_pixstats_datatype_supported(data.image[ID].md[0].datatype) == 0)
+    {
+        PRINT_ERROR("datatype %d not supported",
+                    (int) data.image[ID].md[0].datatype);
+        return 0;
+    }
+    if((wdatatype != _DATATYPE_FLOAT) && (wdatatype != _DATATYPE_DOUBLE))
+    {
+        PRINT_ERROR("weight image must be float or double");
+        return 0;
+    }
+    if(woffset + nbpix > data.image[IDw].md[0].nelement)
+    {
+        PRINT_ERROR("weight image too small");
+        return 0;
+    }
+
+    return 1;
+}
+
+
+
+
+/**
+ * @brief Weighted mean, variance and centroid of the 2D plane at offset
+ *
+ * Weights are read from image IDw starting at woffset : woffset = offset
+ * for a weight cube matching the data cube, or 0 to apply a single weight
+ * map to each slice. Pixels with non-finite value or weight are skipped.
+ */
+errno_t info_wstats_compute(
+    imageID      ID,
+    uint64_t     offset,
+    imageID      IDw,
+    uint64_t     woffset,
+    INFO_WSTATS *wstats
+)
+{
+    uint32_t     xsize = data.image[ID].md[0].size[0];
+    uint32_t     ysize = 1;
+    INFO_PIXMASK planemask;
+
+    if(data.image[ID].md[0].naxis > 1)
+    {
+        ysize = data.image[ID].md[0].size[1];
+    }
+
+    if(wstats_check_weight(ID, IDw, woffset, (uint64_t) xsize * ysize) == 0)
+    {
+        return RETURN_FAILURE;
+    }
+
+    if(info_pixmask_build_roi(&planemask, xsize, ysize, 0, xsize, 0,
+                              ysize) != RETURN_SUCCESS)
+    {
+        return RETURN_FAILURE;
+    }
+
+    double x0 = 0.5 * (xsize - 1);
+    double y0 = 0.5 * (ysize - 1);
+
+    long NBchunk = planemask.NBchunk;
+    WSTATSSUMS *partial = (WSTATSSUMS *) calloc(NBchunk + 1, sizeof(WSTATSSUMS));
+    if(partial == NULL)
+    {
+        PRINT_ERROR("calloc error");
+        info_pixmask_free(&planemask);
+        return RETURN_FAILURE;
+    }
+
+    int NBthreads = info_pixstats_get_NBthreads();
+    (void) NBthreads;
+
+#ifdef _OPENMP
+    #pragma omp parallel for schedule(static) num_threads(NBthreads) if(NBchunk > 1)
+#endif
+    for(long chunk = 0; chunk < NBchunk; chunk++)
+    {
+        for(long spanindex = planemask.chunkspan[chunk];
+                spanindex < planemask.chunkspan[chunk + 1]; spanindex++)
+        {
+            uint64_t start = planemask.span[spanindex].start;
+            uint64_t length = planemask.span[spanindex].length;
+            double   xstart = (double)(start % xsize) - x0;
+            double   y = (double)(start / xsize) - y0;
+
+            if(data.image[IDw].md[0].datatype == _DATATYPE_FLOAT)
+            {
+                switch(data.image[ID].md[0].datatype)
+                {
+#define INFO_WSTATS_CASE_F(TS, PIXTYPE, DTYPE, ...)                         \
+                    case DTYPE:                                             \
+                        wstats_span_##TS##_F(data.image[ID].array.TS +      \
+                                             offset + start,                \
+                                             data.image[IDw].array.F +      \
+                                             woffset + start,               \
+                                             length, xstart, y,             \
+                                             &partial[chunk]);              \
+                        break;
+                        INFO_PIXSTATS_TYPELIST(INFO_WSTATS_CASE_F)
+#undef INFO_WSTATS_CASE_F
+                }
+            }
+            else
+            {
+                switch(data.image[ID].md[0].datatype)
+                {
+#define INFO_WSTATS_CASE_D(TS, PIXTYPE, DTYPE, ...)                         \
+                    case DTYPE:                                             \
+                        wstats_span_##TS##_D(data.image[ID].array.TS +      \
+                                             offset + start,                \
+                                             data.image[IDw].array.D +      \
+                                             woffset + start,               \
+                                             length, xstart, y,             \
+                                             &partial[chunk]);              \
+                        break;
+                        INFO_PIXSTATS_TYPELIST(INFO_WSTATS_CASE_D)
+#undef INFO_WSTATS_CASE_D
+                }
+            }
+        }
+    }
+
+    // pairwise combination, fixed order
+    for(long stride = 1; stride < NBchunk; stride *= 2)
+    {
+        for(long chunk = 0; chunk + stride < NBchunk; chunk += 2 * stride)
+        {
+            WSTATSSUMS *a = &partial[chunk];
+            WSTATSSUMS *b = &partial[chunk + stride];
+
+            a->sw += b->sw;
+            a->swv += b->swv;
+            a->swvv += b->swvv;
+            a->swvx += b->swvx;
+            a->swvy += b->swvy;
+            a->NBbad += b->NBbad;
+        }
+    }
+    WSTATSSUMS ws = partial[0];
+    uint64_t NBpix = planemask.NBpix;
+    free(partial);
+    info_pixmask_free(&planemask);
+
+    wstats->NBpix = NBpix - ws.NBbad;
+    wstats->sumw = ws.sw;
+    wstats->mean = ws.swv / ws.sw;
+    wstats->variance = ws.swvv / ws.sw - wstats->mean * wstats->mean;
+    if(wstats->variance < 0.0)
+    {
+        wstats->variance = 0.0;
+    }
+    wstats->rms = sqrt(wstats->variance);
+    wstats->xc = x0 + ws.swvx / ws.swv;
+    wstats->yc = y0 + ws.swvy / ws.swv;
+
+    return RETURN_SUCCESS;
+}
+
+
+
+
+// value at which cumulative weight of sorted pairs first exceeds target
+static double wstats_select(
+    WPIX     *wpix,
+    uint64_t  n,
+    double    target
+)
+{
+    uint64_t left = 0;
+    uint64_t right = n - 1;
+    double   acc = 0.0;   // weight of pairs before left
+
+    while(right - left > 16)
+    {
+        uint64_t mid = left + (right - left) / 2;
+        double   a = wpix[left].v;
+        double   b = wpix[mid].v;
+        double   c = wpix[right].v;
+        double   pivot = (a < b) ? ((b < c) ? b : ((a < c) ? c : a))
+                         : ((a < c) ? a : ((b < c) ? c : b));
+        WPIX     tmp;
+
+        uint64_t i = left;
+        uint64_t j = right;
+        for(;;)
+        {
+            while(wpix[i].v < pivot)
+            {
+                i++;
+            }
+            while(pivot < wpix[j].v)
+            {
+                j--;
+            }
+            if(i >= j)
+            {
+                break;
+            }
+            tmp = wpix[i];
+            wpix[i] = wpix[j];
+            wpix[j] = tmp;
+            i++;
+            j--;
+        }
+
+        // [left, j] <= pivot <= [j+1, right]
+        double wleft = 0.0;
+        for(uint64_t ii = left; ii <= j; ii++)
+        {
+            wleft += wpix[ii].w;
+        }
+        if(acc + wleft > target)
+        {
+            right = j;
+        }
+        else
+        {
+            acc += wleft;
+            left = j + 1;
+        }
+    }
+
+    for(uint64_t i = left + 1; i <= right; i++)
+    {
+        WPIX     p = wpix[i];
+        uint64_t j = i;
+        while((j > left) && (p.v < wpix[j - 1].v))
+        {
+            wpix[j] = wpix[j - 1];
+            j--;
+        }
+        wpix[j] = p;
+    }
+    for(uint64_t i = left; i < right; i++)
+    {
+        acc += wpix[i].w;
+        if(acc > target)
+        {
+            return wpix[i].v;
+        }
+    }
+    return wpix[right].v;
+}
+
+
+
+
+/**
+ * @brief Weighted percentiles of pixels [offset, offset+nbpix[
+ *
+ * values[k] is the smallest pixel value at which the cumulative weight of
+ * pixels sorted by value exceeds p[k] times the total weight. With unit
+ * weights, this is the pixel of rank (long)(p[k]*N) as for unweighted
+ * percentiles. Pixels with non-finite value or weight, or weight <= 0,
+ * are ignored.
+ */
+errno_t info_wstats_percentiles(
+    imageID       ID,
+    uint64_t      offset,
+    imageID       IDw,
+    uint64_t      woffset,
+    uint64_t      nbpix,
+    const double *p,
+    long          NBp,
+    double       *values
+)
+{
+    uint64_t n = 0;
+
+    if(wstats_check_weight(ID, IDw, woffset, nbpix) == 0)
+    {
+        return RETURN_FAILURE;
+    }
+
+    WPIX *wpix = (WPIX *) malloc(sizeof(WPIX) * (nbpix + 1));
+    if(wpix == NULL)
+    {
+        PRINT_ERROR("malloc error");
+        return RETURN_FAILURE;
+    }
+
+    if(data.image[IDw].md[0].datatype == _DATATYPE_FLOAT)
+    {
+        switch(data.image[ID].md[0].datatype)
+        {
+#define INFO_WSTATS_CASE_COPY_F(TS, PIXTYPE, DTYPE, ...)                    \
+            case DTYPE:                                                     \
+                n = wstats_copy_##TS##_F(data.image[ID].array.TS + offset,  \
+                                         data.image[IDw].array.F + woffset, \
+                                         nbpix, wpix);                      \
+                break;
+                INFO_PIXSTATS_TYPELIST(INFO_WSTATS_CASE_COPY_F)
+#undef INFO_WSTATS_CASE_COPY_F
+        }
+    }
+    else
+    {
+        switch(data.image[ID].md[0].datatype)
+        {
+#define INFO_WSTATS_CASE_COPY_D(TS, PIXTYPE, DTYPE, ...)                    \
+            case DTYPE:                                                     \
+                n = wstats_copy_##TS##_D(data.image[ID].array.TS + offset,  \
+                                         data.image[IDw].array.D + woffset, \
+                                         nbpix, wpix);                      \
+                break;
+                INFO_PIXSTATS_TYPELIST(INFO_WSTATS_CASE_COPY_D)
+#undef INFO_WSTATS_CASE_COPY_D
+        }
+    }
+
+    double sumw = 0.0;
+    for(uint64_t i = 0; i < n; i++)
+    {
+        sumw += wpix[i].w;
+    }
+
+    for(long k = 0; k < NBp; k++)
+    {
+        values[k] = NAN;
+        if(n > 0)
+        {
+            values[k] = wstats_select(wpix, n, p[k] * sumw);
+        }
+    }
+    free(wpix);
+
+    return RETURN_SUCCESS;
+}
+
+
+
+
+errno_t info_image_wstats(
+    const char  *ID_name,
+    const char  *IDw_name,
+    INFO_WSTATS *wstats
+)
+{
+    imageID ID;
+    imageID IDw;
+
+    ID = image_ID(ID_name);
+    if(ID == -1)
+    {
+        PRINT_ERROR("image %s not found", ID_name);
+        return RETURN_FAILURE;
+    }
+    IDw = image_ID(IDw_name);
+    if(IDw == -1)
+    {
+        PRINT_ERROR("image %s not found", IDw_name);
+        return RETURN_FAILURE;
+    }
+
+    return info_wstats_compute(ID, 0, IDw, 0, wstats);
+}
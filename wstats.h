@@ -0,0 +1,50 @@
+/**
+ * @file    wstats.h
+ * @brief   Weighted statistics with per-pixel weight map
+ *
+ */
+
+#if !defined(INFO_WSTATS_H)
+#define INFO_WSTATS_H
+
+
+typedef struct
+{
+    uint64_t  NBpix;      // pixels with finite value and weight, weight > 0
+    double    sumw;       // sum of weights
+    double    mean;       // sum(w.v) / sum(w)
+    double    variance;   // sum(w.(v-mean)^2) / sum(w)
+    double    rms;        // sqrt(variance)
+    double    xc;         // centroid of w.v [pix]
+    double    yc;
+} INFO_WSTATS;
+
+
+
+errno_t info_wstats_compute(
+    imageID      ID,
+    uint64_t     offset,
+    imageID      IDw,
+    uint64_t     woffset,
+    INFO_WSTATS *wstats
+);
+
+errno_t info_wstats_percentiles(
+    imageID       ID,
+    uint64_t      offset,
+    imageID       IDw,
+    uint64_t      woffset,
+    uint64_t      nbpix,
+    const double *p,
+    long          NBp,
+    double       *values
+);
+
+errno_t info_image_wstats(
+    const char  *ID_name,
+    const char  *IDw_name,
+    INFO_WSTATS *wstats
+);
+
+
+#endif